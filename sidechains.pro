@@ -70,6 +70,7 @@ HEADERS += src/addrdb.h \
            src/serialize.h \
            src/sidechain.h \
            src/sidechainclient.h \
+           src/sidechainperf.h \
            src/streams.h \
            src/sync.h \
            src/threadinterrupt.h \
@@ -106,6 +107,7 @@ HEADERS += src/addrdb.h \
            src/crypto/common.h \
            src/crypto/hmac_sha256.h \
            src/crypto/hmac_sha512.h \
+           src/crypto/muhash.h \
            src/crypto/ripemd160.h \
            src/crypto/sha1.h \
            src/crypto/sha256.h \
@@ -159,6 +161,7 @@ HEADERS += src/addrdb.h \
            src/qt/sendcoinsdialog.h \
            src/qt/sendcoinsentry.h \
            src/qt/sidechainbmmtablemodel.h \
+           src/qt/sidechainnotifier.h \
            src/qt/sidechainpage.h \
            src/qt/sidechainwtprimehistorydialog.h \
            src/qt/sidechainwtprimehistorytablemodel.h \
@@ -305,6 +308,7 @@ HEADERS += src/addrdb.h \
            src/secp256k1/src/testrand.h \
            src/secp256k1/src/testrand_impl.h \
            src/secp256k1/src/util.h \
+           src/support/allocators/pool.h \
            src/support/allocators/secure.h \
            src/support/allocators/zeroafterfree.h \
            src/univalue/include/univalue.h \
@@ -395,6 +399,7 @@ SOURCES += src/addrdb.cpp \
            src/scheduler.cpp \
            src/sidechain.cpp \
            src/sidechainclient.cpp \
+           src/sidechainperf.cpp \
            src/sync.cpp \
            src/testchain-cli.cpp \
            src/testchain-tx.cpp \
@@ -424,6 +429,7 @@ SOURCES += src/addrdb.cpp \
            src/bench/crypto_hash.cpp \
            src/bench/Examples.cpp \
            src/bench/lockedpool.cpp \
+           src/bench/merkle_root.cpp \
            src/bench/mempool_eviction.cpp \
            src/bench/perf.cpp \
            src/bench/prevector_destructor.cpp \
@@ -439,10 +445,14 @@ SOURCES += src/addrdb.cpp \
            src/crypto/chacha20.cpp \
            src/crypto/hmac_sha256.cpp \
            src/crypto/hmac_sha512.cpp \
+           src/crypto/muhash.cpp \
            src/crypto/ripemd160.cpp \
            src/crypto/sha1.cpp \
            src/crypto/sha256.cpp \
            src/crypto/sha256_sse4.cpp \
+           src/crypto/sha256_sse41.cpp \
+           src/crypto/sha256_avx2.cpp \
+           src/crypto/sha256_shani.cpp \
            src/crypto/sha512.cpp \
            src/policy/corepolicy.cpp \
            src/policy/feerate.cpp \
@@ -490,6 +500,7 @@ SOURCES += src/addrdb.cpp \
            src/qt/sendcoinsdialog.cpp \
            src/qt/sendcoinsentry.cpp \
            src/qt/sidechainbmmtablemodel.cpp \
+           src/qt/sidechainnotifier.cpp \
            src/qt/sidechainpage.cpp \
            src/qt/sidechainwtprimehistorydialog.cpp \
            src/qt/sidechainwtprimehistorytablemodel.cpp \
@@ -85,3 +85,40 @@ static void CCoinsCaching(benchmark::State& state)
 }
 
 BENCHMARK(CCoinsCaching, 170 * 1000);
+
+// Microbenchmark for AccessCoin on the standard script templates, which the
+// cache decompresses on every access when built with --enable-compact-coins.
+static void CCoinsAccess(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+
+    std::vector<CScript> vScript;
+    vScript.push_back(CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG);
+    vScript.push_back(CScript() << OP_HASH160 << std::vector<unsigned char>(20, 2) << OP_EQUAL);
+    vScript.push_back(CScript() << OP_0 << std::vector<unsigned char>(20, 3));
+    vScript.push_back(CScript() << OP_0 << std::vector<unsigned char>(32, 4));
+    vScript.push_back(CScript() << std::vector<unsigned char>(33, 2) << OP_CHECKSIG);
+
+    std::vector<COutPoint> vOutpoint;
+    for (unsigned int i = 0; i < 1000; i++) {
+        uint256 hash;
+        *hash.begin() = i & 0xff;
+        *(hash.begin() + 1) = i >> 8;
+        vOutpoint.emplace_back(hash, i);
+        Coin coin;
+        coin.out.nValue = CENT;
+        coin.out.scriptPubKey = vScript[i % vScript.size()];
+        coin.nHeight = i;
+        coins.AddCoin(vOutpoint.back(), std::move(coin), false);
+    }
+
+    while (state.KeepRunning()) {
+        CAmount nValue = 0;
+        for (const COutPoint& outpoint : vOutpoint)
+            nValue += coins.AccessCoin(outpoint).out.nValue;
+        assert(nValue == 1000 * CENT);
+    }
+}
+
+BENCHMARK(CCoinsAccess, 10 * 1000);
@@ -10,6 +10,7 @@
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include <random.h>
+#include <crypto/sha256.h>
 
 
 static const int MIN_CORES = 2;
@@ -60,3 +61,53 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+// This Benchmark measures how the CheckQueue scales with the number of
+// worker threads, with checks that take a few microseconds each, roughly
+// like a signature check.
+struct HashJob {
+    unsigned char data[64];
+    HashJob() {}
+    bool operator()()
+    {
+        for (int i = 0; i < 16; ++i)
+            SHA256D64(data, data, 1);
+        return true;
+    }
+    void swap(HashJob& x) { std::swap(data, x.data); }
+};
+
+static void CCheckQueueSpeedHashJob(benchmark::State& state, int nThreads)
+{
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    // The master thread is one of the threads checking
+    for (auto x = 0; x < nThreads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashJob> control(&queue);
+        std::vector<std::vector<HashJob>> vBatches(BATCHES);
+        for (auto& vChecks : vBatches) {
+            vChecks.resize(BATCH_SIZE);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueSpeedHashJob_1(benchmark::State& state) { CCheckQueueSpeedHashJob(state, 1); }
+static void CCheckQueueSpeedHashJob_2(benchmark::State& state) { CCheckQueueSpeedHashJob(state, 2); }
+static void CCheckQueueSpeedHashJob_4(benchmark::State& state) { CCheckQueueSpeedHashJob(state, 4); }
+static void CCheckQueueSpeedHashJob_8(benchmark::State& state) { CCheckQueueSpeedHashJob(state, 8); }
+static void CCheckQueueSpeedHashJob_16(benchmark::State& state) { CCheckQueueSpeedHashJob(state, 16); }
+static void CCheckQueueSpeedHashJob_32(benchmark::State& state) { CCheckQueueSpeedHashJob(state, 32); }
+
+BENCHMARK(CCheckQueueSpeedHashJob_1, 50);
+BENCHMARK(CCheckQueueSpeedHashJob_2, 50);
+BENCHMARK(CCheckQueueSpeedHashJob_4, 50);
+BENCHMARK(CCheckQueueSpeedHashJob_8, 50);
+BENCHMARK(CCheckQueueSpeedHashJob_16, 50);
+BENCHMARK(CCheckQueueSpeedHashJob_32, 50);
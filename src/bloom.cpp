@@ -310,3 +310,42 @@ void CRollingBloomFilter::reset()
         *it = 0;
     }
 }
+
+CHashBloomFilter::CHashBloomFilter(const unsigned int nElements, const double fpRate)
+{
+    nMaxElements = std::max(nElements, 1u);
+    nInserted = 0;
+    /* The optimal number of hash functions is log(fpRate) / log(0.5), but
+     * restrict it to the range 1-50. */
+    nHashFuncs = std::max(1, std::min((int)round(log(fpRate) / log(0.5)), 50));
+    /* nFilterBits = -nElements * log(fpRate) / log(2)^2 */
+    uint64_t nFilterBits = (uint64_t)ceil(-1.0 * nMaxElements * log(fpRate) / (log(2) * log(2)));
+    data.resize((nFilterBits + 63) / 64);
+    k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    k1 = GetRand(std::numeric_limits<uint64_t>::max());
+}
+
+void CHashBloomFilter::insert(const uint256& hash)
+{
+    /* Double hashing: bit n is h1 + n * h2 */
+    uint64_t h1 = SipHashUint256(k0, k1, hash);
+    uint64_t h2 = SipHashUint256Extra(k0, k1, hash, 1) | 1;
+    for (int n = 0; n < nHashFuncs; n++) {
+        uint64_t pos = (h1 + n * h2) % (data.size() * 64);
+        data[pos >> 6] |= ((uint64_t)1) << (pos & 0x3F);
+    }
+    nInserted++;
+}
+
+bool CHashBloomFilter::contains(const uint256& hash) const
+{
+    uint64_t h1 = SipHashUint256(k0, k1, hash);
+    uint64_t h2 = SipHashUint256Extra(k0, k1, hash, 1) | 1;
+    for (int n = 0; n < nHashFuncs; n++) {
+        uint64_t pos = (h1 + n * h2) % (data.size() * 64);
+        if (!((data[pos >> 6] >> (pos & 0x3F)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
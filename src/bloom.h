@@ -140,4 +140,38 @@ private:
     int nHashFuncs;
 };
 
+/**
+ * A bloom filter of hashes with a random salt, for checking whether an object
+ * might be in a database before reading it.
+ *
+ * Unlike CBloomFilter it is not limited to the protocol size, and unlike
+ * CRollingBloomFilter it never forgets an element. The false positive rate
+ * rises above nFPRate once more than nElements elements have been inserted,
+ * so callers should rebuild it with a larger nElements when it is full.
+ */
+class CHashBloomFilter
+{
+public:
+    // A random bloom filter calls GetRand() at creation time.
+    // Don't create global CHashBloomFilter objects, as they may be
+    // constructed before the randomizer is properly initialized.
+    CHashBloomFilter(const unsigned int nElements, const double nFPRate);
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+
+    //! True if more than nElements elements have been inserted
+    bool IsFull() const { return nInserted > nMaxElements; }
+
+    unsigned int GetMaxElements() const { return nMaxElements; }
+
+private:
+    unsigned int nMaxElements;
+    unsigned int nInserted;
+    int nHashFuncs;
+    uint64_t k0;
+    uint64_t k1;
+    std::vector<uint64_t> data;
+};
+
 #endif // BITCOIN_BLOOM_H
@@ -1,15 +1,83 @@
 #include <bmmcache.h>
 
+#include <crypto/common.h>
+#include <hash.h>
 #include <primitives/block.h>
+#include <streams.h>
 #include <util.h>
 
+// Size of a serialized journal entry: type, index, hash & checksum
+static const size_t BMM_JOURNAL_ENTRY_SIZE = 1 + 4 + 32 + 4;
+
 BMMCache::BMMCache()
 {
+    pjournal = nullptr;
+}
 
+void BMMCache::SetJournal(BMMCacheJournal* journal)
+{
+    LOCK(cs_cache);
+    pjournal = journal;
+}
+
+bool BMMCache::ApplyJournalEntry(uint8_t type, uint32_t nIndex, const uint256& hash)
+{
+    LOCK(cs_cache);
+
+    switch (type) {
+    case BMM_JOURNAL_VERIFIED_BMM:
+        setBMMVerified.insert(hash);
+        return true;
+    case BMM_JOURNAL_VERIFIED_DEPOSIT:
+        setDepositVerified.insert(hash);
+        return true;
+    case BMM_JOURNAL_BROADCASTED_BUNDLE:
+        setWithdrawalBundleBroadcasted.insert(hash);
+        return true;
+    case BMM_JOURNAL_WITHDRAWAL_ID:
+        setWITHDRAWALIDCache.insert(hash);
+        return true;
+    case BMM_JOURNAL_MAIN_BLOCK:
+        // The journal can't skip over blocks
+        if (nIndex > vMainBlockHash.size())
+            return false;
+    {
+        TruncateMainBlockCache(nIndex);
+        vMainBlockHash.push_back(hash);
+
+        MainBlockIndex index;
+        index.hash = hash;
+        index.index = nIndex;
+
+        mapMainBlock[hash] = index;
+        return true;
+    }
+    case BMM_JOURNAL_MAIN_TRUNCATE:
+        TruncateMainBlockCache(nIndex);
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t BMMCache::GetPersistedCaches(BMMCacheSnapshot& snapshot) const
+{
+    LOCK(cs_cache);
+
+    snapshot.vBroadcastedWithdrawalBundle.assign(setWithdrawalBundleBroadcasted.begin(), setWithdrawalBundleBroadcasted.end());
+    snapshot.vVerifiedBMM.assign(setBMMVerified.begin(), setBMMVerified.end());
+    snapshot.vVerifiedDeposit.assign(setDepositVerified.begin(), setDepositVerified.end());
+    snapshot.vMainBlockHash = vMainBlockHash;
+    snapshot.setWithdrawalID = setWITHDRAWALIDCache;
+
+    // Every mutation is journaled while holding cs_cache
+    return pjournal ? pjournal->GetEntryCount() : 0;
 }
 
 bool BMMCache::StoreBMMBlock(const CBlock& block)
 {
+    LOCK(cs_cache);
+
     if (!block.vtx.size())
         return false;
 
@@ -26,6 +94,8 @@ bool BMMCache::StoreBMMBlock(const CBlock& block)
 
 bool BMMCache::GetBMMBlock(const uint256& hashMerkleRoot, CBlock& block)
 {
+    LOCK(cs_cache);
+
     if (mapBMMBlocks.find(hashMerkleRoot) == mapBMMBlocks.end())
         return false;
 
@@ -36,6 +106,8 @@ bool BMMCache::GetBMMBlock(const uint256& hashMerkleRoot, CBlock& block)
 
 std::vector<CBlock> BMMCache::GetBMMBlockCache() const
 {
+    LOCK(cs_cache);
+
     std::vector<CBlock> vBlock;
     for (const auto& b : mapBMMBlocks) {
         vBlock.push_back(b.second);
@@ -45,6 +117,8 @@ std::vector<CBlock> BMMCache::GetBMMBlockCache() const
 
 std::vector<uint256> BMMCache::GetBroadcastedWithdrawalBundleCache() const
 {
+    LOCK(cs_cache);
+
     std::vector<uint256> vHash;
     for (const auto& u : setWithdrawalBundleBroadcasted) {
         vHash.push_back(u);
@@ -54,11 +128,14 @@ std::vector<uint256> BMMCache::GetBroadcastedWithdrawalBundleCache() const
 
 std::vector<uint256> BMMCache::GetMainBlockHashCache() const
 {
+    LOCK(cs_cache);
     return vMainBlockHash;
 }
 
 std::vector<uint256> BMMCache::GetRecentMainBlockHashes() const
 {
+    LOCK(cs_cache);
+
     // Return up to three of the most recent mainchain block hashes
     std::vector<uint256> vHash;
     std::vector<uint256>::const_reverse_iterator rit = vMainBlockHash.rbegin();
@@ -73,21 +150,28 @@ std::vector<uint256> BMMCache::GetRecentMainBlockHashes() const
 
 void BMMCache::ClearBMMBlocks()
 {
+    LOCK(cs_cache);
     mapBMMBlocks.clear();
 }
 
 void BMMCache::StoreBroadcastedWithdrawalBundle(const uint256& hashWithdrawalBundle)
 {
-    setWithdrawalBundleBroadcasted.insert(hashWithdrawalBundle);
+    LOCK(cs_cache);
+
+    if (setWithdrawalBundleBroadcasted.insert(hashWithdrawalBundle).second && pjournal)
+        pjournal->Append(BMM_JOURNAL_BROADCASTED_BUNDLE, 0, hashWithdrawalBundle);
 }
 
 void BMMCache::StorePrevBlockBMMCreated(const uint256& hashPrevBlock)
 {
+    LOCK(cs_cache);
     setPrevBlockBMMCreated.insert(hashPrevBlock);
 }
 
 bool BMMCache::HaveBroadcastedWithdrawalBundle(const uint256& hashWithdrawalBundle) const
 {
+    LOCK(cs_cache);
+
     if (hashWithdrawalBundle.IsNull())
         return false;
 
@@ -99,6 +183,8 @@ bool BMMCache::HaveBroadcastedWithdrawalBundle(const uint256& hashWithdrawalBund
 
 bool BMMCache::HaveVerifiedBMM(const uint256& hashBlock) const
 {
+    LOCK(cs_cache);
+
     if (hashBlock.IsNull())
         return false;
 
@@ -107,14 +193,19 @@ bool BMMCache::HaveVerifiedBMM(const uint256& hashBlock) const
 
 void BMMCache::CacheVerifiedBMM(const uint256& hashBlock)
 {
+    LOCK(cs_cache);
+
     if (hashBlock.IsNull())
         return;
 
-    setBMMVerified.insert(hashBlock);
+    if (setBMMVerified.insert(hashBlock).second && pjournal)
+        pjournal->Append(BMM_JOURNAL_VERIFIED_BMM, 0, hashBlock);
 }
 
 bool BMMCache::HaveVerifiedDeposit(const uint256& txid) const
 {
+    LOCK(cs_cache);
+
     if (txid.IsNull())
         return false;
 
@@ -123,14 +214,19 @@ bool BMMCache::HaveVerifiedDeposit(const uint256& txid) const
 
 void BMMCache::CacheVerifiedDeposit(const uint256& txid)
 {
+    LOCK(cs_cache);
+
     if (txid.IsNull())
         return;
 
-    setDepositVerified.insert(txid);
+    if (setDepositVerified.insert(txid).second && pjournal)
+        pjournal->Append(BMM_JOURNAL_VERIFIED_DEPOSIT, 0, txid);
 }
 
 std::vector<uint256> BMMCache::GetVerifiedBMMCache() const
 {
+    LOCK(cs_cache);
+
     std::vector<uint256> vHash;
     for (const auto& u : setBMMVerified) {
         vHash.push_back(u);
@@ -140,6 +236,8 @@ std::vector<uint256> BMMCache::GetVerifiedBMMCache() const
 
 std::vector<uint256> BMMCache::GetVerifiedDepositCache() const
 {
+    LOCK(cs_cache);
+
     std::vector<uint256> vHash;
     for (const auto& u : setDepositVerified) {
         vHash.push_back(u);
@@ -149,6 +247,8 @@ std::vector<uint256> BMMCache::GetVerifiedDepositCache() const
 
 void BMMCache::CacheMainBlockHash(const uint256& hash)
 {
+    LOCK(cs_cache);
+
     // Don't re-cache the genesis block
     if (vMainBlockHash.size() == 1 && hash == vMainBlockHash.front())
         return;
@@ -162,10 +262,15 @@ void BMMCache::CacheMainBlockHash(const uint256& hash)
     index.index = vMainBlockHash.size() - 1;
 
     mapMainBlock[hash] = index;
+
+    if (pjournal)
+        pjournal->Append(BMM_JOURNAL_MAIN_BLOCK, index.index, hash);
 }
 
 bool BMMCache::UpdateMainBlockCache(std::deque<uint256>& deqHashNew, bool& fReorg, std::vector<uint256>& vOrphan)
 {
+    LOCK(cs_cache);
+
     if (deqHashNew.empty()) {
         LogPrintf("%s: Error - called with empty list of new block hashes!\n", __func__);
         return false;
@@ -192,6 +297,7 @@ bool BMMCache::UpdateMainBlockCache(std::deque<uint256>& deqHashNew, bool& fReor
         fReorg = true;
     }
 
+    size_t nSizeBefore = vMainBlockHash.size();
     for (size_t i = vMainBlockHash.size() - 1; i > index.index; i--) {
         vOrphan.push_back(vMainBlockHash[i]);
         vMainBlockHash.pop_back();
@@ -201,6 +307,9 @@ bool BMMCache::UpdateMainBlockCache(std::deque<uint256>& deqHashNew, bool& fReor
     for (const uint256& u : vOrphan)
         mapMainBlock.erase(u);
 
+    if (vMainBlockHash.size() != nSizeBefore && pjournal)
+        pjournal->Append(BMM_JOURNAL_MAIN_TRUNCATE, vMainBlockHash.size(), uint256());
+
     // It's possible that the first block in the list of new blocks (which
     // connects to our cached chain by a prevblock) was already cached.
     // The first block that connected by prevblock to one of our cached blocks
@@ -223,6 +332,8 @@ bool BMMCache::UpdateMainBlockCache(std::deque<uint256>& deqHashNew, bool& fReor
 
 uint256 BMMCache::GetLastMainBlockHash() const
 {
+    LOCK(cs_cache);
+
     if (vMainBlockHash.empty())
         return uint256();
 
@@ -231,6 +342,8 @@ uint256 BMMCache::GetLastMainBlockHash() const
 
 uint256 BMMCache::GetMainPrevBlockHash(const uint256& hashBlock) const
 {
+    LOCK(cs_cache);
+
     if (vMainBlockHash.size() < 2)
         return uint256();
 
@@ -252,11 +365,14 @@ uint256 BMMCache::GetMainPrevBlockHash(const uint256& hashBlock) const
 
 int BMMCache::GetCachedBlockCount() const
 {
+    LOCK(cs_cache);
     return vMainBlockHash.size();
 }
 
 int BMMCache::GetMainchainBlockHeight(const uint256& hash) const
 {
+    LOCK(cs_cache);
+
     if (!mapMainBlock.count(hash))
         return -1;
 
@@ -267,41 +383,234 @@ int BMMCache::GetMainchainBlockHeight(const uint256& hash) const
 
 bool BMMCache::HaveMainBlock(const uint256& hash) const
 {
+    LOCK(cs_cache);
     return mapMainBlock.count(hash);
 }
 
 bool BMMCache::HaveBMMRequestForPrevBlock(const uint256& hashPrevBlock) const
 {
+    LOCK(cs_cache);
     return setPrevBlockBMMCreated.count(hashPrevBlock);
 }
 
 void BMMCache::AddCheckedMainBlock(const uint256& hashBlock)
 {
+    LOCK(cs_cache);
     setMainBlockChecked.insert(hashBlock);
 }
 
 bool BMMCache::MainBlockChecked(const uint256& hashBlock) const
 {
+    LOCK(cs_cache);
     return setMainBlockChecked.count(hashBlock);
 }
 
 void BMMCache::ResetMainBlockCache()
 {
+    LOCK(cs_cache);
+
     vMainBlockHash.clear();
     mapMainBlock.clear();
+
+    if (pjournal)
+        pjournal->Append(BMM_JOURNAL_MAIN_TRUNCATE, 0, uint256());
+}
+
+void BMMCache::ResetPersistedCaches()
+{
+    LOCK(cs_cache);
+
+    setBMMVerified.clear();
+    setDepositVerified.clear();
+    setWithdrawalBundleBroadcasted.clear();
+    setWITHDRAWALIDCache.clear();
+    ResetMainBlockCache();
 }
 
 void BMMCache::CacheWithdrawalID(const uint256& wtid)
 {
-    setWITHDRAWALIDCache.insert(wtid);
+    LOCK(cs_cache);
+
+    if (setWITHDRAWALIDCache.insert(wtid).second && pjournal)
+        pjournal->Append(BMM_JOURNAL_WITHDRAWAL_ID, 0, wtid);
 }
 
 std::set<uint256> BMMCache::GetCachedWithdrawalID()
 {
+    LOCK(cs_cache);
     return setWITHDRAWALIDCache;
 }
 
 bool BMMCache::IsMyWT(const uint256& wtid)
 {
+    LOCK(cs_cache);
     return setWITHDRAWALIDCache.count(wtid);
 }
+
+void BMMCache::TruncateMainBlockCache(size_t nSize)
+{
+    while (vMainBlockHash.size() > nSize) {
+        mapMainBlock.erase(vMainBlockHash.back());
+        vMainBlockHash.pop_back();
+    }
+}
+
+BMMCacheJournal::BMMCacheJournal()
+{
+    file = nullptr;
+    nOffsetStart = 0;
+    nEntries = 0;
+}
+
+BMMCacheJournal::~BMMCacheJournal()
+{
+    Close();
+}
+
+bool BMMCacheJournal::Open(const fs::path& path)
+{
+    LOCK(cs_journal);
+
+    if (file)
+        fclose(file);
+
+    pathJournal = path;
+    nEntries = 0;
+
+    file = fsbridge::fopen(path, "ab");
+    if (!file) {
+        LogPrintf("%s: Failed to open BMM cache journal: %s\n", __func__, path.string());
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    nOffsetStart = ftell(file);
+
+    return true;
+}
+
+void BMMCacheJournal::Close()
+{
+    LOCK(cs_journal);
+
+    if (!file)
+        return;
+
+    FileCommit(file);
+    fclose(file);
+    file = nullptr;
+}
+
+bool BMMCacheJournal::IsOpen() const
+{
+    LOCK(cs_journal);
+    return file != nullptr;
+}
+
+bool BMMCacheJournal::Append(uint8_t type, uint32_t nIndex, const uint256& hash)
+{
+    CDataStream ss(SER_DISK, 0);
+    ss << type;
+    ss << nIndex;
+    ss << hash;
+
+    uint256 hashChecksum = Hash(ss.begin(), ss.end());
+    ss << ReadLE32(hashChecksum.begin());
+
+    LOCK(cs_journal);
+
+    if (!file)
+        return false;
+
+    // Flush each entry to the OS so that it survives the process crashing.
+    // The file is only fsync'd when the journal is closed or reset.
+    if (fwrite(ss.data(), 1, ss.size(), file) != ss.size() || fflush(file) != 0) {
+        LogPrintf("%s: Failed to write to BMM cache journal!\n", __func__);
+        return false;
+    }
+
+    nEntries++;
+
+    return true;
+}
+
+bool BMMCacheJournal::Reset(size_t nEntriesWritten)
+{
+    LOCK(cs_journal);
+
+    if (!file)
+        return false;
+
+    // Read entries which were appended after the caches were written
+    std::vector<char> vchKeep;
+    if (nEntriesWritten < nEntries) {
+        vchKeep.resize((nEntries - nEntriesWritten) * BMM_JOURNAL_ENTRY_SIZE);
+        FILE* filein = fsbridge::fopen(pathJournal, "rb");
+        bool fRead = filein && fseek(filein, nOffsetStart + nEntriesWritten * BMM_JOURNAL_ENTRY_SIZE, SEEK_SET) == 0
+            && fread(vchKeep.data(), 1, vchKeep.size(), filein) == vchKeep.size();
+        if (filein)
+            fclose(filein);
+        if (!fRead) {
+            LogPrintf("%s: Failed to read BMM cache journal: %s\n", __func__, pathJournal.string());
+            return false;
+        }
+    }
+
+    fclose(file);
+
+    nOffsetStart = 0;
+    nEntries = vchKeep.size() / BMM_JOURNAL_ENTRY_SIZE;
+
+    file = fsbridge::fopen(pathJournal, "wb");
+    if (!file) {
+        LogPrintf("%s: Failed to reset BMM cache journal: %s\n", __func__, pathJournal.string());
+        return false;
+    }
+    if (!vchKeep.empty())
+        fwrite(vchKeep.data(), 1, vchKeep.size(), file);
+    FileCommit(file);
+
+    return true;
+}
+
+size_t BMMCacheJournal::GetEntryCount() const
+{
+    LOCK(cs_journal);
+    return nEntries;
+}
+
+size_t BMMCacheJournal::Replay(const fs::path& path, BMMCache& cache)
+{
+    FILE* filein = fsbridge::fopen(path, "rb");
+    if (!filein)
+        return 0;
+
+    size_t nApplied = 0;
+    std::vector<char> vch(BMM_JOURNAL_ENTRY_SIZE);
+    while (fread(vch.data(), 1, vch.size(), filein) == vch.size()) {
+        CDataStream ss(vch.data(), vch.data() + vch.size(), SER_DISK, 0);
+
+        uint8_t type;
+        uint32_t nIndex;
+        uint256 hash;
+        uint32_t nChecksum;
+        ss >> type;
+        ss >> nIndex;
+        ss >> hash;
+        ss >> nChecksum;
+
+        uint256 hashChecksum = Hash(vch.begin(), vch.end() - 4);
+        if (nChecksum != ReadLE32(hashChecksum.begin())) {
+            LogPrintf("%s: Invalid checksum, stopping replay after %u entries\n", __func__, nApplied);
+            break;
+        }
+
+        if (!cache.ApplyJournalEntry(type, nIndex, hash)) {
+            LogPrintf("%s: Invalid entry, stopping replay after %u entries\n", __func__, nApplied);
+            break;
+        }
+        nApplied++;
+    }
+    fclose(filein);
+
+    return nApplied;
+}
@@ -1,6 +1,8 @@
 #ifndef BITCOIN_BMMCACHE_H
 #define BITCOIN_BMMCACHE_H
 
+#include "fs.h"
+#include "sync.h"
 #include "uint256.h"
 
 #include <deque>
@@ -8,6 +10,7 @@
 #include <set>
 #include <vector>
 
+class BMMCacheJournal;
 class CBlock;
 
 struct MainBlockIndex
@@ -16,11 +19,45 @@ struct MainBlockIndex
     uint256 hash;
 };
 
+/** Type of a BMMCacheJournal entry */
+enum BMMJournalEntryType : uint8_t
+{
+    BMM_JOURNAL_VERIFIED_BMM = 0,
+    BMM_JOURNAL_VERIFIED_DEPOSIT = 1,
+    BMM_JOURNAL_BROADCASTED_BUNDLE = 2,
+    BMM_JOURNAL_WITHDRAWAL_ID = 3,
+    // Set mainchain block hash at index and drop any hashes after it
+    BMM_JOURNAL_MAIN_BLOCK = 4,
+    // Keep only the first index mainchain block hashes
+    BMM_JOURNAL_MAIN_TRUNCATE = 5,
+};
+
+/** Copy of the BMMCache contents which are written to the cache files */
+struct BMMCacheSnapshot
+{
+    std::vector<uint256> vBroadcastedWithdrawalBundle;
+    std::vector<uint256> vVerifiedBMM;
+    std::vector<uint256> vVerifiedDeposit;
+    std::vector<uint256> vMainBlockHash;
+    std::set<uint256> setWithdrawalID;
+};
+
 class BMMCache
 {
 public:
     BMMCache();
 
+    // Record future mutations of persisted caches to journal (or stop
+    // recording if journal is null)
+    void SetJournal(BMMCacheJournal* journal);
+
+    // Apply a journal entry read back from disk. Not recorded to the journal.
+    bool ApplyJournalEntry(uint8_t type, uint32_t nIndex, const uint256& hash);
+
+    // Copy the persisted caches at once and return the number of journal
+    // entries the copy covers, entries appended later aren't in it
+    size_t GetPersistedCaches(BMMCacheSnapshot& snapshot) const;
+
     bool StoreBMMBlock(const CBlock& block);
 
     bool GetBMMBlock(const uint256& hashMerkleRoot, CBlock& block);
@@ -81,6 +118,13 @@ public:
 
     void ResetMainBlockCache();
 
+    // Clear every cache persisted by the journal. Only the main block cache
+    // reset is journaled, the journal must be compacted afterwards.
+    void ResetPersistedCaches();
+
+    // Withdrawal IDs created before wallets stored their own withdrawals.
+    // Nothing adds new ones, wallets index their withdrawals from their
+    // transactions instead, see CWallet::SyncWithdrawals().
     void CacheWithdrawalID(const uint256& wtid);
 
     std::set<uint256> GetCachedWithdrawalID();
@@ -88,6 +132,14 @@ public:
     bool IsMyWT(const uint256& wtid);
 
 private:
+    void TruncateMainBlockCache(size_t nSize);
+
+    // Protects the journal pointer and every cache below, which are used
+    // from several threads
+    mutable CCriticalSection cs_cache;
+
+    BMMCacheJournal* pjournal;
+
     // BMM blocks that we have created with the intention of connecting to the
     // side blockchain once the BMM h* hash is included on the mainchain
     std::map<uint256 /* hashMerkleRoot */, CBlock> mapBMMBlocks;
@@ -125,4 +177,55 @@ private:
     std::set<uint256> setWITHDRAWALIDCache;
 };
 
+/**
+ * Append-only journal of BMMCache mutations which are persisted across
+ * restarts (verified BMM & deposits, broadcasted bundles, withdrawal IDs and
+ * the mainchain block hash cache). Entries are written as they happen so that
+ * the caches survive an unclean shutdown. The journal is replayed on top of
+ * the cache files written by the last compaction.
+ *
+ * Every entry is checksummed, replay stops at the first torn or corrupt entry.
+ * Main block entries store absolute positions so replaying entries which were
+ * already compacted into the cache files is harmless.
+ */
+class BMMCacheJournal
+{
+public:
+    BMMCacheJournal();
+    ~BMMCacheJournal();
+
+    // Open the journal at path for appending
+    bool Open(const fs::path& path);
+
+    void Close();
+
+    bool IsOpen() const;
+
+    bool Append(uint8_t type, uint32_t nIndex, const uint256& hash);
+
+    // Discard the first nEntriesWritten entries appended since the journal
+    // was opened or reset, called after the caches have been written out.
+    // Entries appended while the caches were being written are kept.
+    bool Reset(size_t nEntriesWritten);
+
+    // Number of entries appended since the journal was opened or reset
+    size_t GetEntryCount() const;
+
+    // Apply entries of the journal at path to cache. Returns the number of
+    // entries applied.
+    static size_t Replay(const fs::path& path, BMMCache& cache);
+
+private:
+    mutable CCriticalSection cs_journal;
+
+    FILE* file;
+
+    fs::path pathJournal;
+
+    // Offset of the first entry appended since the journal was opened
+    long nOffsetStart;
+
+    size_t nEntries;
+};
+
 #endif // BITCOIN_BMMCACHE_H
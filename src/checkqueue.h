@@ -8,6 +8,8 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -16,6 +18,19 @@
 template <typename T>
 class CCheckQueueControl;
 
+/**
+ * Order of verifications which fail. Specialize it for a type whose
+ * verifications are ordered (like the inputs of one transaction): once one
+ * has failed, those before it are still run, and Wait() hands back the first
+ * of them which failed, whichever thread got to it. By default the first
+ * failure to be recorded is kept and the rest is skipped.
+ */
+template <typename T>
+struct CheckQueueOrder {
+    static const bool fOrdered = false;
+    static bool Before(const T&, const T&) { return false; }
+};
+
 /** 
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
@@ -25,12 +40,38 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker has its own deque of verifications, and the master hands
+  * each batch to the next worker in turn. A worker takes from the back of
+  * its own deque, and when that is empty it steals from the front of the
+  * deque of another worker. The shared mutex is only taken to sleep and to
+  * wake up sleeping threads, so workers don't contend on it while there is
+  * work left.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Deques beyond this are shared by several workers
+    static const int MAX_WORKER_QUEUES = 64;
+
+    //! The verifications handed to one worker
+    struct WorkerQueue {
+        boost::mutex mutex;
+        std::deque<T> checks;
+        //! Size of checks, readable without the lock
+        std::atomic<size_t> nSize{0};
+    };
+
+    WorkerQueue vQueues[MAX_WORKER_QUEUES];
+
+    //! The number of worker threads which ever started (the master excluded).
+    std::atomic<int> nWorkers;
+
+    //! The deque the next batch is added to
+    unsigned int nNextQueue;
+
+    //! Mutex to sleep on and to protect nIdle
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,87 +80,160 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
+    //! The number of workers (the master excluded) that are idle.
     int nIdle;
 
-    //! The total number of workers (including the master).
-    int nTotal;
-
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
+
+    //! Protects checkFailed and fHaveFailed
+    boost::mutex mutexFailed;
+
+    //! The first verification which failed, handed to the master by Wait()
+    T checkFailed;
+    bool fHaveFailed;
+
+    //! Number of verifications in the deques, not yet taken by a thread.
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * This includes elements that are no longer queued, but still being
+     * verified or destroyed by a thread.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! The maximum number of elements to be processed in one batch
+    //! The maximum number of elements to be stolen at once
     unsigned int nBatchSize;
 
+    int NumQueues() const
+    {
+        const int n = nWorkers;
+        return n < 1 ? 1 : (n > MAX_WORKER_QUEUES ? MAX_WORKER_QUEUES : n);
+    }
+
+    //! Take the newest verification of a deque.
+    bool Pop(WorkerQueue& q, std::vector<T>& vChecks)
+    {
+        if (q.nSize == 0)
+            return false;
+        boost::unique_lock<boost::mutex> lock(q.mutex);
+        if (q.checks.empty())
+            return false;
+        vChecks.resize(1);
+        vChecks[0].swap(q.checks.back());
+        q.checks.pop_back();
+        q.nSize = q.checks.size();
+        nQueued--;
+        return true;
+    }
+
+    //! Take the oldest half of a deque, but no more than nBatchSize.
+    bool Steal(WorkerQueue& q, std::vector<T>& vChecks)
+    {
+        if (q.nSize == 0)
+            return false;
+        boost::unique_lock<boost::mutex> lock(q.mutex);
+        if (q.checks.empty())
+            return false;
+        unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)(q.checks.size() + 1) / 2));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // We want the lock on the mutex to be as short as possible, so swap jobs from the
+            // deque to the local batch vector instead of copying.
+            vChecks[i].swap(q.checks.front());
+            q.checks.pop_front();
+        }
+        q.nSize = q.checks.size();
+        nQueued -= nNow;
+        return true;
+    }
+
+    //! Find work, starting with the own deque (if any) and then the next ones.
+    bool Take(int nOwn, std::vector<T>& vChecks)
+    {
+        if (nOwn >= 0 && Pop(vQueues[nOwn], vChecks))
+            return true;
+        const int nQueues = NumQueues();
+        for (int i = 1; i <= nQueues; i++) {
+            int nVictim = (std::max(nOwn, 0) + i) % nQueues;
+            if (nVictim != nOwn && Steal(vQueues[nVictim], vChecks))
+                return true;
+        }
+        return false;
+    }
+
+    //! Keep the first verification (in CheckQueueOrder) which fails, the others are destroyed.
+    void KeepFailed(T& check)
+    {
+        boost::unique_lock<boost::mutex> lock(mutexFailed);
+        if (!fHaveFailed || CheckQueueOrder<T>::Before(check, checkFailed)) {
+            checkFailed.swap(check);
+            fHaveFailed = true;
+        }
+    }
+
+    //! Whether a verification comes before the one which failed so far.
+    bool BeforeFailed(const T& check)
+    {
+        boost::unique_lock<boost::mutex> lock(mutexFailed);
+        return fHaveFailed && CheckQueueOrder<T>::Before(check, checkFailed);
+    }
+
+    //! Run and destroy a batch, then account for it.
+    void Execute(std::vector<T>& vChecks, bool fMaster)
+    {
+        bool fOk = fAllOk;
+        for (T& check : vChecks) {
+            if (fOk || (CheckQueueOrder<T>::fOrdered && BeforeFailed(check))) {
+                if (!check()) {
+                    fOk = false;
+                    KeepFailed(check);
+                }
+            }
+        }
+        if (!fOk)
+            fAllOk = false;
+        const unsigned int nNow = vChecks.size();
+        vChecks.clear();
+        if ((nTodo -= nNow) == 0 && !fMaster) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        // The master steals from every deque, a worker owns one
+        const int nOwn = fMaster ? -1 : nWorkers++ % MAX_WORKER_QUEUES;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
+            if (Take(nOwn, vChecks)) {
+                Execute(vChecks, fMaster);
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                while (nQueued == 0) {
+                    if (nTodo == 0) {
                         bool fRet = fAllOk;
                         // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
+                        fAllOk = true;
                         // return the current status
                         return fRet;
                     }
+                    condMaster.wait(lock);
+                }
+            } else {
+                while (nQueued == 0) {
                     nIdle++;
-                    cond.wait(lock); // wait
+                    condWorker.wait(lock); // wait
                     nIdle--;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
@@ -128,7 +242,7 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : nWorkers(0), nNextQueue(0), nIdle(0), fAllOk(true), fHaveFailed(false), nQueued(0), nTodo(0), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
@@ -136,24 +250,50 @@ public:
         Loop();
     }
 
-    //! Wait until execution finishes, and return whether all evaluations were successful.
-    bool Wait()
+    /**
+     * Wait until execution finishes, and return whether all evaluations were
+     * successful. If one failed and pfailed isn't null, the first verification
+     * (in CheckQueueOrder) which failed is swapped into it, so that only it has
+     * to be looked at again.
+     */
+    bool Wait(T* pfailed = nullptr)
     {
-        return Loop(true);
+        bool fRet = Loop(true);
+        // Every verification is done, nothing else touches checkFailed now
+        boost::unique_lock<boost::mutex> lock(mutexFailed);
+        if (fHaveFailed) {
+            if (pfailed)
+                pfailed->swap(checkFailed);
+            T().swap(checkFailed);
+            fHaveFailed = false;
+        }
+        return fRet;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
+        // Count the checks as queued before they are, so a worker which
+        // doesn't find them yet retries instead of going to sleep
+        nQueued += vChecks.size();
+        {
+            WorkerQueue& q = vQueues[nNextQueue++ % (unsigned int)NumQueues()];
+            boost::unique_lock<boost::mutex> lock(q.mutex);
+            for (T& check : vChecks) {
+                q.checks.push_back(T());
+                check.swap(q.checks.back());
+            }
+            q.nSize = q.checks.size();
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nIdle == 0)
+            return;
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -186,11 +326,11 @@ public:
         }
     }
 
-    bool Wait()
+    bool Wait(T* pfailed = nullptr)
     {
         if (pqueue == nullptr)
             return true;
-        bool fRet = pqueue->Wait();
+        bool fRet = pqueue->Wait(pfailed);
         fDone = true;
         return fRet;
     }
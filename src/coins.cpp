@@ -6,6 +6,8 @@
 
 #include <consensus/consensus.h>
 #include <random.h>
+#include <streams.h>
+#include <version.h>
 
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
@@ -29,9 +31,197 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
+void CompactCoin::CopyFrom(const CompactCoin& other)
+{
+    memcpy(vchValue, other.vchValue, sizeof(vchValue));
+    memcpy(vchCode, other.vchCode, sizeof(vchCode));
+    nScriptType = other.nScriptType;
+    memcpy(vchScript, other.vchScript, sizeof(vchScript));
+}
+
+CompactCoin::CompactCoin(const CompactCoin& other) : nScriptType(0)
+{
+    *this = other;
+}
+
+CompactCoin::CompactCoin(CompactCoin&& other) noexcept
+{
+    CopyFrom(other);
+    // The heap script, if any, now belongs to us
+    other.nScriptType = 0;
+}
+
+CompactCoin& CompactCoin::operator=(const CompactCoin& other)
+{
+    if (this == &other)
+        return *this;
+    FreeScript();
+    CopyFrom(other);
+    if (nScriptType == SCRIPT_INDIRECT) {
+        uint32_t nSize;
+        const unsigned char* pchOther = other.GetIndirect(nSize);
+        unsigned char* pch = new unsigned char[nSize];
+        memcpy(pch, pchOther, nSize);
+        memcpy(vchScript, &pch, sizeof(pch));
+    }
+    return *this;
+}
+
+CompactCoin& CompactCoin::operator=(CompactCoin&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+    FreeScript();
+    CopyFrom(other);
+    other.nScriptType = 0;
+    return *this;
+}
+
+void CompactCoin::Set(const Coin& coin)
+{
+    uint32_t nCode = coin.nHeight * 2 + coin.fCoinBase;
+    memcpy(vchValue, &coin.out.nValue, sizeof(vchValue));
+    memcpy(vchCode, &nCode, sizeof(vchCode));
+    SetScript(coin.out.scriptPubKey);
+}
+
+void CompactCoin::SetScript(const CScript& script)
+{
+    FreeScript();
+
+    const unsigned int nSize = script.size();
+    if (nSize == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+            script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+        nScriptType = SCRIPT_P2PKH;
+        memcpy(vchScript, &script[3], 20);
+    } else if (nSize == 23 && script[0] == OP_HASH160 && script[1] == 20 && script[22] == OP_EQUAL) {
+        nScriptType = SCRIPT_P2SH;
+        memcpy(vchScript, &script[2], 20);
+    } else if (nSize == 22 && script[0] == OP_0 && script[1] == 20) {
+        nScriptType = SCRIPT_P2WPKH;
+        memcpy(vchScript, &script[2], 20);
+    } else if (nSize == 34 && script[0] == OP_0 && script[1] == 32) {
+        nScriptType = SCRIPT_P2WSH;
+        memcpy(vchScript, &script[2], 32);
+    } else if (nSize == 35 && script[0] == 33 && (script[1] == 0x02 || script[1] == 0x03) && script[34] == OP_CHECKSIG) {
+        nScriptType = SCRIPT_P2PK;
+        memcpy(vchScript, &script[1], 33);
+    } else if (nSize <= DIRECT_SIZE) {
+        nScriptType = nSize;
+        if (nSize)
+            memcpy(vchScript, script.data(), nSize);
+    } else {
+        nScriptType = SCRIPT_INDIRECT;
+        unsigned char* pch = new unsigned char[nSize];
+        uint32_t nSize32 = nSize;
+        memcpy(pch, script.data(), nSize);
+        memcpy(vchScript, &pch, sizeof(pch));
+        memcpy(vchScript + sizeof(pch), &nSize32, sizeof(nSize32));
+    }
+}
+
+const unsigned char* CompactCoin::GetIndirect(uint32_t& nSize) const
+{
+    assert(nScriptType == SCRIPT_INDIRECT);
+    unsigned char* pch;
+    memcpy(&pch, vchScript, sizeof(pch));
+    memcpy(&nSize, vchScript + sizeof(pch), sizeof(nSize));
+    return pch;
+}
+
+void CompactCoin::FreeScript()
+{
+    if (nScriptType == SCRIPT_INDIRECT) {
+        uint32_t nSize;
+        delete[] GetIndirect(nSize);
+    }
+    nScriptType = 0;
+}
+
+void CompactCoin::Clear()
+{
+    FreeScript();
+    const CAmount nValue = -1;
+    const uint32_t nCode = 0;
+    memcpy(vchValue, &nValue, sizeof(vchValue));
+    memcpy(vchCode, &nCode, sizeof(vchCode));
+}
+
+bool CompactCoin::IsSpent() const
+{
+    CAmount nValue;
+    memcpy(&nValue, vchValue, sizeof(nValue));
+    return nValue == -1;
+}
+
+void CompactCoin::Decompress(Coin& coin) const
+{
+    uint32_t nCode;
+    memcpy(&coin.out.nValue, vchValue, sizeof(vchValue));
+    memcpy(&nCode, vchCode, sizeof(nCode));
+    coin.nHeight = nCode >> 1;
+    coin.fCoinBase = nCode & 1;
+
+    CScript& script = coin.out.scriptPubKey;
+    switch (nScriptType) {
+    case SCRIPT_P2PKH:
+        script.resize(25);
+        script[0] = OP_DUP;
+        script[1] = OP_HASH160;
+        script[2] = 20;
+        memcpy(&script[3], vchScript, 20);
+        script[23] = OP_EQUALVERIFY;
+        script[24] = OP_CHECKSIG;
+        break;
+    case SCRIPT_P2SH:
+        script.resize(23);
+        script[0] = OP_HASH160;
+        script[1] = 20;
+        memcpy(&script[2], vchScript, 20);
+        script[22] = OP_EQUAL;
+        break;
+    case SCRIPT_P2WPKH:
+        script.resize(22);
+        script[0] = OP_0;
+        script[1] = 20;
+        memcpy(&script[2], vchScript, 20);
+        break;
+    case SCRIPT_P2WSH:
+        script.resize(34);
+        script[0] = OP_0;
+        script[1] = 32;
+        memcpy(&script[2], vchScript, 32);
+        break;
+    case SCRIPT_P2PK:
+        script.resize(35);
+        script[0] = 33;
+        memcpy(&script[1], vchScript, 33);
+        script[34] = OP_CHECKSIG;
+        break;
+    case SCRIPT_INDIRECT: {
+        uint32_t nSize;
+        const unsigned char* pch = GetIndirect(nSize);
+        script.assign(pch, pch + nSize);
+        break;
+    }
+    default:
+        script.assign(vchScript, vchScript + nScriptType);
+    }
+}
+
+size_t CompactCoin::DynamicMemoryUsage() const
+{
+    if (nScriptType != SCRIPT_INDIRECT)
+        return 0;
+    uint32_t nSize;
+    GetIndirect(nSize);
+    return memusage::MallocUsage(nSize);
+}
+
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn),
+    cacheCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource), cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -57,7 +247,7 @@ CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const
 bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
-        coin = it->second.coin;
+        it->second.GetCoin(coin);
         return !coin.IsSpent();
     }
     return false;
@@ -100,7 +290,7 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     if (it == cacheCoins.end()) return false;
     cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
     if (moveout) {
-        *moveout = std::move(it->second.coin);
+        it->second.MoveCoin(*moveout);
     }
     if (it->second.flags & CCoinsCacheEntry::FRESH) {
         cacheCoins.erase(it);
@@ -113,12 +303,12 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
 
 static const Coin coinEmpty;
 
-const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
+CoinAccess CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
         return coinEmpty;
     } else {
-        return it->second.coin;
+        return it->second.GetCoin();
     }
 }
 
@@ -132,6 +322,14 @@ bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
     return (it != cacheCoins.end() && !it->second.coin.IsSpent());
 }
 
+void CCoinsViewCache::PrefetchCoin(const COutPoint &outpoint, Coin&& coin) {
+    if (coin.IsSpent())
+        return;
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (ret.second)
+        cachedCoinsUsage += ret.first->second.coin.DynamicMemoryUsage();
+}
+
 uint256 CCoinsViewCache::GetBestBlock() const {
     if (hashBlock.IsNull())
         hashBlock = base->GetBestBlock();
@@ -202,11 +400,70 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
-    cacheCoins.clear();
+    ReallocateCache();
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+bool CCoinsViewCache::Sync() {
+    // Hand the base a copy of the modified entries, the base is allowed to
+    // consume the map it is given
+    CCoinsMapMemoryResource resource;
+    CCoinsMap mapDirty(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            ++it;
+            continue;
+        }
+        mapDirty.emplace(it->first, it->second);
+        if (it->second.coin.IsSpent()) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    return base->BatchWrite(mapDirty, hashBlock);
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    // The map has to be destroyed before the resource it allocates from
+    cacheCoins.~CCoinsMap();
+    cacheCoinsMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&cacheCoinsMemoryResource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource);
+}
+
+void CCoinsViewCache::Trim(size_t nMaxUsage)
+{
+    if (DynamicMemoryUsage() <= nMaxUsage)
+        return;
+
+    // Modified coins first, then as many unmodified ones as fit
+    CCoinsMapMemoryResource resource;
+    CCoinsMap mapKeep(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+    size_t nKeepCoinsUsage = 0;
+    for (int nPass = 0; nPass < 2; nPass++) {
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ++it) {
+            if ((it->second.flags == 0) != (nPass == 1))
+                continue;
+            size_t nCoinUsage = it->second.coin.DynamicMemoryUsage();
+            if (nPass == 1 && memusage::DynamicUsage(mapKeep) + nKeepCoinsUsage + nCoinUsage > nMaxUsage)
+                break;
+            mapKeep.emplace(it->first, std::move(it->second));
+            nKeepCoinsUsage += nCoinUsage;
+        }
+    }
+
+    ReallocateCache();
+    cacheCoins.reserve(mapKeep.size());
+    for (CCoinsMap::iterator it = mapKeep.begin(); it != mapKeep.end(); ++it)
+        cacheCoins.emplace(it->first, std::move(it->second));
+    cachedCoinsUsage = nKeepCoinsUsage;
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -247,7 +504,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 static const size_t MIN_TRANSACTION_OUTPUT_WEIGHT = WITNESS_SCALE_FACTOR * ::GetSerializeSize(CTxOut(), SER_NETWORK, PROTOCOL_VERSION);
 static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_WEIGHT / MIN_TRANSACTION_OUTPUT_WEIGHT;
 
-const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
+CoinAccess AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
 {
     COutPoint iter(txid, 0);
     while (iter.n < MAX_OUTPUTS_PER_BLOCK) {
@@ -257,3 +514,44 @@ const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
     }
     return coinEmpty;
 }
+
+static uint64_t GetBogoSize(const Coin& coin)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + coin.out.scriptPubKey.size() /* scriptPubKey */;
+}
+
+static CDataStream SerializeHashedCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << (uint32_t)(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    return ss;
+}
+
+void CCoinsRollingStats::AddCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = SerializeHashedCoin(outpoint, coin);
+    muhash.Insert((const unsigned char*)ss.data(), ss.size());
+    nTransactionOutputs++;
+    nBogoSize += GetBogoSize(coin);
+    nTotalAmount += coin.out.nValue;
+}
+
+void CCoinsRollingStats::RemoveCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = SerializeHashedCoin(outpoint, coin);
+    muhash.Remove((const unsigned char*)ss.data(), ss.size());
+    nTransactionOutputs--;
+    nBogoSize -= GetBogoSize(coin);
+    nTotalAmount -= coin.out.nValue;
+}
+
+uint256 CCoinsRollingStats::GetHash() const
+{
+    MuHash3072 muhashFinal = muhash;
+    uint256 hash;
+    muhashFinal.Finalize(hash);
+    return hash;
+}
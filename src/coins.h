@@ -6,12 +6,18 @@
 #ifndef BITCOIN_COINS_H
 #define BITCOIN_COINS_H
 
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
 #include <primitives/transaction.h>
 #include <compressor.h>
 #include <core_memusage.h>
+#include <crypto/muhash.h>
 #include <hash.h>
 #include <memusage.h>
 #include <serialize.h>
+#include <support/allocators/pool.h>
 #include <uint256.h>
 
 #include <assert.h>
@@ -81,6 +87,76 @@ public:
     }
 };
 
+/**
+ * Compact in-memory form of a Coin, used for the entries of CCoinsViewCache
+ * when built with --enable-compact-coins.
+ *
+ * Scripts matching a standard template (P2PKH, P2SH, P2WPKH, P2WSH and P2PK
+ * with a compressed key) only store their 20, 32 or 33 byte payload and are
+ * rebuilt when the coin is decompressed. Other scripts of up to DIRECT_SIZE
+ * bytes are stored inline, longer ones on the heap.
+ *
+ * All members are byte arrays, so the object has no padding and the flags of
+ * a cache entry fit right behind it.
+ */
+class CompactCoin
+{
+private:
+    //! Longest script stored inline, a compressed public key fits
+    static const unsigned int DIRECT_SIZE = 33;
+
+    //! Script encodings, a type up to DIRECT_SIZE is the length of an inline script
+    enum ScriptType : unsigned char {
+        SCRIPT_INDIRECT = DIRECT_SIZE + 1,
+        SCRIPT_P2PKH,
+        SCRIPT_P2SH,
+        SCRIPT_P2WPKH,
+        SCRIPT_P2WSH,
+        SCRIPT_P2PK,
+    };
+
+    unsigned char vchValue[sizeof(CAmount)];
+    //! nHeight * 2 + fCoinBase, like the serialized Coin
+    unsigned char vchCode[sizeof(uint32_t)];
+    unsigned char nScriptType;
+    //! Inline script, template payload or the pointer & size of a heap script
+    unsigned char vchScript[DIRECT_SIZE];
+
+    //! Shallow copy, a heap script is shared afterwards
+    void CopyFrom(const CompactCoin& other);
+    void SetScript(const CScript& script);
+    void FreeScript();
+    const unsigned char* GetIndirect(uint32_t& nSize) const;
+
+public:
+    CompactCoin() : nScriptType(0) { Clear(); }
+    explicit CompactCoin(const Coin& coin) : nScriptType(0) { Set(coin); }
+    CompactCoin(const CompactCoin& other);
+    CompactCoin(CompactCoin&& other) noexcept;
+    ~CompactCoin() { FreeScript(); }
+
+    CompactCoin& operator=(const CompactCoin& other);
+    CompactCoin& operator=(CompactCoin&& other) noexcept;
+    CompactCoin& operator=(const Coin& coin) { Set(coin); return *this; }
+
+    void Set(const Coin& coin);
+
+    //! Mark the coin as spent, see Coin::Clear()
+    void Clear();
+
+    bool IsSpent() const;
+
+    void Decompress(Coin& coin) const;
+
+    Coin Decompress() const {
+        Coin coin;
+        Decompress(coin);
+        return coin;
+    }
+
+    size_t DynamicMemoryUsage() const;
+};
+
 class SaltedOutpointHasher
 {
 private:
@@ -100,9 +176,20 @@ public:
     }
 };
 
+#ifdef ENABLE_COMPACT_COINS
+//! Cached coins are decompressed when they are read, so reads return a copy
+typedef Coin CoinAccess;
+#else
+typedef const Coin& CoinAccess;
+#endif
+
 struct CCoinsCacheEntry
 {
+#ifdef ENABLE_COMPACT_COINS
+    CompactCoin coin; // The actual cached data.
+#else
     Coin coin; // The actual cached data.
+#endif
     unsigned char flags;
 
     enum Flags {
@@ -117,9 +204,29 @@ struct CCoinsCacheEntry
 
     CCoinsCacheEntry() : flags(0) {}
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
+
+#ifdef ENABLE_COMPACT_COINS
+    CoinAccess GetCoin() const { return coin.Decompress(); }
+    void GetCoin(Coin& coinOut) const { coin.Decompress(coinOut); }
+    void MoveCoin(Coin& coinOut) { coin.Decompress(coinOut); }
+#else
+    CoinAccess GetCoin() const { return coin; }
+    void GetCoin(Coin& coinOut) const { coinOut = coin; }
+    void MoveCoin(Coin& coinOut) { coinOut = std::move(coin); }
+#endif
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * The nodes of the coins cache are allocated from a pool, which avoids the
+ * malloc overhead of every node and lets us account for the memory used
+ * exactly. The block size leaves room for the node's next pointer and cached
+ * hash.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                      sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4>
+    CCoinsMapAllocator;
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -206,6 +313,8 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* Must be declared before cacheCoins, which allocates from it */
+    mutable CCoinsMapMemoryResource cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
@@ -236,17 +345,22 @@ public:
      */
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
+    /**
+     * Add a coin which was read from the base view to the cache, unless the
+     * cache already has an entry for it. This lets the base view be read
+     * from other threads ahead of using the coins.
+     */
+    void PrefetchCoin(const COutPoint &outpoint, Coin&& coin);
+
     /**
      * Return a reference to Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
      *
-     * Generally, do not hold the reference returned for more than a short scope.
-     * While the current implementation allows for modifications to the contents
-     * of the cache while holding the reference, this behavior should not be relied
-     * on! To be safe, best to not hold the returned reference through any other
-     * calls to this cache.
+     * With compact coins (see CompactCoin) a decompressed copy is returned
+     * instead, bind the result to a const reference rather than to a member
+     * of it.
      */
-    const Coin& AccessCoin(const COutPoint &output) const;
+    CoinAccess AccessCoin(const COutPoint &output) const;
 
     /**
      * Add a coin. Set potential_overwrite to true if a non-pruned version may
@@ -268,6 +382,28 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush(),
+     * but keep the coins in memory. Spent coins are removed and the others
+     * are kept as unmodified entries, so the cache stays warm.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync();
+
+    /**
+     * Free the memory of the cache. The pool the cache allocates from only
+     * releases memory when it is destroyed, so this replaces both.
+     */
+    void ReallocateCache();
+
+    /**
+     * Evict unmodified coins until the cache uses no more than nMaxUsage,
+     * keeping the others. Modified coins are always kept. The kept coins are
+     * moved to a new pool, as the old one only releases memory when it is
+     * destroyed.
+     */
+    void Trim(size_t nMaxUsage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -309,6 +445,38 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool
 // This function can be quite expensive because in the event of a transaction
 // which is not found in the cache, it can cause up to MAX_OUTPUTS_PER_BLOCK
 // lookups to database, so it should be used with care.
-const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
+CoinAccess AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
+
+/**
+ * Statistics of a UTXO set which are updated as coins are added and spent:
+ * an order independent hash of the coins (see MuHash3072) and the totals
+ * reported by gettxoutsetinfo.
+ */
+class CCoinsRollingStats
+{
+public:
+    MuHash3072 muhash;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+
+    CCoinsRollingStats() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin);
+    void RemoveCoin(const COutPoint& outpoint, const Coin& coin);
+
+    //! Hash of the UTXO set. This computes a modular inverse, don't call it per coin.
+    uint256 GetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(muhash);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+    }
+};
 
 #endif // BITCOIN_COINS_H
@@ -86,8 +86,18 @@ typedef int32_t ssize_t;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+// select() cannot wait on sockets numbered FD_SETSIZE or above. Where it is
+// reliable, poll() is used instead; on Linux the socket handler keeps its
+// sockets registered in an epoll set.
+#if defined(__linux__)
+#define USE_EPOLL
+#endif
+#if !defined(WIN32) && !defined(__APPLE__)
+#define USE_POLL
+#endif
+
 bool static inline IsSelectableSocket(const SOCKET& s) {
-#ifdef WIN32
+#if defined(USE_POLL) || defined(WIN32)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -19,6 +19,21 @@ void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
 #endif
 #endif
 
+namespace sha256d64_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+
+namespace sha256d64_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in);
+}
+
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+}
+
 // Internal implementation code.
 namespace
 {
@@ -144,8 +159,42 @@ void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
 } // namespace sha256
 
 typedef void (*TransformType)(uint32_t*, const unsigned char*, size_t);
+typedef void (*TransformD64Type)(unsigned char*, const unsigned char*);
+
+/** Double-SHA256 of one 64 byte input with a single buffer transform. */
+template<TransformType tr>
+void TransformD64Wrapper(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8];
+    static const unsigned char padding1[64] = {
+        0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0
+    };
+    unsigned char buffer2[64] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0
+    };
+    sha256::Initialize(s);
+    tr(s, in, 1);
+    tr(s, padding1, 1);
+    for (int i = 0; i < 8; ++i)
+        WriteBE32(buffer2 + 4 * i, s[i]);
+    sha256::Initialize(s);
+    tr(s, buffer2, 1);
+    for (int i = 0; i < 8; ++i)
+        WriteBE32(out + 4 * i, s[i]);
+}
+
+TransformType Transform = sha256::Transform;
+TransformD64Type TransformD64 = TransformD64Wrapper<sha256::Transform>;
+TransformD64Type TransformD64_4way = nullptr;
+TransformD64Type TransformD64_8way = nullptr;
 
-bool SelfTest(TransformType tr) {
+bool SelfTest() {
     static const unsigned char in1[65] = {0, 0x80};
     static const unsigned char in2[129] = {
         0,
@@ -157,38 +206,178 @@ bool SelfTest(TransformType tr) {
     static const uint32_t init[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
     static const uint32_t out1[8] = {0xe3b0c442ul, 0x98fc1c14ul, 0x9afbf4c8ul, 0x996fb924ul, 0x27ae41e4ul, 0x649b934cul, 0xa495991bul, 0x7852b855ul};
     static const uint32_t out2[8] = {0xce4153b0ul, 0x147c2a86ul, 0x3ed4298eul, 0xe0676bc8ul, 0x79fc77a1ul, 0x2abe1f49ul, 0xb2b055dful, 0x1069523eul};
+    // Double-SHA256 of the 8 64 byte blocks of the pseudorandom input below.
+    // No two blocks are alike, so a kernel mixing up its lanes fails.
+    static const unsigned char d64out[256] = {
+        0x24, 0x3f, 0x12, 0xbd, 0x66, 0x1b, 0xcd, 0xa0, 0x71, 0x81, 0xff, 0xec, 0x0a, 0xcc, 0x6c, 0x0d, 0x7a, 0x6a, 0x9d, 0x0a, 0xae, 0xaa, 0xe3, 0xa9, 0xb4, 0x2f, 0x71, 0x26, 0x41, 0x77, 0xa8, 0x6b,
+        0x6b, 0x75, 0x57, 0xbc, 0xb5, 0xaf, 0x2a, 0xb8, 0x9c, 0xf8, 0xa0, 0xbf, 0x14, 0x5b, 0xf7, 0xc8, 0x62, 0x18, 0x43, 0xd0, 0x7c, 0x38, 0xc2, 0x04, 0x40, 0xc8, 0x4d, 0xad, 0x4c, 0xd7, 0xdf, 0xde,
+        0xcd, 0xe0, 0x5a, 0x0f, 0xfe, 0xd4, 0xfc, 0x1d, 0x00, 0x0d, 0x9c, 0x83, 0x84, 0x6d, 0xb8, 0x06, 0x44, 0x39, 0xe0, 0x38, 0x8b, 0x7d, 0x74, 0x4b, 0x39, 0x25, 0x7d, 0x19, 0x87, 0x44, 0x45, 0xfc,
+        0x50, 0xbd, 0x1e, 0xf8, 0x12, 0x97, 0x47, 0xe5, 0x41, 0xc4, 0x70, 0xc1, 0x7f, 0x6d, 0x38, 0x3e, 0xa4, 0x4b, 0xfc, 0xfe, 0x73, 0xd0, 0x09, 0xa2, 0x96, 0xf4, 0x60, 0x22, 0xed, 0x77, 0xbe, 0x5b,
+        0x9b, 0xfd, 0x7a, 0x81, 0xd4, 0xb7, 0xbd, 0x0d, 0x39, 0xdf, 0xfa, 0x61, 0xdc, 0x0f, 0x68, 0x08, 0x04, 0xa8, 0x2e, 0x72, 0x6d, 0xec, 0x72, 0xf5, 0x9b, 0x03, 0x6b, 0xeb, 0x6d, 0x77, 0xd8, 0xb8,
+        0xd4, 0x93, 0xcc, 0x50, 0xef, 0xb6, 0xe1, 0x67, 0x34, 0xb2, 0xfb, 0x32, 0xd3, 0xc8, 0x33, 0x40, 0x99, 0x80, 0x28, 0x64, 0xfb, 0x68, 0xdc, 0x0a, 0x2b, 0x47, 0xc3, 0xa2, 0xa0, 0x84, 0xa0, 0xbf,
+        0x4e, 0x4f, 0x79, 0x40, 0x21, 0x20, 0x4b, 0xb0, 0x86, 0x8f, 0x97, 0xa4, 0xe8, 0x9c, 0x34, 0x9b, 0xda, 0x0c, 0x2d, 0xfe, 0xcd, 0x49, 0xa4, 0xe3, 0xba, 0xc3, 0x29, 0x40, 0x30, 0xf3, 0x82, 0xf6,
+        0xc0, 0x24, 0x48, 0x79, 0x35, 0xea, 0x14, 0x2d, 0x8c, 0xfe, 0x9e, 0xd5, 0xe6, 0x88, 0xff, 0x66, 0x9e, 0x91, 0x75, 0x1c, 0x1b, 0xa2, 0xdf, 0xf3, 0x5e, 0x9f, 0xac, 0xf4, 0x2b, 0x13, 0x5f, 0x74
+    };
     uint32_t buf[8];
     memcpy(buf, init, sizeof(buf));
     // Process nothing, and check we remain in the initial state.
-    tr(buf, nullptr, 0);
+    Transform(buf, nullptr, 0);
     if (memcmp(buf, init, sizeof(buf))) return false;
     // Process the padded empty string (unaligned)
-    tr(buf, in1 + 1, 1);
+    Transform(buf, in1 + 1, 1);
     if (memcmp(buf, out1, sizeof(buf))) return false;
     // Process 64 spaces (unaligned)
     memcpy(buf, init, sizeof(buf));
-    tr(buf, in2 + 1, 2);
+    Transform(buf, in2 + 1, 2);
     if (memcmp(buf, out2, sizeof(buf))) return false;
+
+    // Test the double-SHA256 of 64 byte inputs, with every available width
+    unsigned char in[512], out[256];
+    uint32_t x = 1;
+    for (int i = 0; i < 512; ++i) {
+        x = x * 1103515245 + 12345;
+        in[i] = x >> 24;
+    }
+    for (int i = 0; i < 8; ++i) {
+        TransformD64(out + 32 * i, in + 64 * i);
+        if (memcmp(out + 32 * i, d64out + 32 * i, 32)) return false;
+    }
+    if (TransformD64_4way) {
+        memset(out, 0, sizeof(out));
+        TransformD64_4way(out, in);
+        TransformD64_4way(out + 128, in + 256);
+        if (memcmp(out, d64out, 256)) return false;
+    }
+    if (TransformD64_8way) {
+        memset(out, 0, sizeof(out));
+        TransformD64_8way(out, in);
+        if (memcmp(out, d64out, 256)) return false;
+    }
     return true;
 }
 
-TransformType Transform = sha256::Transform;
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+
+/** The SHA256 related instruction set extensions usable on this machine. */
+struct CPUFeatures
+{
+    bool have_sse4 = false;
+    bool have_avx2 = false;
+    bool have_shani = false;
+};
+
+CPUFeatures DetectCPUFeatures()
+{
+    CPUFeatures features;
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
+    uint32_t eax, ebx, ecx, edx;
+    bool enabled_avx = false;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        features.have_sse4 = (ecx >> 19) & 1;
+        // AVX needs both the CPU support and XSAVE enabled by the OS
+        if (((ecx >> 27) & 1) && ((ecx >> 28) & 1))
+            enabled_avx = AVXEnabled();
+    }
+    if (features.have_sse4 && __get_cpuid_max(0, nullptr) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        features.have_avx2 = ((ebx >> 5) & 1) && enabled_avx;
+        features.have_shani = (ebx >> 29) & 1;
+    }
+#endif
+    return features;
+}
+
+/** Go back to the generic implementation, with no multi-lane kernels. */
+void UseStandard()
+{
+    Transform = sha256::Transform;
+    TransformD64 = TransformD64Wrapper<sha256::Transform>;
+    TransformD64_4way = nullptr;
+    TransformD64_8way = nullptr;
+}
 
 } // namespace
 
 std::string SHA256AutoDetect()
 {
+    std::string ret = "standard";
+    UseStandard();
 #if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
-    uint32_t eax, ebx, ecx, edx;
-    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx >> 19) & 1) {
+    const CPUFeatures features = DetectCPUFeatures();
+
+#if defined(ENABLE_SHANI) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (features.have_shani) {
+        // The SHA instructions beat the multi-lane kernels at every width
+        Transform = sha256_shani::Transform;
+        TransformD64 = TransformD64Wrapper<sha256_shani::Transform>;
+        assert(SelfTest());
+        return "shani(1way)";
+    }
+#endif
+
+    if (features.have_sse4) {
         Transform = sha256_sse4::Transform;
-        assert(SelfTest(Transform));
-        return "sse4";
+        TransformD64 = TransformD64Wrapper<sha256_sse4::Transform>;
+        ret = "sse4(1way)";
+#if defined(ENABLE_SSE41) && !defined(BUILD_BITCOIN_INTERNAL)
+        TransformD64_4way = sha256d64_sse41::Transform_4way;
+        ret += ",sse41(4way)";
+#endif
     }
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (features.have_avx2) {
+        TransformD64_8way = sha256d64_avx2::Transform_8way;
+        ret += ",avx2(8way)";
+    }
+#endif
 #endif
 
-    assert(SelfTest(Transform));
-    return "standard";
+    assert(SelfTest());
+    return ret;
+}
+
+bool SHA256ForceImplementation(const std::string& name)
+{
+    UseStandard();
+    if (name == "standard")
+        return true;
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__))
+    const CPUFeatures features = DetectCPUFeatures();
+    if (name == "sse4" && features.have_sse4) {
+        Transform = sha256_sse4::Transform;
+        TransformD64 = TransformD64Wrapper<sha256_sse4::Transform>;
+        return true;
+    }
+#if defined(ENABLE_SSE41) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (name == "sse41" && features.have_sse4) {
+        TransformD64_4way = sha256d64_sse41::Transform_4way;
+        return true;
+    }
+#endif
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (name == "avx2" && features.have_avx2) {
+        TransformD64_8way = sha256d64_avx2::Transform_8way;
+        return true;
+    }
+#endif
+#if defined(ENABLE_SHANI) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (name == "shani" && features.have_shani) {
+        Transform = sha256_shani::Transform;
+        TransformD64 = TransformD64Wrapper<sha256_shani::Transform>;
+        return true;
+    }
+#endif
+#endif
+    return false;
 }
 
 ////// SHA-256
@@ -247,3 +436,29 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    if (TransformD64_8way) {
+        while (blocks >= 8) {
+            TransformD64_8way(out, in);
+            out += 256;
+            in += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformD64_4way) {
+        while (blocks >= 4) {
+            TransformD64_4way(out, in);
+            out += 128;
+            in += 256;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        TransformD64(out, in);
+        out += 32;
+        in += 64;
+        --blocks;
+    }
+}
@@ -31,4 +31,18 @@ public:
  */
 std::string SHA256AutoDetect();
 
+/** Use only the named SHA256 implementation ("standard", "sse4", "sse41",
+ *  "avx2" or "shani"), for testing each of them. Returns false if it isn't
+ *  available on this machine, in which case the standard one is used.
+ *  Call SHA256AutoDetect() to go back to the best implementation.
+ */
+bool SHA256ForceImplementation(const std::string& name);
+
+/** Compute multiple double-SHA256's of 64-byte blobs.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*64 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -111,6 +111,29 @@ public:
         ssKey.clear();
     }
 
+    /** Write a raw key & value as returned by CDBIterator::GetKeyBytes & GetValueBytes */
+    void WriteBytes(const std::vector<unsigned char>& key, const std::vector<unsigned char>& value)
+    {
+        leveldb::Slice slKey((const char*) key.data(), key.size());
+
+        ssValue.write((const char*) value.data(), value.size());
+        ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
+        leveldb::Slice slValue(ssValue.data(), ssValue.size());
+
+        batch.Put(slKey, slValue);
+        size_estimate += 3 + (slKey.size() > 127) + slKey.size() + (slValue.size() > 127) + slValue.size();
+        ssValue.clear();
+    }
+
+    /** Erase a raw key as returned by CDBIterator::GetKeyBytes */
+    void EraseBytes(const std::vector<unsigned char>& key)
+    {
+        leveldb::Slice slKey((const char*) key.data(), key.size());
+
+        batch.Delete(slKey);
+        size_estimate += 2 + (slKey.size() > 127) + slKey.size();
+    }
+
     size_t SizeEstimate() const { return size_estimate; }
 };
 
@@ -183,6 +206,20 @@ public:
         return piter->value().size();
     }
 
+    /** Serialized key of the current entry */
+    std::vector<unsigned char> GetKeyBytes() const {
+        leveldb::Slice slKey = piter->key();
+        return std::vector<unsigned char>(slKey.data(), slKey.data() + slKey.size());
+    }
+
+    /** Serialized (not obfuscated) value of the current entry */
+    std::vector<unsigned char> GetValueBytes() const {
+        leveldb::Slice slValue = piter->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
+        return std::vector<unsigned char>(ssValue.begin(), ssValue.end());
+    }
+
 };
 
 class CDBWrapper
@@ -212,14 +212,10 @@ void Shutdown()
         DumpMempool();
     }
 
-    // Write the BMM cache to disk
-    DumpBMMCache();
-
-    // Write the users WithdrawalID cache to disk
-    DumpWithdrawalIDCache();
-
-    // Write the mainchain block hash cache to disk
-    DumpMainBlockCache();
+    // Write the BMM cache, the users WithdrawalID cache and the mainchain
+    // block hash cache to disk and clear the BMM cache journal
+    CompactBMMCacheJournal();
+    CloseBMMCacheJournal();
 
     if (fFeeEstimatesInitialized)
     {
@@ -364,6 +360,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
+    strUsage += HelpMessageOpt("-coinsrollingstats", strprintf(_("Maintain UTXO set statistics with every block for gettxoutsetinfo muhash, keeping them for the last %u blocks (default: %u)"), COINS_ROLLING_STATS_WINDOW, DEFAULT_COINS_ROLLING_STATS));
+    strUsage += HelpMessageOpt("-backgroundflush", strprintf(_("Write the coins database in the background when flushing the coins cache, and keep unmodified coins in the cache (default: %u)"), DEFAULT_BACKGROUND_FLUSH));
+    strUsage += HelpMessageOpt("-prefetchinputs", strprintf(_("Read the input coins of a block from the coins database in parallel before connecting it, using -par threads (default: %u)"), DEFAULT_PREFETCH_INPUTS));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
     strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
@@ -375,6 +374,7 @@ std::string HelpMessage(HelpMessageMode mode)
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
+    strUsage += HelpMessageOpt("-sidechainarchive=<n>", strprintf(_("Move settled withdrawals, withdrawal bundles and deposits to the sidechain archive database <n> blocks after they settle (default: %u = keep everything in the sidechain database)"), DEFAULT_SIDECHAIN_ARCHIVE_DEPTH));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -398,6 +398,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Set the number of threads processing peer messages (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
@@ -930,8 +931,13 @@ bool AppInitParameterInteraction()
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
+#ifdef USE_POLL
+    int fd_max = nFD;
+#else
+    int fd_max = FD_SETSIZE;
+#endif
+    nMaxConnections = std::max(std::min(nMaxConnections, fd_max - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS), 0);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
     nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS, nMaxConnections);
@@ -992,6 +998,8 @@ bool AppInitParameterInteraction()
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fPrefetchInputs = gArgs.GetBoolArg("-prefetchinputs", DEFAULT_PREFETCH_INPUTS);
+    fCoinsRollingStatsEnabled = gArgs.GetBoolArg("-coinsrollingstats", DEFAULT_COINS_ROLLING_STATS);
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
@@ -1236,6 +1244,10 @@ bool AppInitMain()
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        if (fPrefetchInputs) {
+            for (int i=0; i<nScriptCheckThreads-1; i++)
+                threadGroup.create_thread(&ThreadInputPrefetch);
+        }
     }
 
     // Start the lightweight task scheduler thread
@@ -1435,7 +1447,7 @@ bool AppInitMain()
                 // fails if it's still open from the previous loop. Close it first:
                 pblocktree.reset();
                 pblocktree.reset(new CBlockTreeDB(nBlockTreeDBCache, false, fReset));
-                psidechaintree.reset(new CSidechainTreeDB(nSidechainTreeDBCache, false, fReset));
+                psidechaintree.reset(new CSidechainTreeDB(nSidechainTreeDBCache, false, fReset, gArgs.GetArg("-sidechainarchive", DEFAULT_SIDECHAIN_ARCHIVE_DEPTH)));
 
                 if (fReset) {
                     pblocktree->WriteReindexing(true);
@@ -1473,6 +1485,16 @@ bool AppInitMain()
                     break;
                 }
 
+                // Check for an interrupted sidechain state snapshot load
+                bool fSnapshotLoad = false;
+                pblocktree->ReadFlag("sidechainstateload", fSnapshotLoad);
+                if (fSnapshotLoad) {
+                    // Blocks below the snapshot were never downloaded, so
+                    // only -reindex, which fetches them again, can recover
+                    strLoadError = _("Loading a sidechain state snapshot was interrupted. You need to rebuild the database using -reindex.");
+                    break;
+                }
+
                 // At this point blocktree args are consistent with what's on disk.
                 // If we're not mid-reindex (based on disk + args), add a genesis block on disk
                 // (otherwise we use the one already on disk).
@@ -1486,6 +1508,7 @@ bool AppInitMain()
                 // block tree into mapBlockIndex!
 
                 pcoinsdbview.reset(new CCoinsViewDB(nCoinDBCache, false, fReset || fReindexChainState));
+                pcoinsdbview->SetBackgroundWrite(gArgs.GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH));
                 pcoinscatcher.reset(new CCoinsViewErrorCatcher(pcoinsdbview.get()));
 
                 // If necessary, upgrade from older database format.
@@ -1550,6 +1573,11 @@ bool AppInitMain()
                         break;
                     }
                 }
+
+                if (!LoadCoinsRollingStats()) {
+                    strLoadError = _("Error loading UTXO set statistics");
+                    break;
+                }
             } catch (const std::exception& e) {
                 LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1601,6 +1629,9 @@ bool AppInitMain()
     // Load the mainchain block hash cache from disk
     LoadMainBlockCache();
 
+    // Apply BMM cache changes from before an unclean shutdown
+    LoadBMMCacheJournal();
+
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
     if (!OpenWallets())
@@ -1622,6 +1653,12 @@ bool AppInitMain()
         }
     }
 
+    // Blocks below a loaded sidechain state snapshot are missing like pruned ones
+    if (fHaveSnapshotChain) {
+        LogPrintf("Unsetting NODE_NETWORK on a chainstate loaded from a snapshot\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
+
     if (chainparams.GetConsensus().vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout != 0) {
         // Only advertise witness capabilities if they have a reasonable start time.
         // This allows us to have the code merged without a defined softfork, by setting its
@@ -1722,6 +1759,7 @@ bool AppInitMain()
     connOptions.m_msgproc = peerLogic.get();
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
+    connOptions.nMessageHandlerThreads = gArgs.GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS);
     connOptions.m_added_nodes = gArgs.GetArgs("-addnode");
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
@@ -25,6 +25,7 @@
 #include <script/standard.h>
 #include <sidechain.h>
 #include <sidechainclient.h>
+#include <sidechainperf.h>
 #include <timedata.h>
 #include <txdb.h>
 #include <util.h>
@@ -58,6 +59,39 @@ uint64_t nLastBlockWeight = 0;
 
 static const uint64_t nRefundOutputSize = 34;
 
+/**
+ * Transaction selection of the last BMM block template. BMM requests are
+ * refreshed often, and usually only the mainchain tip has changed since the
+ * last one, so the selection and the Withdrawal Bundle are reused while the
+ * sidechain tip, the assembler options and the mempool are the same.
+ */
+struct LastBlockTemplate
+{
+    uint256 hashPrevBlock;
+    unsigned int nBlockMaxWeight = 0;
+    CFeeRate blockMinFeeRate;
+    unsigned int nTransactionsUpdated = 0;
+
+    // Withdrawal Bundle created for the template, null if none. Refunds are
+    // only selected when there is no bundle.
+    CTransactionRef withdrawalBundleTx;
+    CTransactionRef withdrawalBundleDataTx;
+
+    // Selected transactions, not including the coinbase
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOpsCost;
+    std::vector<CTransactionRef> vRefundTx;
+
+    uint64_t nBlockWeight = 0;
+    uint64_t nBlockTx = 0;
+    uint64_t nBlockSigOpsCost = 0;
+    CAmount nFees = 0;
+};
+
+static CCriticalSection cs_lastblocktemplate;
+static LastBlockTemplate lastBlockTemplate;
+
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -115,7 +149,7 @@ void BlockAssembler::resetBlock()
     nFees = 0;
 }
 
-std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx, bool fCheckBMM, const uint256& hashPrevBlock, CAmount* nFeesOut)
+std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx, bool fCheckBMM, const uint256& hashPrevBlock, CAmount* nFeesOut, bool fReuseTemplate)
 {
     // TODO
     // Usually this is called via RefreshBMM of the SidechainPage. SidechainPage
@@ -180,21 +214,38 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     // transaction (which in most cases can be a no-op).
     fIncludeWitness = true;
 
-    // Try to create a Withdrawal Bundle for this block. We want to know if a Withdrawal Bundle is going to
-    // be generated because we will skip adding refund transactions to the
-    // same block as a Withdrawal Bundle. We will add the Withdrawal Bundle to the block later if created.
     CTransactionRef withdrawalBundleTx;
     CTransactionRef withdrawalBundleDataTx;
     bool fCreatedWithdrawalBundle = false;
-    if (CreateWithdrawalBundleTx(nHeight, withdrawalBundleTx, withdrawalBundleDataTx, false /* fReplicationCheck */,
-                true /* fCheckUnique */)) {
-        fCreatedWithdrawalBundle = true;
-    }
-
     int nPackagesSelected = 0;
     int nDescendantsUpdated = 0;
-    std::vector<CTxMemPool::txiter> vRefund;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated, vRefund, !fCreatedWithdrawalBundle /* fIncludeRefunds */);
+    std::vector<CTransactionRef> vRefund;
+
+    bool fReused = fReuseTemplate && ReuseLastTemplate(pindexPrev, withdrawalBundleTx, withdrawalBundleDataTx, vRefund);
+    if (fReused) {
+        fCreatedWithdrawalBundle = withdrawalBundleTx != nullptr;
+    } else {
+        // Try to create a Withdrawal Bundle for this block. We want to know if a Withdrawal Bundle is going to
+        // be generated because we will skip adding refund transactions to the
+        // same block as a Withdrawal Bundle. We will add the Withdrawal Bundle to the block later if created.
+        if (CreateWithdrawalBundleTx(nHeight, withdrawalBundleTx, withdrawalBundleDataTx, false /* fReplicationCheck */,
+                    true /* fCheckUnique */)) {
+            fCreatedWithdrawalBundle = true;
+        } else {
+            withdrawalBundleTx.reset();
+            withdrawalBundleDataTx.reset();
+        }
+
+        std::vector<CTxMemPool::txiter> vRefundIter;
+        addPackageTxs(nPackagesSelected, nDescendantsUpdated, vRefundIter, !fCreatedWithdrawalBundle /* fIncludeRefunds */);
+        for (const CTxMemPool::txiter& it : vRefundIter)
+            vRefund.push_back(it->GetSharedTx());
+
+        if (fReuseTemplate)
+            StoreLastTemplate(pindexPrev, withdrawalBundleTx, withdrawalBundleDataTx, vRefund);
+    }
+    if (fReuseTemplate)
+        RecordSidechainCacheLookup("BMM block template", fReused);
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -217,6 +268,8 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     psidechaintree->GetLastWithdrawalBundleHash(hashCurrentWithdrawalBundle);
     if (psidechaintree->GetWithdrawalBundle(hashCurrentWithdrawalBundle, withdrawalBundle)) {
         if (withdrawalBundle.status == WITHDRAWAL_BUNDLE_CREATED) {
+            SidechainPerfTimer timer(SIDECHAIN_PERF_CS_MAIN_WAIT);
+
             // Check if the Withdrawal Bundle has been paid out or failed
             if (client.HaveFailedWithdrawalBundle(hashCurrentWithdrawalBundle)) {
                 CScript script = GenerateWithdrawalBundleFailCommit(hashCurrentWithdrawalBundle);
@@ -257,8 +310,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     //
     if (!fCreatedWithdrawalBundle) {
         uint64_t nRefundAdded = 0;
-        for (const CTxMemPool::txiter& it : vRefund) {
-            CTransactionRef tx = it->GetSharedTx();
+        for (const CTransactionRef& tx : vRefund) {
             if (tx == nullptr) continue;
 
             // Find the refund script
@@ -303,7 +355,10 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
         hashLastDeposit = lastDeposit.dtx.GetHash();
         nBurnIndex = lastDeposit.nBurnIndex;
     }
-    vDeposit = client.UpdateDeposits(hashLastDeposit, nBurnIndex);
+    {
+        SidechainPerfTimer timer(SIDECHAIN_PERF_CS_MAIN_WAIT);
+        vDeposit = client.UpdateDeposits(hashLastDeposit, nBurnIndex);
+    }
 
     // Find new deposits
     std::vector<SidechainDeposit> vDepositNew;
@@ -511,6 +566,16 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false,
                 fCheckBMM, hashPrevBlock.IsNull() ? false : true)) {
+        // The reused transaction selection might no longer be valid, so try
+        // again with a new one
+        if (fReused) {
+            LogPrintf("%s: Reused block template invalid: %s\n", __func__, FormatStateMessage(state));
+            {
+                LOCK(cs_lastblocktemplate);
+                lastBlockTemplate = LastBlockTemplate();
+            }
+            return CreateNewBlock(scriptPubKeyIn, fMineWitnessTx, fCheckBMM, hashPrevBlock, nFeesOut, fReuseTemplate);
+        }
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
     }
     int64_t nTime2 = GetTimeMicros();
@@ -520,6 +585,63 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     return std::move(pblocktemplate);
 }
 
+bool BlockAssembler::ReuseLastTemplate(const CBlockIndex* pindexPrev, CTransactionRef& withdrawalBundleTx, CTransactionRef& withdrawalBundleDataTx, std::vector<CTransactionRef>& vRefundTx)
+{
+    AssertLockHeld(mempool.cs);
+
+    LOCK(cs_lastblocktemplate);
+
+    if (lastBlockTemplate.hashPrevBlock != pindexPrev->GetBlockHash())
+        return false;
+    if (lastBlockTemplate.nBlockMaxWeight != nBlockMaxWeight)
+        return false;
+    if (lastBlockTemplate.blockMinFeeRate != blockMinFeeRate)
+        return false;
+    if (lastBlockTemplate.nTransactionsUpdated != mempool.GetTransactionsUpdated())
+        return false;
+
+    withdrawalBundleTx = lastBlockTemplate.withdrawalBundleTx;
+    withdrawalBundleDataTx = lastBlockTemplate.withdrawalBundleDataTx;
+    vRefundTx = lastBlockTemplate.vRefundTx;
+
+    pblock->vtx.insert(pblock->vtx.end(), lastBlockTemplate.vtx.begin(), lastBlockTemplate.vtx.end());
+    pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), lastBlockTemplate.vTxFees.begin(), lastBlockTemplate.vTxFees.end());
+    pblocktemplate->vTxSigOpsCost.insert(pblocktemplate->vTxSigOpsCost.end(), lastBlockTemplate.vTxSigOpsCost.begin(), lastBlockTemplate.vTxSigOpsCost.end());
+
+    nBlockWeight = lastBlockTemplate.nBlockWeight;
+    nBlockTx = lastBlockTemplate.nBlockTx;
+    nBlockSigOpsCost = lastBlockTemplate.nBlockSigOpsCost;
+    nFees = lastBlockTemplate.nFees;
+
+    return true;
+}
+
+void BlockAssembler::StoreLastTemplate(const CBlockIndex* pindexPrev, const CTransactionRef& withdrawalBundleTx, const CTransactionRef& withdrawalBundleDataTx, const std::vector<CTransactionRef>& vRefundTx)
+{
+    AssertLockHeld(mempool.cs);
+
+    LOCK(cs_lastblocktemplate);
+
+    lastBlockTemplate.hashPrevBlock = pindexPrev->GetBlockHash();
+    lastBlockTemplate.nBlockMaxWeight = nBlockMaxWeight;
+    lastBlockTemplate.blockMinFeeRate = blockMinFeeRate;
+    lastBlockTemplate.nTransactionsUpdated = mempool.GetTransactionsUpdated();
+
+    lastBlockTemplate.withdrawalBundleTx = withdrawalBundleTx;
+    lastBlockTemplate.withdrawalBundleDataTx = withdrawalBundleDataTx;
+    lastBlockTemplate.vRefundTx = vRefundTx;
+
+    // Skip the dummy coinbase
+    lastBlockTemplate.vtx.assign(pblock->vtx.begin() + 1, pblock->vtx.end());
+    lastBlockTemplate.vTxFees.assign(pblocktemplate->vTxFees.begin() + 1, pblocktemplate->vTxFees.end());
+    lastBlockTemplate.vTxSigOpsCost.assign(pblocktemplate->vTxSigOpsCost.begin() + 1, pblocktemplate->vTxSigOpsCost.end());
+
+    lastBlockTemplate.nBlockWeight = nBlockWeight;
+    lastBlockTemplate.nBlockTx = nBlockTx;
+    lastBlockTemplate.nBlockSigOpsCost = nBlockSigOpsCost;
+    lastBlockTemplate.nFees = nFees;
+}
+
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
 {
     for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
@@ -870,10 +992,10 @@ bool BlockAssembler::GenerateBMMBlock(CBlock& block, std::string& strError, CAmo
             strError = "Failed to get script for mining!\n";
             return false;
         }
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript, true, false, hashPrevBlock, nFeesOut);
+        pblocktemplate = CreateNewBlock(coinbaseScript->reserveScript, true, false, hashPrevBlock, nFeesOut, true /* fReuseTemplate */);
         #endif
     } else {
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptPubKey, true, false, hashPrevBlock, nFeesOut);
+        pblocktemplate = CreateNewBlock(scriptPubKey, true, false, hashPrevBlock, nFeesOut, true /* fReuseTemplate */);
     }
 
     if (!pblocktemplate.get()) {
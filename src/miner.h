@@ -169,8 +169,9 @@ public:
 
 private:
     // Note: Moved to private, should always use GenerateBMMBlock().
-    /** Construct a new block template with coinbase to scriptPubKeyIn */
-    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true, bool fCheckBMM = true, const uint256& hashPrevBlock = uint256(), CAmount* nFeesOut = nullptr);
+    /** Construct a new block template with coinbase to scriptPubKeyIn. BMM
+      * blocks set fReuseTemplate to share the work of the last template. */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true, bool fCheckBMM = true, const uint256& hashPrevBlock = uint256(), CAmount* nFeesOut = nullptr, bool fReuseTemplate = false);
 
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
@@ -186,6 +187,12 @@ private:
       * Increments nPackagesSelected / nDescendantsUpdated with corresponding
       * statistics from the package selection (for logging statistics). */
     void addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, std::vector<CTxMemPool::txiter>& vRefundTx, bool fIncludeRefunds);
+    /** Copy the transaction selection and Withdrawal Bundle (null if none)
+      * of the last block template into this one if it was made for the same
+      * chain tip, options and mempool. */
+    bool ReuseLastTemplate(const CBlockIndex* pindexPrev, CTransactionRef& withdrawalBundleTx, CTransactionRef& withdrawalBundleDataTx, std::vector<CTransactionRef>& vRefundTx);
+    /** Remember the transaction selection and Withdrawal Bundle of this block template */
+    void StoreLastTemplate(const CBlockIndex* pindexPrev, const CTransactionRef& withdrawalBundleTx, const CTransactionRef& withdrawalBundleDataTx, const std::vector<CTransactionRef>& vRefundTx);
 
     // helper functions for addPackageTxs()
     /** Remove confirmed (inBlock) entries from given set */
@@ -17,6 +17,7 @@
 #include <qt/networkstyle.h>
 #include <qt/optionsmodel.h>
 #include <qt/platformstyle.h>
+#include <qt/sidechainnotifier.h>
 #include <qt/splashscreen.h>
 #include <qt/utilitydialog.h>
 #include <qt/winshutdownmonitor.h>
@@ -586,6 +587,9 @@ int main(int argc, char *argv[])
     //   IMPORTANT if it is no longer a typedef use the normal variant above
     qRegisterMetaType< CAmount >("CAmount");
     qRegisterMetaType< std::function<void(void)> >("std::function<void(void)>");
+    // Sidechain objects sent from the validation interface thread
+    qRegisterMetaType< std::vector<SidechainWithdrawalSelection> >("std::vector<SidechainWithdrawalSelection>");
+    qRegisterMetaType< std::vector<SidechainWithdrawalBundle> >("std::vector<SidechainWithdrawalBundle>");
 
     /// 3. Application identification
     // must be set before OptionsModel is initialized or translations are loaded,
@@ -0,0 +1,179 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <qt/sidechainnotifier.h>
+
+#include <base58.h>
+#include <consensus/validation.h>
+#include <script/standard.h>
+#include <txdb.h>
+#include <validation.h>
+
+SidechainNotifier::SidechainNotifier(QObject *parent) :
+    QObject(parent),
+    guard(std::make_shared<Guard>()),
+    fSubscribed(false),
+    fLoadedWithdrawals(false),
+    fLoadedWithdrawalBundles(false)
+{
+    guard->notifier = this;
+}
+
+SidechainNotifier::~SidechainNotifier()
+{
+    Unsubscribe();
+
+    // Waits for a queued function or notification using the notifier
+    LOCK(guard->cs);
+    guard->notifier = nullptr;
+}
+
+void SidechainNotifier::Subscribe()
+{
+    if (fSubscribed)
+        return;
+
+    RegisterValidationInterface(this);
+    fSubscribed = true;
+}
+
+void SidechainNotifier::Unsubscribe()
+{
+    if (!fSubscribed)
+        return;
+
+    UnregisterValidationInterface(this);
+    fSubscribed = false;
+}
+
+void SidechainNotifier::LoadWithdrawals()
+{
+    std::shared_ptr<Guard> guardQueued = guard;
+    CallFunctionInValidationInterfaceQueue([guardQueued] {
+        LOCK(guardQueued->cs);
+        if (!guardQueued->notifier)
+            return;
+
+        guardQueued->notifier->ReadWithdrawals();
+    });
+}
+
+void SidechainNotifier::LoadWithdrawalBundles()
+{
+    std::shared_ptr<Guard> guardQueued = guard;
+    CallFunctionInValidationInterfaceQueue([guardQueued] {
+        LOCK(guardQueued->cs);
+        if (!guardQueued->notifier)
+            return;
+
+        guardQueued->notifier->ReadWithdrawalBundles();
+    });
+}
+
+void SidechainNotifier::ReadWithdrawals()
+{
+    if (!psidechaintree)
+        return;
+
+    fLoadedWithdrawals = true;
+
+    mapUnspentWithdrawal.clear();
+    // Archived withdrawals are all spent
+    for (const SidechainWithdrawal& wt : psidechaintree->GetWithdrawals(THIS_SIDECHAIN, false /* fIncludeArchived */)) {
+        if (wt.status == WITHDRAWAL_UNSPENT)
+            mapUnspentWithdrawal[wt.GetID()] = wt;
+    }
+
+    SendWithdrawalSelection();
+}
+
+void SidechainNotifier::ReadWithdrawalBundles()
+{
+    if (!psidechaintree)
+        return;
+
+    fLoadedWithdrawalBundles = true;
+
+    Q_EMIT WithdrawalBundlesLoaded(psidechaintree->GetWithdrawalBundles(THIS_SIDECHAIN));
+}
+
+void SidechainNotifier::SendWithdrawalSelection()
+{
+    std::vector<SidechainWithdrawal> vWT;
+    vWT.reserve(mapUnspentWithdrawal.size());
+    for (const auto& it : mapUnspentWithdrawal)
+        vWT.push_back(it.second);
+
+    SortWithdrawalByFee(vWT);
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = chainActive.Height() + 1;
+    }
+
+    // Create a fake WithdrawalBundle transaction so that we can estimate the total size of
+    // the WithdrawalBundle.
+    CMutableTransaction wjtx = CreateWithdrawalBundleBase();
+
+    // Select WT(s) the same way that the next WithdrawalBundle will
+    std::vector<bool> vSelected = SelectWithdrawalsForBundle(nHeight, vWT);
+
+    // Add selected WT(s) to the fake WithdrawalBundle transaction to estimate size
+    std::vector<SidechainWithdrawalSelection> vSelection;
+    vSelection.reserve(vWT.size());
+    for (size_t i = 0; i < vWT.size(); i++) {
+        const SidechainWithdrawal& wt = vWT[i];
+
+        if (vSelected[i]) {
+            CTxDestination dest = DecodeDestination(wt.strDestination, true /* fMainchain */);
+            wjtx.vout.push_back(CTxOut(wt.amount - wt.mainchainFee, GetScriptForDestination(dest)));
+        }
+
+        SidechainWithdrawalSelection selection;
+        selection.withdrawal = wt;
+        selection.fSelected = vSelected[i];
+        selection.nCumulativeWeight = GetTransactionWeight(wjtx);
+        vSelection.push_back(selection);
+    }
+
+    Q_EMIT WithdrawalSelectionUpdated(vSelection);
+}
+
+void SidechainNotifier::SidechainWithdrawalsUpdated(const std::vector<SidechainWithdrawal>& vWithdrawal)
+{
+    LOCK(guard->cs);
+    if (!guard->notifier || !fLoadedWithdrawals)
+        return;
+
+    for (const SidechainWithdrawal& wt : vWithdrawal) {
+        if (wt.status == WITHDRAWAL_UNSPENT)
+            mapUnspentWithdrawal[wt.GetID()] = wt;
+        else
+            mapUnspentWithdrawal.erase(wt.GetID());
+    }
+
+    SendWithdrawalSelection();
+}
+
+void SidechainNotifier::SidechainWithdrawalBundleUpdated(const SidechainWithdrawalBundle& withdrawalBundle)
+{
+    LOCK(guard->cs);
+    if (!guard->notifier)
+        return;
+
+    Q_EMIT WithdrawalBundlesUpdated(std::vector<SidechainWithdrawalBundle>{ withdrawalBundle });
+}
+
+void SidechainNotifier::SidechainDBReloaded()
+{
+    LOCK(guard->cs);
+    if (!guard->notifier)
+        return;
+
+    if (fLoadedWithdrawals)
+        ReadWithdrawals();
+    if (fLoadedWithdrawalBundles)
+        ReadWithdrawalBundles();
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_QT_SIDECHAINNOTIFIER_H
+#define BITCOIN_QT_SIDECHAINNOTIFIER_H
+
+#include <sidechain.h>
+#include <sync.h>
+#include <uint256.h>
+#include <validationinterface.h>
+
+#include <QMetaType>
+#include <QObject>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+/** An unspent withdrawal and how it would be packed into the next bundle */
+struct SidechainWithdrawalSelection
+{
+    SidechainWithdrawal withdrawal;
+    // Whether the withdrawal would be selected for the next bundle
+    bool fSelected;
+    // Weight of the next bundle up to and including this withdrawal
+    unsigned int nCumulativeWeight;
+};
+
+Q_DECLARE_METATYPE(std::vector<SidechainWithdrawalSelection>)
+Q_DECLARE_METATYPE(std::vector<SidechainWithdrawalBundle>)
+
+/**
+ * Forwards sidechain database notifications from the validation interface to
+ * Qt signals, and reads sidechain objects from the database on the validation
+ * interface thread so that the GUI thread is not blocked.
+ *
+ * Loads and updates are both handled on the validation interface queue so they
+ * arrive in order. Updates are complete objects which replace the object with
+ * the same ID, so an update that is already part of a load can be applied again.
+ * Bulk changes of the database are followed by a new load.
+ */
+class SidechainNotifier : public QObject, public CValidationInterface
+{
+    Q_OBJECT
+
+public:
+    explicit SidechainNotifier(QObject *parent = 0);
+    ~SidechainNotifier();
+
+    /** Start or stop receiving notifications from the validation interface */
+    void Subscribe();
+    void Unsubscribe();
+
+    /**
+     * Read withdrawals from the database, then keep them up to date and send
+     * the unspent withdrawals in the order and selection of the next bundle
+     * with WithdrawalSelectionUpdated.
+     */
+    void LoadWithdrawals();
+
+    /** Read withdrawal bundles from the database and send them with WithdrawalBundlesLoaded */
+    void LoadWithdrawalBundles();
+
+Q_SIGNALS:
+    void WithdrawalSelectionUpdated(const std::vector<SidechainWithdrawalSelection>& vSelection);
+    void WithdrawalBundlesLoaded(const std::vector<SidechainWithdrawalBundle>& vWithdrawalBundle);
+    void WithdrawalBundlesUpdated(const std::vector<SidechainWithdrawalBundle>& vWithdrawalBundle);
+
+protected:
+    // CValidationInterface
+    void SidechainWithdrawalsUpdated(const std::vector<SidechainWithdrawal>& vWithdrawal) override;
+    void SidechainWithdrawalBundleUpdated(const SidechainWithdrawalBundle& withdrawalBundle) override;
+    void SidechainDBReloaded() override;
+
+private:
+    /**
+     * Shared with functions waiting in the validation interface queue, which
+     * may run after the notifier was destroyed. The notifier is cleared when
+     * it is destroyed, and only used with cs held.
+     */
+    struct Guard
+    {
+        CCriticalSection cs;
+        SidechainNotifier* notifier;
+    };
+    std::shared_ptr<Guard> guard;
+
+    bool fSubscribed;
+
+    // Only used on the validation interface queue
+    bool fLoadedWithdrawals;
+    bool fLoadedWithdrawalBundles;
+    std::map<uint256, SidechainWithdrawal> mapUnspentWithdrawal;
+
+    void ReadWithdrawals();
+    void ReadWithdrawalBundles();
+    void SendWithdrawalSelection();
+};
+
+#endif // BITCOIN_QT_SIDECHAINNOTIFIER_H
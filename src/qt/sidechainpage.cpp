@@ -564,9 +564,6 @@ void SidechainPage::on_pushButtonWithdraw_clicked()
         return;
     }
 
-    // Cache users WithdrawalID
-    bmmCache.CacheWithdrawalID(wtid);
-
     // Successful withdraw message box
     messageBox.setWindowTitle("Withdrawal transaction created!");
     QString result = "txid: " + QString::fromStdString(txid.ToString());
@@ -60,7 +60,6 @@ void SidechainWithdrawalBundleHistoryDialog::setClientModel(ClientModel *model)
 {
     this->clientModel = model;
     withdrawalBundleHistoryModel->setClientModel(model);
-    withdrawalBundleHistoryModel->UpdateModel();
 }
 
 void SidechainWithdrawalBundleHistoryDialog::on_tableView_doubleClicked(const QModelIndex& index)
@@ -4,16 +4,14 @@
 
 #include <qt/sidechainwithdrawalbundlehistorytablemodel.h>
 
-#include <QTimer>
-
 #include <qt/bitcoinunits.h>
 #include <qt/clientmodel.h>
 #include <qt/guiconstants.h>
 #include <qt/optionsmodel.h>
+#include <qt/sidechainnotifier.h>
 #include <qt/walletmodel.h>
 
 #include <sidechain.h>
-#include <txdb.h>
 #include <validation.h>
 
 Q_DECLARE_METATYPE(WithdrawalBundleHistoryTableObject)
@@ -21,6 +19,11 @@ Q_DECLARE_METATYPE(WithdrawalBundleHistoryTableObject)
 SidechainWithdrawalBundleHistoryTableModel::SidechainWithdrawalBundleHistoryTableModel(QObject *parent) :
     QAbstractTableModel(parent)
 {
+    notifier = new SidechainNotifier(this);
+    connect(notifier, SIGNAL(WithdrawalBundlesLoaded(std::vector<SidechainWithdrawalBundle>)),
+            this, SLOT(WithdrawalBundlesLoaded(std::vector<SidechainWithdrawalBundle>)));
+    connect(notifier, SIGNAL(WithdrawalBundlesUpdated(std::vector<SidechainWithdrawalBundle>)),
+            this, SLOT(WithdrawalBundlesUpdated(std::vector<SidechainWithdrawalBundle>)));
 }
 
 int SidechainWithdrawalBundleHistoryTableModel::rowCount(const QModelIndex & /*parent*/) const
@@ -116,35 +119,46 @@ QVariant SidechainWithdrawalBundleHistoryTableModel::headerData(int section, Qt:
     return QVariant();
 }
 
-void SidechainWithdrawalBundleHistoryTableModel::UpdateModel()
+void SidechainWithdrawalBundleHistoryTableModel::WithdrawalBundlesLoaded(const std::vector<SidechainWithdrawalBundle>& vWithdrawalBundle)
 {
     beginResetModel();
     model.clear();
     endResetModel();
 
-    // Get all of the current WithdrawalBundle(s)
-    std::vector<SidechainWithdrawalBundle> vWithdrawalBundle;
-    vWithdrawalBundle = psidechaintree->GetWithdrawalBundles(THIS_SIDECHAIN);
-
-    if (vWithdrawalBundle.empty())
-        return;
-
-    // Sort WithdrawalBundle(s) by height
-    SortWithdrawalBundleByHeight(vWithdrawalBundle);
+    WithdrawalBundlesUpdated(vWithdrawalBundle);
+}
 
-    // Add WithdrawalBundle(s) to model
-    beginInsertRows(QModelIndex(), model.size(), model.size() + vWithdrawalBundle.size() - 1);
+void SidechainWithdrawalBundleHistoryTableModel::WithdrawalBundlesUpdated(const std::vector<SidechainWithdrawalBundle>& vWithdrawalBundle)
+{
     for (const SidechainWithdrawalBundle& wt : vWithdrawalBundle) {
         WithdrawalBundleHistoryTableObject object;
-
-        // Insert new WithdrawalBundle into table
         object.hash = QString::fromStdString(wt.tx.GetHash().ToString());
         object.amount = CTransaction(wt.tx).GetValueOut();
         object.status = QString::fromStdString(wt.GetStatusStr());
         object.height = wt.nHeight;
-        model.append(QVariant::fromValue(object));
+
+        // Update the WithdrawalBundle if it is already in the table
+        bool fFound = false;
+        for (int i = 0; i < model.size(); i++) {
+            if (model.at(i).value<WithdrawalBundleHistoryTableObject>().hash == object.hash) {
+                model[i] = QVariant::fromValue(object);
+                Q_EMIT dataChanged(index(i, 0), index(i, columnCount() - 1));
+                fFound = true;
+                break;
+            }
+        }
+        if (fFound)
+            continue;
+
+        // Insert new WithdrawalBundle into table sorted by height, newest first
+        int nRow = 0;
+        while (nRow < model.size() && model.at(nRow).value<WithdrawalBundleHistoryTableObject>().height >= object.height)
+            nRow++;
+
+        beginInsertRows(QModelIndex(), nRow, nRow);
+        model.insert(nRow, QVariant::fromValue(object));
+        endInsertRows();
     }
-    endInsertRows();
 }
 
 bool SidechainWithdrawalBundleHistoryTableModel::GetWithdrawalBundleInfoAtRow(int row, uint256& hash) const
@@ -172,7 +186,10 @@ void SidechainWithdrawalBundleHistoryTableModel::setClientModel(ClientModel *mod
     this->clientModel = model;
     if (model)
     {
-        connect(model, SIGNAL(numBlocksChanged(int, QDateTime, double, bool)),
-                this, SLOT(UpdateModel()));
+        // Load the WithdrawalBundle(s) in the background and then keep them up to date
+        notifier->Subscribe();
+        notifier->LoadWithdrawalBundles();
+    } else {
+        notifier->Unsubscribe();
     }
 }
@@ -6,18 +6,18 @@
 #define BITCOIN_SIDECHAINWITHDRAWAL_BUNDLEHISTORYTABLEMODEL_H
 
 #include <amount.h>
+#include <sidechain.h>
 #include <uint256.h>
 
 #include <QAbstractTableModel>
 #include <QList>
 
+#include <vector>
+
 class ClientModel;
+class SidechainNotifier;
 class WalletModel;
 
-QT_BEGIN_NAMESPACE
-class QTimer;
-QT_END_NAMESPACE
-
 struct WithdrawalBundleHistoryTableObject
 {
     QString hash;
@@ -43,11 +43,12 @@ public:
     void setClientModel(ClientModel *model);
 
 public Q_SLOTS:
-    void UpdateModel();
+    void WithdrawalBundlesLoaded(const std::vector<SidechainWithdrawalBundle>& vWithdrawalBundle);
+    void WithdrawalBundlesUpdated(const std::vector<SidechainWithdrawalBundle>& vWithdrawalBundle);
 
 private:
     QList<QVariant> model;
-    QTimer *pollTimer;
+    SidechainNotifier *notifier;
 
     WalletModel *walletModel;
     ClientModel *clientModel;
@@ -6,29 +6,34 @@
 
 #include <QBrush>
 #include <QColor>
-#include <QTimer>
 
 #include <qt/bitcoinunits.h>
 #include <qt/clientmodel.h>
 #include <qt/guiconstants.h>
 #include <qt/optionsmodel.h>
+#include <qt/sidechainnotifier.h>
 #include <qt/walletmodel.h>
 
-#include <bmmcache.h>
-#include <consensus/validation.h>
 #include <policy/withdrawalbundle.h>
 #include <sidechain.h>
-#include <txdb.h>
 #include <validation.h>
 
+#include <set>
+
 Q_DECLARE_METATYPE(WTTableObject)
 
 SidechainWithdrawalTableModel::SidechainWithdrawalTableModel(QObject *parent) :
     QAbstractTableModel(parent)
 {
+    walletModel = nullptr;
+    clientModel = nullptr;
     fOnlyMyWithdrawals = false;
 
     connect(parent, SIGNAL(OnlyMyWithdrawalsToggled(bool)), this, SLOT(SetOnlyMyWithdrawals(bool)));
+
+    notifier = new SidechainNotifier(this);
+    connect(notifier, SIGNAL(WithdrawalSelectionUpdated(std::vector<SidechainWithdrawalSelection>)),
+            this, SLOT(WithdrawalSelectionUpdated(std::vector<SidechainWithdrawalSelection>)));
 }
 
 int SidechainWithdrawalTableModel::rowCount(const QModelIndex & /*parent*/) const
@@ -96,9 +101,9 @@ QVariant SidechainWithdrawalTableModel::data(const QModelIndex &index, int role)
     }
     case Qt::BackgroundRole:
     {
-        // Highlight WT(s) with cumulative weight > MAX_WITHDRAWAL_BUNDLE_WEIGHT
-        // to indicate that they are not going to be included in the next bundle
-        if (object.nCumulativeWeight > MAX_WITHDRAWAL_BUNDLE_WEIGHT) {
+        // Highlight WT(s) which are not selected to indicate that they are not
+        // going to be included in the next bundle
+        if (!object.fSelected) {
             // Semi-transparent red
             return QBrush(QColor(255, 40, 0, 180));
         }
@@ -152,45 +157,14 @@ QVariant SidechainWithdrawalTableModel::headerData(int section, Qt::Orientation
 
 void SidechainWithdrawalTableModel::UpdateModel()
 {
-    beginResetModel();
-    model.clear();
-    endResetModel();
-
-    std::vector<SidechainWithdrawal> vWT;
-    vWT = psidechaintree->GetWithdrawals(THIS_SIDECHAIN);
-
-    SelectUnspentWithdrawal(vWT);
-
-    if (vWT.empty())
-        return;
-
-    SortWithdrawalByFee(vWT);
-
-    // Create a fake WithdrawalBundle transaction so that we can estimate the total size of
-    // the WithdrawalBundle. WT(s) in the table after the cumulative size is too large will
-    // be highlighted.
-    CMutableTransaction wjtx;
-    // Add SIDECHAIN_WITHDRAWAL_RETURN_DEST output
-    wjtx.vout.push_back(CTxOut(0, CScript() << OP_RETURN << ParseHex(HexStr(SIDECHAIN_WITHDRAWAL_BUNDLE_RETURN_DEST))));
-    // Add a dummy output for mainchain fee encoding
-    wjtx.vout.push_back(CTxOut(0, CScript() << OP_RETURN << CScriptNum(1LL << 40)));
-    wjtx.nVersion = 2;
-    wjtx.vin.resize(1); // Dummy vin for serialization...
-    wjtx.vin[0].scriptSig = CScript() << OP_0;
-
-    // Add WT(s) to model & to the fake WithdrawalBundle transaction to estimate size
-    //
-    // Loop through WTs and calculate TX size, copy WTs that should be displayed
-    // (based on fOnlyMyWithdrawals) into vector.
+    // Copy WT(s) that should be displayed (based on fOnlyMyWithdrawals) into
+    // vector. Sorting, selection and size estimates were done by notifier.
     std::vector<WTTableObject> vWTDisplay;
-    for (const SidechainWithdrawal& wt : vWT) {
-        // Add wt output to fake WithdrawalBundle and calculate size estimate as well as
-        // estimate which WTs will be included in the next WithdrawalBundle
-        CTxDestination dest = DecodeDestination(wt.strDestination, true /* fMainchain */);
-        wjtx.vout.push_back(CTxOut(wt.amount, GetScriptForDestination(dest)));
-
-        // Check if the Withdrawalis mine
-        bool fMine = bmmCache.IsMyWT(wt.GetID());
+    for (const SidechainWithdrawalSelection& selection : vSelection) {
+        const SidechainWithdrawal& wt = selection.withdrawal;
+
+        // Check if the withdrawal is mine
+        bool fMine = walletModel && walletModel->isMyWithdrawal(wt.GetID());
         if (!fMine && fOnlyMyWithdrawals)
             continue;
 
@@ -199,16 +173,72 @@ void SidechainWithdrawalTableModel::UpdateModel()
         object.amount = wt.amount;
         object.amountMainchainFee = wt.mainchainFee;
         object.destination = QString::fromStdString(wt.strDestination);
-        object.nCumulativeWeight = GetTransactionWeight(wjtx);
+        object.nCumulativeWeight = selection.nCumulativeWeight;
         object.fMine = fMine;
+        object.fSelected = selection.fSelected;
 
         vWTDisplay.push_back(object);
     }
 
-    beginInsertRows(QModelIndex(), model.size(), model.size() + vWTDisplay.size() - 1);
+    // Apply the difference between the current rows and vWTDisplay to the
+    // model instead of resetting it so that the view keeps its state.
+
+    // Remove rows which are no longer displayed
+    std::set<uint256> setDisplay;
     for (const WTTableObject& wt : vWTDisplay)
-        model.append(QVariant::fromValue(wt));
-    endInsertRows();
+        setDisplay.insert(wt.id);
+
+    std::set<uint256> setModel;
+    for (int i = model.size() - 1; i >= 0; i--) {
+        WTTableObject object = model.at(i).value<WTTableObject>();
+        if (setDisplay.count(object.id)) {
+            setModel.insert(object.id);
+            continue;
+        }
+        beginRemoveRows(QModelIndex(), i, i);
+        model.removeAt(i);
+        endRemoveRows();
+    }
+
+    // The remaining rows must be in the same order as they will be displayed
+    // for new rows to be inserted between them. Sorting doesn't guarantee the
+    // order of WT(s) with equal fees, so fall back to resetting the model.
+    int nRow = 0;
+    for (const WTTableObject& wt : vWTDisplay) {
+        if (!setModel.count(wt.id))
+            continue;
+        if (model.at(nRow).value<WTTableObject>().id != wt.id) {
+            beginResetModel();
+            model.clear();
+            for (const WTTableObject& object : vWTDisplay)
+                model.append(QVariant::fromValue(object));
+            endResetModel();
+            return;
+        }
+        nRow++;
+    }
+
+    // Insert new rows and update existing rows
+    for (int i = 0; i < (int)vWTDisplay.size(); i++) {
+        const WTTableObject& wt = vWTDisplay[i];
+        if (setModel.count(wt.id)) {
+            model[i] = QVariant::fromValue(wt);
+            continue;
+        }
+        beginInsertRows(QModelIndex(), i, i);
+        model.insert(i, QVariant::fromValue(wt));
+        endInsertRows();
+    }
+
+    // Selection & cumulative weight of existing rows may have changed
+    if (!model.isEmpty())
+        Q_EMIT dataChanged(index(0, 0), index(model.size() - 1, columnCount() - 1));
+}
+
+void SidechainWithdrawalTableModel::WithdrawalSelectionUpdated(const std::vector<SidechainWithdrawalSelection>& vSelectionIn)
+{
+    vSelection = vSelectionIn;
+    UpdateModel();
 }
 
 void SidechainWithdrawalTableModel::SetOnlyMyWithdrawals(bool fChecked)
@@ -220,6 +250,8 @@ void SidechainWithdrawalTableModel::SetOnlyMyWithdrawals(bool fChecked)
 void SidechainWithdrawalTableModel::setWalletModel(WalletModel *model)
 {
     this->walletModel = model;
+    // Which withdrawals are mine depends on the wallet
+    UpdateModel();
 }
 
 void SidechainWithdrawalTableModel::setClientModel(ClientModel *model)
@@ -227,9 +259,10 @@ void SidechainWithdrawalTableModel::setClientModel(ClientModel *model)
     this->clientModel = model;
     if (model)
     {
-        connect(model, SIGNAL(numBlocksChanged(int, QDateTime, double, bool)),
-                this, SLOT(UpdateModel()));
-
-        UpdateModel();
+        // Load the WT(s) in the background and then keep them up to date
+        notifier->Subscribe();
+        notifier->LoadWithdrawals();
+    } else {
+        notifier->Unsubscribe();
     }
 }
@@ -6,19 +6,19 @@
 #define BITCOIN_SIDECHAIN_WITHDRAWAL_BUNDLE_TABLEMODEL_H
 
 #include <amount.h>
+#include <qt/sidechainnotifier.h>
+#include <sidechain.h>
 #include <uint256.h>
 
 #include <QAbstractTableModel>
 #include <QList>
 #include <QString>
 
+#include <vector>
+
 class ClientModel;
 class WalletModel;
 
-QT_BEGIN_NAMESPACE
-class QTimer;
-QT_END_NAMESPACE
-
 struct WTTableObject
 {
     CAmount amount;
@@ -27,6 +27,7 @@ struct WTTableObject
     unsigned int nCumulativeWeight;
     uint256 id;
     bool fMine;
+    bool fSelected;
 };
 
 class SidechainWithdrawalTableModel : public QAbstractTableModel
@@ -54,10 +55,15 @@ public:
 public Q_SLOTS:
     void UpdateModel();
     void SetOnlyMyWithdrawals(bool fChecked);
+    void WithdrawalSelectionUpdated(const std::vector<SidechainWithdrawalSelection>& vSelectionIn);
 
 private:
     QList<QVariant> model;
-    QTimer *pollTimer;
+
+    // Unspent withdrawals in the order and selection of the next bundle,
+    // computed and kept up to date by notifier
+    std::vector<SidechainWithdrawalSelection> vSelection;
+    SidechainNotifier *notifier;
 
     WalletModel *walletModel;
     ClientModel *clientModel;
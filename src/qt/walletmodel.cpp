@@ -612,6 +612,11 @@ bool WalletModel::isLockedCoin(uint256 hash, unsigned int n) const
     return wallet->IsLockedCoin(hash, n);
 }
 
+bool WalletModel::isMyWithdrawal(const uint256& id) const
+{
+    return wallet->IsMyWithdrawal(id);
+}
+
 void WalletModel::lockCoin(COutPoint& output)
 {
     LOCK2(cs_main, wallet->cs_wallet);
@@ -6,6 +6,7 @@
 #include <rpc/blockchain.h>
 
 #include <amount.h>
+#include <base58.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
@@ -16,7 +17,9 @@
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <primitives/transaction.h>
+#include <random.h>
 #include <rpc/server.h>
+#include <script/standard.h>
 #include <streams.h>
 #include <sync.h>
 #include <txdb.h>
@@ -33,8 +36,11 @@
 
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <thread>
+#include <unordered_set>
 
 struct CUpdatedBlock
 {
@@ -903,29 +909,78 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" \"blockhash\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time with the hash_serialized_2 hash type.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"      (string, optional, default=hash_serialized_2) \"hash_serialized_2\" scans the UTXO set,\n"
+            "                      \"muhash\" returns the statistics which are updated with every block at once (requires -coinsrollingstats)\n"
+            "2. \"blockhash\"      (string, optional, default=tip) With muhash, the block after which to return the statistics,\n"
+            "                      one of the last " + std::to_string(COINS_ROLLING_STATS_WINDOW) + " blocks of the active chain. Statistics\n"
+            "                      of older blocks are not kept and return an error\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (hash_serialized_2 only)\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (hash_serialized_2 only)\n"
+            "  \"muhash\": \"hash\",      (string) The order independent MuHash of the UTXO set (muhash only)\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (hash_serialized_2 only)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
     UniValue ret(UniValue::VOBJ);
 
+    std::string strHashType = request.params[0].isNull() ? "hash_serialized_2" : request.params[0].get_str();
+    if (strHashType == "muhash") {
+        uint256 hashBlock;
+        int nHeight;
+        {
+            LOCK(cs_main);
+            CBlockIndex* pindex = chainActive.Tip();
+            if (!request.params[1].isNull()) {
+                hashBlock = ParseHashV(request.params[1], "blockhash");
+                BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+                if (it == mapBlockIndex.end())
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+                pindex = it->second;
+            }
+            if (!fCoinsRollingStatsEnabled)
+                throw JSONRPCError(RPC_MISC_ERROR, "UTXO set statistics are not maintained, restart with -coinsrollingstats");
+            if (!chainActive.Contains(pindex))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Block is not in the active chain");
+            if (chainActive.Height() - pindex->nHeight >= (int)COINS_ROLLING_STATS_WINDOW)
+                throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("UTXO set statistics are only kept for the last %u blocks", COINS_ROLLING_STATS_WINDOW));
+            hashBlock = pindex->GetBlockHash();
+            nHeight = pindex->nHeight;
+        }
+
+        CCoinsRollingStats stats;
+        if (!GetCoinsRollingStats(hashBlock, stats))
+            throw JSONRPCError(RPC_MISC_ERROR, "UTXO set statistics not available for this block");
+
+        ret.pushKV("height", (int64_t)nHeight);
+        ret.pushKV("bestblock", hashBlock.GetHex());
+        ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
+        ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
+        ret.pushKV("muhash", stats.GetHash().GetHex());
+        ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
+        return ret;
+    }
+    if (strHashType != "hash_serialized_2")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Unknown hash type %s", strHashType));
+    if (!request.params[1].isNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "blockhash is only supported with the muhash hash type");
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (GetUTXOStats(pcoinsdbview.get(), stats)) {
@@ -1588,6 +1643,259 @@ UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+/** Maximum number of cursors scantxoutset reads the chainstate with */
+static const int MAX_SCAN_THREADS = 8;
+
+static std::atomic<bool> g_scan_in_progress(false);
+static std::atomic<bool> g_should_abort_scan(false);
+/** Progress of a running scan in first key bytes (out of 256) covered */
+static std::atomic<int> g_scan_progress(0);
+
+/** RAII object to prevent concurrency issue when scanning the txout set */
+class CoinsViewScanReserver
+{
+private:
+    bool m_could_reserve;
+public:
+    CoinsViewScanReserver() : m_could_reserve(false) {}
+
+    bool reserve() {
+        assert(!m_could_reserve);
+        bool expected = false;
+        if (!g_scan_in_progress.compare_exchange_strong(expected, true))
+            return false;
+        m_could_reserve = true;
+        return true;
+    }
+
+    ~CoinsViewScanReserver() {
+        if (m_could_reserve)
+            g_scan_in_progress = false;
+    }
+};
+
+/** Salted hasher for the set of scripts scantxoutset looks for */
+class SaltedScriptHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedScriptHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+    size_t operator()(const CScript& script) const {
+        return CSipHasher(k0, k1).Write(script.data(), script.size()).Finalize();
+    }
+};
+
+typedef std::unordered_set<CScript, SaltedScriptHasher> ScanScriptSet;
+
+struct ScanResult {
+    COutPoint outpoint;
+    Coin coin;
+};
+
+/**
+ * Scan the coins with a txid whose first byte is in [nBegin, nEnd), starting
+ * from a cursor positioned at nBegin. The chainstate keys are ordered by the
+ * txid bytes from the lowest one, so each range is a contiguous part of the
+ * database and the ranges can be read by separate cursors at the same time.
+ */
+static bool ScanUTXOPartition(CCoinsViewCursor* pcursor, int nBegin, int nEnd, const ScanScriptSet& setScripts,
+                              std::vector<ScanResult>& vResult, int64_t& nSearched)
+{
+    int nProgress = nBegin;
+    while (pcursor->Valid()) {
+        if (g_should_abort_scan)
+            return false;
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+            return false;
+        const int nKeyByte = *key.hash.begin();
+        if (nKeyByte >= nEnd)
+            break;
+        if (nKeyByte > nProgress) {
+            g_scan_progress += nKeyByte - nProgress;
+            nProgress = nKeyByte;
+        }
+        nSearched++;
+        if (setScripts.count(coin.out.scriptPubKey))
+            vResult.push_back(ScanResult{key, std::move(coin)});
+        pcursor->Next();
+    }
+    g_scan_progress += nEnd - nProgress;
+    return true;
+}
+
+UniValue scantxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "scantxoutset \"action\" ( [scanobjects,...] )\n"
+            "\nScans the unspent transaction output set for entries that match certain output scripts.\n"
+            "The chainstate is read with several cursors over disjoint key ranges in parallel.\n"
+            "\nArguments:\n"
+            "1. \"action\"                       (string, required) The action to execute\n"
+            "                                      \"start\" for starting a scan\n"
+            "                                      \"abort\" for aborting the current scan (returns true when abort was successful)\n"
+            "                                      \"status\" for progress report (in %) of the current scan\n"
+            "2. \"scanobjects\"                  (array, required for \"start\") Array of scan objects\n"
+            "    [\n"
+            "      \"addr(<address>)\"             (string) An output to the address\n"
+            "      \"raw(<hex>)\"                  (string) An output with the hex encoded script\n"
+            "      ,...\n"
+            "    ]\n"
+            "\nResult (\"start\"):\n"
+            "{\n"
+            "  \"success\": true|false,         (boolean) Whether the scan was completed\n"
+            "  \"searched_items\": n,           (numeric) The number of unspent transaction outputs scanned\n"
+            "  \"height\": n,                   (numeric) The current block height (index)\n"
+            "  \"bestblock\": \"hex\",            (string) The hash of the block at the tip of the chain\n"
+            "  \"unspents\": [\n"
+            "    {\n"
+            "      \"txid\" : \"transactionid\",  (string) The transaction id\n"
+            "      \"vout\": n,                 (numeric) The vout value\n"
+            "      \"scriptPubKey\" : \"script\", (string) The script key\n"
+            "      \"amount\" : x.xxx,          (numeric) The total amount in " + CURRENCY_UNIT + " of the unspent output\n"
+            "      \"height\" : n,              (numeric) Height of the unspent transaction output\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"total_amount\" : x.xxx,        (numeric) The total amount of all found unspent outputs in " + CURRENCY_UNIT + "\n"
+            "}\n"
+            "\nResult (\"status\"):\n"
+            "{\n"
+            "  \"progress\": n                  (numeric) The scan progress, or null when no scan is in progress\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("scantxoutset", "\"start\" \"[\\\"raw(76a91400000000000000000000000000000000000000088ac)\\\"]\"")
+            + HelpExampleCli("scantxoutset", "\"status\"")
+            + HelpExampleRpc("scantxoutset", "\"abort\"")
+        );
+
+    RPCTypeCheck(request.params, {UniValue::VSTR, UniValue::VARR});
+
+    UniValue result(UniValue::VOBJ);
+    const std::string& strAction = request.params[0].get_str();
+    if (strAction == "status") {
+        CoinsViewScanReserver reserver;
+        if (reserver.reserve()) {
+            // No scan in progress
+            return NullUniValue;
+        }
+        result.pushKV("progress", g_scan_progress * 100 / 256);
+        return result;
+    } else if (strAction == "abort") {
+        CoinsViewScanReserver reserver;
+        if (reserver.reserve()) {
+            // Reserve was possible which means no scan was running
+            return false;
+        }
+        // Set the abort flag
+        g_should_abort_scan = true;
+        return true;
+    } else if (strAction != "start") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid command '%s'", strAction));
+    }
+
+    CoinsViewScanReserver reserver;
+    if (!reserver.reserve())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Scan already in progress, use action \"abort\" or \"status\"");
+    if (request.params[1].isNull())
+        throw JSONRPCError(RPC_MISC_ERROR, "No scan objects specified");
+
+    ScanScriptSet setScripts;
+    for (const UniValue& scanobject : request.params[1].get_array().getValues()) {
+        if (!scanobject.isStr())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Scan object must be a string");
+        const std::string& strObject = scanobject.get_str();
+        if (strObject.size() > 6 && strObject.compare(0, 5, "addr(") == 0 && strObject.back() == ')') {
+            CTxDestination dest = DecodeDestination(strObject.substr(5, strObject.size() - 6));
+            if (!IsValidDestination(dest))
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("Invalid address in scan object: %s", strObject));
+            setScripts.insert(GetScriptForDestination(dest));
+        } else if (strObject.size() > 5 && strObject.compare(0, 4, "raw(") == 0 && strObject.back() == ')') {
+            const std::string strHex = strObject.substr(4, strObject.size() - 5);
+            if (!IsHex(strHex))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid hex in scan object: %s", strObject));
+            std::vector<unsigned char> vScript(ParseHex(strHex));
+            setScripts.insert(CScript(vScript.begin(), vScript.end()));
+        } else {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Invalid scan object: %s", strObject));
+        }
+    }
+
+    g_scan_progress = 0;
+    g_should_abort_scan = false;
+
+    // Every partition gets its own cursor and thread. A cursor reads a
+    // snapshot of the database taken when it is created, so all of them are
+    // created under cs_main right after the flush, before another block can
+    // be connected and written.
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_SCAN_THREADS));
+    std::vector<std::unique_ptr<CCoinsViewCursor>> vCursors;
+    uint256 hashBlock;
+    int nHeight;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        hashBlock = pcoinsdbview->GetBestBlock();
+        nHeight = mapBlockIndex.find(hashBlock)->second->nHeight;
+        for (int t = 0; t < nThreads; t++) {
+            uint256 hashStart;
+            *hashStart.begin() = (unsigned char)(256 * t / nThreads);
+            vCursors.emplace_back(pcoinsdbview->Cursor(hashStart));
+            assert(vCursors.back());
+            if (vCursors.back()->GetBestBlock() != hashBlock)
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read a consistent UTXO set");
+        }
+    }
+
+    std::vector<std::vector<ScanResult>> vResults(nThreads);
+    std::vector<int64_t> vSearched(nThreads, 0);
+    std::vector<char> vSuccess(nThreads, false);
+    std::vector<std::thread> vThreads;
+    vThreads.reserve(nThreads);
+    for (int t = 0; t < nThreads; t++) {
+        const int nBegin = 256 * t / nThreads;
+        const int nEnd = 256 * (t + 1) / nThreads;
+        vThreads.emplace_back([&, t, nBegin, nEnd]() {
+            vSuccess[t] = ScanUTXOPartition(vCursors[t].get(), nBegin, nEnd, setScripts, vResults[t], vSearched[t]);
+        });
+    }
+    for (std::thread& thread : vThreads)
+        thread.join();
+
+    bool fSuccess = true;
+    int64_t nSearched = 0;
+    CAmount nTotal = 0;
+    UniValue unspents(UniValue::VARR);
+    for (int t = 0; t < nThreads; t++) {
+        fSuccess &= (bool)vSuccess[t];
+        nSearched += vSearched[t];
+        for (const ScanResult& res : vResults[t]) {
+            UniValue unspent(UniValue::VOBJ);
+            unspent.pushKV("txid", res.outpoint.hash.GetHex());
+            unspent.pushKV("vout", (int32_t)res.outpoint.n);
+            unspent.pushKV("scriptPubKey", HexStr(res.coin.out.scriptPubKey.begin(), res.coin.out.scriptPubKey.end()));
+            unspent.pushKV("amount", ValueFromAmount(res.coin.out.nValue));
+            unspent.pushKV("height", (int32_t)res.coin.nHeight);
+            unspents.push_back(unspent);
+            nTotal += res.coin.out.nValue;
+        }
+    }
+
+    result.pushKV("success", fSuccess);
+    result.pushKV("searched_items", nSearched);
+    result.pushKV("height", nHeight);
+    result.pushKV("bestblock", hashBlock.GetHex());
+    result.pushKV("unspents", unspents);
+    result.pushKV("total_amount", ValueFromAmount(nTotal));
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1606,9 +1914,10 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type","blockhash"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
+    { "blockchain",         "scantxoutset",           &scantxoutset,           {"action", "scanobjects"} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
 
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
@@ -99,6 +99,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "fundrawtransaction", 2, "iswitness" },
     { "gettxout", 1, "n" },
     { "gettxout", 2, "include_mempool" },
+    { "scantxoutset", 1, "scanobjects" },
     { "gettxoutproof", 0, "txids" },
     { "lockunspent", 0, "unlock" },
     { "lockunspent", 1, "transactions" },
@@ -150,6 +151,10 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "refreshbmm", 0, "amount" },
     { "refreshbmm", 1, "createnew" },
     { "getmainchainblockhash", 0, "height" },
+    { "getsidechainperfstats", 0, "reset" },
+    { "listwithdrawals", 1, "limit" },
+    { "listwithdrawalbundles", 1, "limit" },
+    { "listdeposits", 0, "limit" },
 };
 
 class CRPCConvertTable
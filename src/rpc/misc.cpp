@@ -19,6 +19,7 @@
 #include <rpc/util.h>
 #include <sidechain.h>
 #include <sidechainclient.h>
+#include <sidechainperf.h>
 #include <timedata.h>
 #include <txdb.h>
 #include <util.h>
@@ -676,29 +677,6 @@ UniValue updatemainblockcache(const JSONRPCRequest& request)
     return result;
 }
 
-UniValue listmywithdrawals(const JSONRPCRequest& request)
-{
-    if (request.fHelp || request.params.size())
-        throw std::runtime_error(
-            "listmywithdrawals\n"
-            "\nArguments: None\n"
-            "\nList your sidechain withdrawals.\n"
-            "\nResult:\n"
-            "id             (string)\n"
-        );
-
-    std::set<uint256> setID = bmmCache.GetCachedWithdrawalID();
-
-    UniValue result(UniValue::VARR);
-    for (const uint256& u : setID) {
-        UniValue obj(UniValue::VOBJ);
-        obj.pushKV("id", u.ToString());
-        result.push_back(obj);
-    }
-
-    return result;
-}
-
 UniValue rebroadcastwithdrawalbundle(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size())
@@ -805,6 +783,408 @@ UniValue formatdepositaddress(const JSONRPCRequest& request)
     return strDepositAddress;
 }
 
+/** Default and maximum number of objects returned by the sidechain list RPCs */
+static const int DEFAULT_SIDECHAIN_LIST_LIMIT = 100;
+static const int MAX_SIDECHAIN_LIST_LIMIT = 1000;
+
+/** Parse the limit & cursor params of the sidechain list RPCs */
+static void ParseSidechainListParams(const JSONRPCRequest& request, size_t nLimitIndex, int& nLimit, uint256& hashAfter)
+{
+    nLimit = DEFAULT_SIDECHAIN_LIST_LIMIT;
+    if (request.params.size() > nLimitIndex && !request.params[nLimitIndex].isNull())
+        nLimit = request.params[nLimitIndex].get_int();
+
+    if (nLimit < 1 || nLimit > MAX_SIDECHAIN_LIST_LIMIT)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("limit must be between 1 and %d", MAX_SIDECHAIN_LIST_LIMIT));
+
+    hashAfter.SetNull();
+    if (request.params.size() > nLimitIndex + 1 && !request.params[nLimitIndex + 1].isNull())
+        hashAfter = ParseHashV(request.params[nLimitIndex + 1], "cursor");
+}
+
+UniValue listwithdrawals(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 3)
+        throw std::runtime_error(
+            "listwithdrawals ( \"status\" limit \"cursor\" )\n"
+            "\nList sidechain withdrawals a page at a time.\n"
+            "\nArguments:\n"
+            "1. \"status\"     (string, optional, default=\"all\") Only list withdrawals with this status: \"unspent\", \"pending\", \"spent\" or \"all\"\n"
+            "2. limit        (numeric, optional, default=" + std::to_string(DEFAULT_SIDECHAIN_LIST_LIMIT) + ") Maximum number of withdrawals to return\n"
+            "3. \"cursor\"     (string, optional) The cursor returned by the previous call, to get the next page\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"withdrawals\": [\n"
+            "    {\n"
+            "      \"id\": xxxx,                 (string) The withdrawal ID\n"
+            "      \"destination\": xxxx,        (string) Mainchain destination\n"
+            "      \"refunddestination\": xxxx,  (string) Sidechain refund destination\n"
+            "      \"amount\": n,                (numeric) Amount in satoshis\n"
+            "      \"amountmainchainfee\": n,    (numeric) Mainchain fee in satoshis\n"
+            "      \"status\": xxxx,             (string) Withdrawal status\n"
+            "      \"hashblindtx\": xxxx,        (string) Hash of the withdrawal transaction minus the serialization output\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"cursor\": xxxx                 (string) Cursor for the next page, not set on the last page. A page\n"
+            "                                 filtered by status may hold fewer withdrawals than limit, even none\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("listwithdrawals", "")
+            + HelpExampleCli("listwithdrawals", "\"unspent\" 10")
+            + HelpExampleRpc("listwithdrawals", "\"all\", 10, \"cursor\"")
+        );
+
+    char status = 0;
+    if (!request.params[0].isNull()) {
+        std::string strStatus = request.params[0].get_str();
+        if (strStatus == "unspent")
+            status = WITHDRAWAL_UNSPENT;
+        else
+        if (strStatus == "pending")
+            status = WITHDRAWAL_IN_BUNDLE;
+        else
+        if (strStatus == "spent")
+            status = WITHDRAWAL_SPENT;
+        else
+        if (strStatus != "all")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid status!");
+    }
+
+    int nLimit;
+    uint256 hashAfter;
+    ParseSidechainListParams(request, 1, nLimit, hashAfter);
+
+    uint256 hashNext;
+    std::vector<SidechainWithdrawal> vWithdrawal = psidechaintree->ListWithdrawals(hashAfter, nLimit, status, hashNext);
+
+    UniValue arr(UniValue::VARR);
+    for (const SidechainWithdrawal& wt : vWithdrawal) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("id", wt.GetID().ToString());
+        obj.pushKV("destination", wt.strDestination);
+        obj.pushKV("refunddestination", wt.strRefundDestination);
+        obj.pushKV("amount", wt.amount);
+        obj.pushKV("amountmainchainfee", wt.mainchainFee);
+        obj.pushKV("status", wt.GetStatusStr());
+        obj.pushKV("hashblindtx", wt.hashBlindTx.ToString());
+        arr.push_back(obj);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("withdrawals", arr);
+    if (!hashNext.IsNull())
+        result.pushKV("cursor", hashNext.GetHex());
+
+    return result;
+}
+
+UniValue listwithdrawalbundles(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 3)
+        throw std::runtime_error(
+            "listwithdrawalbundles ( \"status\" limit \"cursor\" )\n"
+            "\nList WithdrawalBundle(s) a page at a time.\n"
+            "\nArguments:\n"
+            "1. \"status\"     (string, optional, default=\"all\") Only list WithdrawalBundle(s) with this status: \"created\", \"failed\", \"spent\" or \"all\"\n"
+            "2. limit        (numeric, optional, default=" + std::to_string(DEFAULT_SIDECHAIN_LIST_LIMIT) + ") Maximum number of WithdrawalBundle(s) to return\n"
+            "3. \"cursor\"     (string, optional) The cursor returned by the previous call, to get the next page\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"withdrawalbundles\": [\n"
+            "    {\n"
+            "      \"id\": xxxx,           (string) The WithdrawalBundle ID\n"
+            "      \"txid\": xxxx,         (string) The WithdrawalBundle transaction hash\n"
+            "      \"status\": xxxx,       (string) WithdrawalBundle status\n"
+            "      \"height\": n,          (numeric) Sidechain height the WithdrawalBundle was created at\n"
+            "      \"failheight\": n,      (numeric) Sidechain height the WithdrawalBundle failed at\n"
+            "      \"amount\": n,          (numeric) Total output amount in satoshis\n"
+            "      \"withdrawals\": n,     (numeric) Number of withdrawals paid out\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"cursor\": xxxx           (string) Cursor for the next page, not set on the last page. A page\n"
+            "                           filtered by status may hold fewer WithdrawalBundle(s) than limit, even none\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("listwithdrawalbundles", "")
+            + HelpExampleCli("listwithdrawalbundles", "\"failed\" 10")
+            + HelpExampleRpc("listwithdrawalbundles", "\"all\", 10, \"cursor\"")
+        );
+
+    char status = 0;
+    if (!request.params[0].isNull()) {
+        std::string strStatus = request.params[0].get_str();
+        if (strStatus == "created")
+            status = WITHDRAWAL_BUNDLE_CREATED;
+        else
+        if (strStatus == "failed")
+            status = WITHDRAWAL_BUNDLE_FAILED;
+        else
+        if (strStatus == "spent")
+            status = WITHDRAWAL_BUNDLE_SPENT;
+        else
+        if (strStatus != "all")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid status!");
+    }
+
+    int nLimit;
+    uint256 hashAfter;
+    ParseSidechainListParams(request, 1, nLimit, hashAfter);
+
+    uint256 hashNext;
+    std::vector<SidechainWithdrawalBundle> vWithdrawalBundle = psidechaintree->ListWithdrawalBundles(hashAfter, nLimit, status, hashNext);
+
+    UniValue arr(UniValue::VARR);
+    for (const SidechainWithdrawalBundle& bundle : vWithdrawalBundle) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("id", bundle.GetID().ToString());
+        obj.pushKV("txid", bundle.tx.GetHash().ToString());
+        obj.pushKV("status", bundle.GetStatusStr());
+        obj.pushKV("height", bundle.nHeight);
+        obj.pushKV("failheight", bundle.nFailHeight);
+        obj.pushKV("amount", CTransaction(bundle.tx).GetValueOut());
+        obj.pushKV("withdrawals", (uint64_t)bundle.vWithdrawalID.size());
+        arr.push_back(obj);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("withdrawalbundles", arr);
+    if (!hashNext.IsNull())
+        result.pushKV("cursor", hashNext.GetHex());
+
+    return result;
+}
+
+UniValue listdeposits(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 2)
+        throw std::runtime_error(
+            "listdeposits ( limit \"cursor\" )\n"
+            "\nList sidechain deposits a page at a time.\n"
+            "\nArguments:\n"
+            "1. limit        (numeric, optional, default=" + std::to_string(DEFAULT_SIDECHAIN_LIST_LIMIT) + ") Maximum number of deposits to return\n"
+            "2. \"cursor\"     (string, optional) The cursor returned by the previous call, to get the next page\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"deposits\": [\n"
+            "    {\n"
+            "      \"id\": xxxx,                 (string) The deposit ID\n"
+            "      \"destination\": xxxx,        (string) Sidechain destination\n"
+            "      \"amount\": n,                (numeric) Amount paid out on the sidechain in satoshis\n"
+            "      \"mainchaintxid\": xxxx,      (string) Mainchain deposit transaction hash\n"
+            "      \"burnindex\": n,             (numeric) Deposit output index\n"
+            "      \"ntx\": n,                   (numeric) Deposit transaction number in the mainchain block\n"
+            "      \"mainchainblockhash\": xxxx, (string) Mainchain block hash\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"cursor\": xxxx                 (string) Cursor for the next page, not set on the last page\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("listdeposits", "")
+            + HelpExampleCli("listdeposits", "10")
+            + HelpExampleRpc("listdeposits", "10, \"cursor\"")
+        );
+
+    int nLimit;
+    uint256 hashAfter;
+    ParseSidechainListParams(request, 0, nLimit, hashAfter);
+
+    uint256 hashNext;
+    std::vector<SidechainDeposit> vDeposit = psidechaintree->ListDeposits(hashAfter, nLimit, hashNext);
+
+    UniValue arr(UniValue::VARR);
+    for (const SidechainDeposit& deposit : vDeposit) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("id", deposit.GetID().ToString());
+        obj.pushKV("destination", deposit.strDest);
+        obj.pushKV("amount", deposit.amtUserPayout);
+        obj.pushKV("mainchaintxid", deposit.dtx.GetHash().ToString());
+        obj.pushKV("burnindex", (uint64_t)deposit.nBurnIndex);
+        obj.pushKV("ntx", (uint64_t)deposit.nTx);
+        obj.pushKV("mainchainblockhash", deposit.hashMainchainBlock.ToString());
+        arr.push_back(obj);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("deposits", arr);
+    if (!hashNext.IsNull())
+        result.pushKV("cursor", hashNext.GetHex());
+
+    return result;
+}
+
+UniValue getsidechainperfstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getsidechainperfstats ( reset )\n"
+            "\nGet call counts and latency of sidechain operations and mainchain\n"
+            "requests, and hit rates of the sidechain verification caches.\n"
+            "Latency percentiles are calculated from the most recent samples.\n"
+            "\nArguments:\n"
+            "1. reset   (boolean, optional, default=false) Reset the stats after returning them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"timing\": [\n"
+            "    {\n"
+            "      \"name\": xxxx,     (string) The operation\n"
+            "      \"count\": n,       (numeric) Number of calls\n"
+            "      \"total_ms\": n,    (numeric) Total time spent\n"
+            "      \"avg_ms\": n,      (numeric) Average latency\n"
+            "      \"p50_ms\": n,      (numeric) Median latency\n"
+            "      \"p90_ms\": n,      (numeric) 90th percentile latency\n"
+            "      \"p99_ms\": n,      (numeric) 99th percentile latency\n"
+            "      \"max_ms\": n,      (numeric) Maximum latency\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"cache\": [\n"
+            "    {\n"
+            "      \"name\": xxxx,     (string) The cache\n"
+            "      \"hits\": n,        (numeric) Number of lookups found in the cache\n"
+            "      \"misses\": n,      (numeric) Number of lookups not found in the cache\n"
+            "      \"hitrate\": n,     (numeric) Fraction of lookups found in the cache\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsidechainperfstats", "")
+            + HelpExampleRpc("getsidechainperfstats", "")
+        );
+
+    bool fReset = false;
+    if (!request.params[0].isNull())
+        fReset = request.params[0].get_bool();
+
+    std::map<std::string, SidechainTimingStat> mapTiming = GetSidechainTimingStats();
+    std::map<std::string, SidechainCacheStat> mapCache = GetSidechainCacheStats();
+
+    if (fReset)
+        ResetSidechainPerfStats();
+
+    UniValue timing(UniValue::VARR);
+    for (const auto& it : mapTiming) {
+        const SidechainTimingStat& stat = it.second;
+
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("name", it.first);
+        obj.pushKV("count", stat.nCount);
+        obj.pushKV("total_ms", stat.nTotalMicros * 0.001);
+        obj.pushKV("avg_ms", stat.nCount ? stat.nTotalMicros * 0.001 / stat.nCount : 0.0);
+        obj.pushKV("p50_ms", stat.GetPercentile(50) * 0.001);
+        obj.pushKV("p90_ms", stat.GetPercentile(90) * 0.001);
+        obj.pushKV("p99_ms", stat.GetPercentile(99) * 0.001);
+        obj.pushKV("max_ms", stat.nMaxMicros * 0.001);
+        timing.push_back(obj);
+    }
+
+    UniValue cache(UniValue::VARR);
+    for (const auto& it : mapCache) {
+        const SidechainCacheStat& stat = it.second;
+        uint64_t nLookup = stat.nHit + stat.nMiss;
+
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("name", it.first);
+        obj.pushKV("hits", stat.nHit);
+        obj.pushKV("misses", stat.nMiss);
+        obj.pushKV("hitrate", nLookup ? (double)stat.nHit / nLookup : 0.0);
+        cache.push_back(obj);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("timing", timing);
+    result.pushKV("cache", cache);
+
+    return result;
+}
+
+static UniValue SidechainStateInfoToJSON(const SidechainStateInfo& info)
+{
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("hash", info.hashContent.GetHex());
+    result.pushKV("blockhash", info.hashBlock.GetHex());
+    result.pushKV("height", info.nHeight);
+    result.pushKV("coins", info.nCoins);
+    result.pushKV("records", info.nRecords);
+    return result;
+}
+
+UniValue dumpsidechainstate(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumpsidechainstate \"filename\"\n"
+            "\nWrite the UTXO set, sidechain database and BMM caches at the current\n"
+            "tip to a snapshot file which a new node can load with loadsidechainstate.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The filename with path (either absolute or relative to the working directory)\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"hash\": xxxx,        (string) Content hash of the snapshot, to be passed to loadsidechainstate\n"
+            "  \"blockhash\": xxxx,   (string) The block hash of the snapshot tip\n"
+            "  \"height\": n,         (numeric) The height of the snapshot tip\n"
+            "  \"coins\": n,          (numeric) Number of unspent outputs\n"
+            "  \"records\": n,        (numeric) Number of sidechain database records\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumpsidechainstate", "\"snapshot.dat\"")
+            + HelpExampleRpc("dumpsidechainstate", "\"snapshot.dat\"")
+        );
+
+    fs::path path = fs::absolute(request.params[0].get_str());
+    if (fs::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists. If you are sure this is what you want, move it out of the way first");
+
+    SidechainStateInfo info;
+    std::string strError;
+    if (!DumpSidechainState(path, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    return SidechainStateInfoToJSON(info);
+}
+
+UniValue loadsidechainstate(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 2)
+        throw std::runtime_error(
+            "loadsidechainstate \"filename\" \"hash\"\n"
+            "\nReplace the UTXO set, sidechain database and BMM caches with a snapshot\n"
+            "written by dumpsidechainstate, and continue syncing from the snapshot tip.\n"
+            "The snapshot is only loaded if its content hash matches the trusted hash.\n"
+            "Only the headers up to the snapshot tip must be downloaded, blocks below\n"
+            "the snapshot tip are not downloaded or validated and the chain can't be\n"
+            "reorganized below it, and the node stops offering NODE_NETWORK to peers.\n"
+            "Restart with -rescan to update the wallet. If loading fails after the state\n"
+            "was changed the node shuts down and must be restarted with -reindex.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The filename with path (either absolute or relative to the working directory)\n"
+            "2. \"hash\"        (string, required) The trusted content hash of the snapshot\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"hash\": xxxx,        (string) Content hash of the snapshot\n"
+            "  \"blockhash\": xxxx,   (string) The block hash of the snapshot tip\n"
+            "  \"height\": n,         (numeric) The height of the snapshot tip\n"
+            "  \"coins\": n,          (numeric) Number of unspent outputs\n"
+            "  \"records\": n,        (numeric) Number of sidechain database records\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadsidechainstate", "\"snapshot.dat\" \"hash\"")
+            + HelpExampleRpc("loadsidechainstate", "\"snapshot.dat\", \"hash\"")
+        );
+
+    fs::path path = fs::absolute(request.params[0].get_str());
+    uint256 hashExpected = ParseHashV(request.params[1], "hash");
+
+    SidechainStateInfo info;
+    std::string strError;
+    if (!LoadSidechainState(path, hashExpected, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    // Blocks below the snapshot can't be served
+    if (g_connman)
+        g_connman->RemoveLocalServices(NODE_NETWORK);
+
+    return SidechainStateInfoToJSON(info);
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                        actor (function)           argNames
   //  --------------------- ------------------------    -----------------------    ----------
@@ -829,10 +1209,15 @@ static const CRPCCommand commands[] =
     { "sidechain",          "getwithdrawalbundle",          &getwithdrawalbundle,           {}},
     { "sidechain",          "verifymainblockcache",         &verifymainblockcache,          {}},
     { "sidechain",          "updatemainblockcache",         &updatemainblockcache,          {}},
-    { "sidechain",          "listmywithdrawals",            &listmywithdrawals,             {}},
     { "sidechain",          "rebroadcastwithdrawalbundle",  &rebroadcastwithdrawalbundle,   {}},
     { "sidechain",          "getwithdrawal",                &getwithdrawal,                 {"id"}},
     { "sidechain",          "formatdepositaddress",         &formatdepositaddress,          {"address"}},
+    { "sidechain",          "getsidechainperfstats",        &getsidechainperfstats,         {"reset"}},
+    { "sidechain",          "listwithdrawals",              &listwithdrawals,               {"status", "limit", "cursor"}},
+    { "sidechain",          "listwithdrawalbundles",        &listwithdrawalbundles,         {"status", "limit", "cursor"}},
+    { "sidechain",          "listdeposits",                 &listdeposits,                  {"limit", "cursor"}},
+    { "sidechain",          "dumpsidechainstate",           &dumpsidechainstate,            {"filename"}},
+    { "sidechain",          "loadsidechainstate",           &loadsidechainstate,            {"filename", "hash"}},
 
 };
 
@@ -4,14 +4,22 @@
 
 #include <sidechain.h>
 
+#include <base58.h>
+#include <chainparams.h>
 #include <clientversion.h>
+#include <consensus/validation.h>
 #include <core_io.h>
 #include <hash.h>
+#include <policy/withdrawalbundle.h>
+#include <script/standard.h>
 #include <streams.h>
 #include <utilmoneystr.h>
 #include <utilstrencodings.h>
+#include <validation.h>
+#include <version.h>
 
 #include <algorithm>
+#include <map>
 #include <sstream>
 
 const uint32_t nType = 1;
@@ -173,6 +181,158 @@ void SelectUnspentWithdrawal(std::vector<SidechainWithdrawal>& vWT)
                 {return wt.status != WITHDRAWAL_UNSPENT;}), vWT.end());
 }
 
+CMutableTransaction CreateWithdrawalBundleBase()
+{
+    CMutableTransaction wjtx;
+
+    // Add SIDECHAIN_WITHDRAWAL_BUNDLE_RETURN_DEST OP_RETURN output
+    wjtx.vout.push_back(CTxOut(0, CScript() << OP_RETURN << ParseHex(HexStr(SIDECHAIN_WITHDRAWAL_BUNDLE_RETURN_DEST))));
+
+    // Add the mainchain fee encoding output. The encoding has the same size
+    // for any amount, so the bundle doesn't grow when it is updated.
+    wjtx.vout.push_back(CTxOut(0, EncodeWithdrawalFees(MAX_MONEY)));
+
+    wjtx.nVersion = 2;
+    wjtx.vin.resize(1); // Dummy vin for serialization...
+    wjtx.vin[0].scriptSig = CScript() << OP_0;
+
+    return wjtx;
+}
+
+/**
+ * Selection of bundles created below WithdrawalBundlePackHeight: withdrawals
+ * are added in fee order until one doesn't fit. The fee output is sized with
+ * the placeholder older releases used, which is 2 bytes short.
+ */
+static std::vector<bool> SelectWithdrawalsInOrder(const std::vector<SidechainWithdrawal>& vWithdrawal)
+{
+    CMutableTransaction wjtx = CreateWithdrawalBundleBase();
+    wjtx.vout[1].scriptPubKey = CScript() << OP_RETURN << CScriptNum(1LL << 40);
+
+    std::vector<bool> vSelected(vWithdrawal.size(), false);
+    for (size_t i = 0; i < vWithdrawal.size(); i++) {
+        const SidechainWithdrawal& withdrawal = vWithdrawal[i];
+        CTxDestination dest = DecodeDestination(withdrawal.strDestination, true /* fMainchain */);
+        wjtx.vout.push_back(CTxOut(withdrawal.amount - withdrawal.mainchainFee, GetScriptForDestination(dest)));
+
+        if (GetTransactionWeight(wjtx) > MAX_WITHDRAWAL_BUNDLE_WEIGHT)
+            break;
+
+        vSelected[i] = true;
+    }
+    return vSelected;
+}
+
+std::vector<bool> SelectWithdrawalsForBundle(int nHeight, const std::vector<SidechainWithdrawal>& vWithdrawal)
+{
+    if (nHeight < Params().GetConsensus().WithdrawalBundlePackHeight)
+        return SelectWithdrawalsInOrder(vWithdrawal);
+
+    const CMutableTransaction wjtxBase = CreateWithdrawalBundleBase();
+
+    // The bundle has no witness data so weight is 4x the serialized size
+    unsigned int nBaseWeight = GetTransactionWeight(wjtxBase);
+    if (nBaseWeight >= MAX_WITHDRAWAL_BUNDLE_WEIGHT)
+        return std::vector<bool>(vWithdrawal.size(), false);
+
+    unsigned int nSpace = (MAX_WITHDRAWAL_BUNDLE_WEIGHT - nBaseWeight) / WITNESS_SCALE_FACTOR;
+
+    // Reserve space for the output count to grow if every withdrawal is added
+    size_t nSizeCount = GetSizeOfCompactSize(wjtxBase.vout.size());
+    size_t nSizeCountMax = GetSizeOfCompactSize(wjtxBase.vout.size() + vWithdrawal.size());
+    if (nSizeCountMax - nSizeCount >= nSpace)
+        return std::vector<bool>(vWithdrawal.size(), false);
+
+    nSpace -= nSizeCountMax - nSizeCount;
+
+    std::vector<CAmount> vFee;
+    std::vector<unsigned int> vSize;
+    for (const SidechainWithdrawal& withdrawal : vWithdrawal) {
+        CTxDestination dest = DecodeDestination(withdrawal.strDestination, true /* fMainchain */);
+        CTxOut out(withdrawal.amount - withdrawal.mainchainFee, GetScriptForDestination(dest));
+
+        vFee.push_back(withdrawal.mainchainFee);
+        vSize.push_back(::GetSerializeSize(out, SER_NETWORK, PROTOCOL_VERSION));
+    }
+
+    return PackWithdrawalBundle(vFee, vSize, nSpace);
+}
+
+std::vector<bool> PackWithdrawalBundle(const std::vector<CAmount>& vFee, const std::vector<unsigned int>& vSize, unsigned int nSpace)
+{
+    std::vector<bool> vSelected(vFee.size(), false);
+
+    // Group items by size. Within a group the best choice of n items is always
+    // the first n when the group is sorted by fee, so for each group we only
+    // have to decide how many items to take.
+    std::map<unsigned int, std::vector<size_t>> mapGroup;
+    for (size_t i = 0; i < vFee.size(); i++) {
+        if (vSize[i] && vSize[i] <= nSpace)
+            mapGroup[vSize[i]].push_back(i);
+    }
+
+    // Total fee and item count
+    typedef std::pair<CAmount, size_t> PackValue;
+
+    // vBest[c]: best value using at most c bytes of the groups processed so far
+    std::vector<PackValue> vBest(nSpace + 1, PackValue(0, 0));
+
+    // vvTake[g][c]: number of items taken from group g for vBest[c]
+    std::vector<std::vector<size_t>> vvTake;
+    std::vector<std::vector<size_t>> vvGroup;
+    std::vector<unsigned int> vGroupSize;
+
+    for (auto& group : mapGroup) {
+        const unsigned int nSize = group.first;
+        std::vector<size_t>& vIndex = group.second;
+
+        std::stable_sort(vIndex.begin(), vIndex.end(), [&vFee](size_t a, size_t b)
+                {return vFee[a] > vFee[b];});
+
+        size_t nMax = std::min(vIndex.size(), (size_t)(nSpace / nSize));
+        vIndex.resize(nMax);
+
+        std::vector<CAmount> vPrefixFee(nMax + 1, 0);
+        for (size_t k = 0; k < nMax; k++)
+            vPrefixFee[k + 1] = vPrefixFee[k] + vFee[vIndex[k]];
+
+        std::vector<PackValue> vNext(nSpace + 1);
+        std::vector<size_t> vTake(nSpace + 1, 0);
+        for (unsigned int c = 0; c <= nSpace; c++) {
+            PackValue best = vBest[c];
+            size_t nTake = 0;
+            size_t nLimit = std::min(nMax, (size_t)(c / nSize));
+            for (size_t k = 1; k <= nLimit; k++) {
+                const PackValue& prev = vBest[c - k * nSize];
+                PackValue value(prev.first + vPrefixFee[k], prev.second + k);
+                if (value > best) {
+                    best = value;
+                    nTake = k;
+                }
+            }
+            vNext[c] = best;
+            vTake[c] = nTake;
+        }
+
+        vBest.swap(vNext);
+        vvTake.push_back(vTake);
+        vvGroup.push_back(vIndex);
+        vGroupSize.push_back(nSize);
+    }
+
+    // Walk back through the groups to find the items taken
+    unsigned int c = nSpace;
+    for (size_t g = vvTake.size(); g-- > 0;) {
+        size_t nTake = vvTake[g][c];
+        for (size_t k = 0; k < nTake; k++)
+            vSelected[vvGroup[g][k]] = true;
+
+        c -= nTake * vGroupSize[g];
+    }
+
+    return vSelected;
+}
+
 CScript SidechainObj::GetScript(void) const
 {
     CDataStream ds (SER_DISK, CLIENT_VERSION);
@@ -272,6 +272,22 @@ void SortWithdrawalBundleByHeight(std::vector<SidechainWithdrawalBundle>& vWithd
 // Erase all SidechainWithdrawal from a vector which do not have WITHDRAWAL_UNSPENT status
 void SelectUnspentWithdrawal(std::vector<SidechainWithdrawal>& vWithdrawal);
 
+// Create a withdrawal bundle transaction with the return destination and
+// mainchain fee outputs but no withdrawals, sized as the final bundle
+CMutableTransaction CreateWithdrawalBundleBase();
+
+// Select which SidechainWithdrawal (sorted by SortWithdrawalByFee) to pay out
+// in the withdrawal bundle created at nHeight. From WithdrawalBundlePackHeight
+// fills the bundle up to MAX_WITHDRAWAL_BUNDLE_WEIGHT maximizing the total
+// mainchain fee, then the number of withdrawals. Before it, withdrawals are
+// taken in order until one doesn't fit. Returns a flag for each withdrawal.
+std::vector<bool> SelectWithdrawalsForBundle(int nHeight, const std::vector<SidechainWithdrawal>& vWithdrawal);
+
+// Choose the items (fee vFee[i], serialized size vSize[i]) which fit in nSpace
+// bytes maximizing the total fee, then the number of items. Ties are broken
+// by input order so that the result is deterministic.
+std::vector<bool> PackWithdrawalBundle(const std::vector<CAmount>& vFee, const std::vector<unsigned int>& vSize, unsigned int nSpace);
+
 std::string GenerateDepositAddress(const std::string& strDestIn);
 
 bool ParseDepositAddress(const std::string& strAddressIn, std::string& strAddressOut, unsigned int& nSidechainOut);
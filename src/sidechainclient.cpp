@@ -9,6 +9,7 @@
 #include <core_io.h>
 #include <miner.h>
 #include <sidechain.h>
+#include <sidechainperf.h>
 #include <streams.h>
 #include <uint256.h>
 #include <univalue.h>
@@ -34,6 +35,8 @@ SidechainClient::SidechainClient()
 
 bool SidechainClient::BroadcastWithdrawalBundle(const std::string& hex)
 {
+    SidechainPerfTimer timer("SidechainClient::BroadcastWithdrawalBundle");
+
     // JSON for sending the WithdrawalBundle to mainchain via HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -53,6 +56,8 @@ bool SidechainClient::BroadcastWithdrawalBundle(const std::string& hex)
 // TODO return bool & state / fail string
 std::vector<SidechainDeposit> SidechainClient::UpdateDeposits(const uint256& hashLastDeposit, uint32_t nLastBurnIndex)
 {
+    SidechainPerfTimer timer("SidechainClient::UpdateDeposits");
+
     // List of deposits in sidechain format for DB
     std::vector<SidechainDeposit> incoming;
 
@@ -171,6 +176,8 @@ std::vector<SidechainDeposit> SidechainClient::UpdateDeposits(const uint256& has
 
 bool SidechainClient::VerifyDeposit(const uint256& hashMainBlock, const uint256& txid, const int nTx)
 {
+    SidechainPerfTimer timer("SidechainClient::VerifyDeposit");
+
     // JSON for requesting deposit verification via mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -198,6 +205,8 @@ bool SidechainClient::VerifyDeposit(const uint256& hashMainBlock, const uint256&
 
 bool SidechainClient::VerifyBMM(const uint256& hashMainBlock, const uint256& hashBMM, uint256& txid, uint32_t& nTime)
 {
+    SidechainPerfTimer timer("SidechainClient::VerifyBMM");
+
     // JSON for requesting BMM proof via mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -257,6 +266,8 @@ bool SidechainClient::VerifyBMM(const uint256& hashMainBlock, const uint256& has
 
 uint256 SidechainClient::SendBMMRequest(const uint256& hashCritical, const uint256& hashBlockMain, int nHeight, CAmount amount)
 {
+    SidechainPerfTimer timer("SidechainClient::SendBMMRequest");
+
     uint256 txid = uint256();
     std::string strPrevHash = hashBlockMain.ToString();
 
@@ -309,6 +320,8 @@ uint256 SidechainClient::SendBMMRequest(const uint256& hashCritical, const uint2
 
 bool SidechainClient::GetCTIP(std::pair<uint256, uint32_t>& ctip)
 {
+    SidechainPerfTimer timer("SidechainClient::GetCTIP");
+
     // JSON for requesting sidechain CTIP via mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -354,6 +367,8 @@ bool SidechainClient::GetCTIP(std::pair<uint256, uint32_t>& ctip)
 
 bool SidechainClient::RefreshBMM(const CAmount& amount, std::string& strError, uint256& hashCreatedMerkleRoot, uint256& hashConnected, uint256& hashConnectedMerkleRoot, uint256& txid, int& nTxn, CAmount& nFees, bool fCreateNew, const uint256& hashPrevBlock)
 {
+    SidechainPerfTimer timer("SidechainClient::RefreshBMM");
+
     //
     // A cache of recent mainchain block hashes and the mainchain tip is created
     // and updated.
@@ -468,6 +483,8 @@ bool SidechainClient::RefreshBMM(const CAmount& amount, std::string& strError, u
 
 bool SidechainClient::CreateBMMBlock(CBlock& block, std::string& strError, CAmount& nFees, const uint256& hashPrevBlock)
 {
+    SidechainPerfTimer timer("SidechainClient::CreateBMMBlock");
+
     if (!BlockAssembler(Params()).GenerateBMMBlock(block, strError, &nFees,
                 std::vector<CMutableTransaction>(), hashPrevBlock)) {
         return false;
@@ -484,12 +501,16 @@ bool SidechainClient::CreateBMMBlock(CBlock& block, std::string& strError, CAmou
 
 bool SidechainClient::SubmitBMMBlock(const CBlock& block)
 {
+    SidechainPerfTimer timer("SidechainClient::SubmitBMMBlock");
+
     std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(block);
     return ProcessNewBlock(Params(), shared_pblock, true, NULL);
 }
 
 bool SidechainClient::GetAverageFees(int nBlocks, int nStartHeight, CAmount& nAverageFee)
 {
+    SidechainPerfTimer timer("SidechainClient::GetAverageFees");
+
     // JSON for 'getaveragefees' mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -530,6 +551,8 @@ bool SidechainClient::GetAverageFees(int nBlocks, int nStartHeight, CAmount& nAv
 
 bool SidechainClient::GetBlockCount(int& nBlocks)
 {
+    SidechainPerfTimer timer("SidechainClient::GetBlockCount");
+
     // JSON for 'getblockcount' mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -551,6 +574,8 @@ bool SidechainClient::GetBlockCount(int& nBlocks)
 
 bool SidechainClient::GetWorkScore(const uint256& hash, int& nWorkScore)
 {
+    SidechainPerfTimer timer("SidechainClient::GetWorkScore");
+
     // JSON for 'getworkscore' mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -577,6 +602,8 @@ bool SidechainClient::GetWorkScore(const uint256& hash, int& nWorkScore)
 
 bool SidechainClient::ListWithdrawalBundleStatus(std::vector<uint256>& vHashWithdrawalBundle)
 {
+    SidechainPerfTimer timer("SidechainClient::ListWithdrawalBundleStatus");
+
     // TODO for now this function is only being used to see if there are any
     // WithdrawalBundle(s) for nSidechain. The rest of the results could be useful for the
     // GUI though.
@@ -617,6 +644,8 @@ bool SidechainClient::ListWithdrawalBundleStatus(std::vector<uint256>& vHashWith
 
 bool SidechainClient::GetBlockHash(int nHeight, uint256& hashBlock)
 {
+    SidechainPerfTimer timer("SidechainClient::GetBlockHash");
+
     // JSON for 'getblockhash' mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -640,6 +669,8 @@ bool SidechainClient::GetBlockHash(int nHeight, uint256& hashBlock)
 
 bool SidechainClient::HaveSpentWithdrawalBundle(const uint256& hash)
 {
+    SidechainPerfTimer timer("SidechainClient::HaveSpentWithdrawalBundle");
+
     // JSON for 'havespentwithdrawalbundle' mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
@@ -666,6 +697,8 @@ bool SidechainClient::HaveSpentWithdrawalBundle(const uint256& hash)
 
 bool SidechainClient::HaveFailedWithdrawalBundle(const uint256& hash)
 {
+    SidechainPerfTimer timer("SidechainClient::HaveFailedWithdrawalBundle");
+
     // JSON for 'havefailedwithdrawalbundle' mainchain HTTP-RPC
     std::string json;
     json.append("{\"jsonrpc\": \"1.0\", \"id\":\"SidechainClient\", ");
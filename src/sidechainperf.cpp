@@ -0,0 +1,94 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <sidechainperf.h>
+
+#include <sync.h>
+#include <util.h>
+#include <utiltime.h>
+
+#include <algorithm>
+#include <cmath>
+
+static CCriticalSection cs_sidechainperf;
+static std::map<std::string, SidechainTimingStat> mapTimingStat;
+static std::map<std::string, SidechainCacheStat> mapCacheStat;
+
+void SidechainTimingStat::Add(int64_t nMicros)
+{
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+
+    if (vSample.size() < SIDECHAIN_PERF_SAMPLES) {
+        vSample.push_back(nMicros);
+    } else {
+        vSample[nSampleNext] = nMicros;
+        nSampleNext = (nSampleNext + 1) % SIDECHAIN_PERF_SAMPLES;
+    }
+}
+
+int64_t SidechainTimingStat::GetPercentile(double dPercentile) const
+{
+    if (vSample.empty())
+        return 0;
+
+    std::vector<int64_t> vSorted = vSample;
+    std::sort(vSorted.begin(), vSorted.end());
+
+    size_t nIndex = std::ceil(dPercentile / 100.0 * vSorted.size());
+    if (nIndex > 0)
+        nIndex--;
+
+    return vSorted[std::min(nIndex, vSorted.size() - 1)];
+}
+
+void RecordSidechainTiming(const std::string& strName, int64_t nMicros)
+{
+    LOCK(cs_sidechainperf);
+    mapTimingStat[strName].Add(nMicros);
+}
+
+void RecordSidechainCacheLookup(const std::string& strName, bool fHit)
+{
+    LOCK(cs_sidechainperf);
+    SidechainCacheStat& stat = mapCacheStat[strName];
+    if (fHit)
+        stat.nHit++;
+    else
+        stat.nMiss++;
+}
+
+std::map<std::string, SidechainTimingStat> GetSidechainTimingStats()
+{
+    LOCK(cs_sidechainperf);
+    return mapTimingStat;
+}
+
+std::map<std::string, SidechainCacheStat> GetSidechainCacheStats()
+{
+    LOCK(cs_sidechainperf);
+    return mapCacheStat;
+}
+
+void ResetSidechainPerfStats()
+{
+    LOCK(cs_sidechainperf);
+    mapTimingStat.clear();
+    mapCacheStat.clear();
+}
+
+SidechainPerfTimer::SidechainPerfTimer(const std::string& strNameIn)
+{
+    strName = strNameIn;
+    nTimeStart = GetTimeMicros();
+}
+
+SidechainPerfTimer::~SidechainPerfTimer()
+{
+    int64_t nMicros = GetTimeMicros() - nTimeStart;
+    RecordSidechainTiming(strName, nMicros);
+
+    LogPrint(BCLog::BENCH, "    - Sidechain %s: %.2fms\n", strName, nMicros * 0.001);
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SIDECHAINPERF_H
+#define BITCOIN_SIDECHAINPERF_H
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Number of recent latency samples kept per operation for percentiles */
+static const size_t SIDECHAIN_PERF_SAMPLES = 1000;
+
+/** Name of the timing stat for time spent waiting on the mainchain while holding cs_main */
+static const char* const SIDECHAIN_PERF_CS_MAIN_WAIT = "cs_main mainchain wait";
+
+/** Call count and latency of a sidechain operation */
+struct SidechainTimingStat
+{
+    uint64_t nCount = 0;
+    int64_t nTotalMicros = 0;
+    int64_t nMaxMicros = 0;
+
+    // Ring buffer of the most recent latencies
+    std::vector<int64_t> vSample;
+    size_t nSampleNext = 0;
+
+    void Add(int64_t nMicros);
+
+    // Latency percentile (0 - 100) of the recent samples
+    int64_t GetPercentile(double dPercentile) const;
+};
+
+/** Hit & miss counts of a sidechain cache */
+struct SidechainCacheStat
+{
+    uint64_t nHit = 0;
+    uint64_t nMiss = 0;
+};
+
+/** Record the latency of a sidechain operation */
+void RecordSidechainTiming(const std::string& strName, int64_t nMicros);
+
+/** Record a sidechain cache lookup */
+void RecordSidechainCacheLookup(const std::string& strName, bool fHit);
+
+std::map<std::string, SidechainTimingStat> GetSidechainTimingStats();
+
+std::map<std::string, SidechainCacheStat> GetSidechainCacheStats();
+
+void ResetSidechainPerfStats();
+
+/**
+ * Times a sidechain operation for the lifetime of the object, records it and
+ * logs it to the bench log category.
+ */
+class SidechainPerfTimer
+{
+public:
+    explicit SidechainPerfTimer(const std::string& strNameIn);
+    ~SidechainPerfTimer();
+
+private:
+    std::string strName;
+    int64_t nTimeStart;
+};
+
+#endif // BITCOIN_SIDECHAINPERF_H
@@ -4,9 +4,12 @@
 
 #include <util.h>
 
+#include <support/allocators/pool.h>
 #include <support/allocators/secure.h>
 #include <test/test_bitcoin.h>
 
+#include <unordered_map>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
@@ -231,4 +234,48 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(poolresource_tests)
+{
+    PoolResource<128, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    // Small blocks come from one chunk, rounded up to the alignment
+    void* a = resource.Allocate(8, 8);
+    void* b = resource.Allocate(12, 8);
+    void* c = resource.Allocate(8, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL((char*)b - (char*)a, 8);
+    BOOST_CHECK_EQUAL((char*)c - (char*)b, 16);
+
+    // Freed blocks are reused for the same size
+    resource.Deallocate(b, 12, 8);
+    BOOST_CHECK(resource.Allocate(16, 8) == b);
+    resource.Deallocate(a, 8, 8);
+    BOOST_CHECK(resource.Allocate(1, 8) == a);
+
+    // Large blocks don't come from the pool
+    void* d = resource.Allocate(256, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    resource.Deallocate(d, 256, 8);
+
+    // A new chunk is allocated when the current one runs out
+    for (int i = 0; i < 8; i++)
+        resource.Allocate(128, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+
+    // Containers allocate through PoolAllocator
+    {
+        PoolResource<sizeof(std::pair<const int, int>) + sizeof(void*) * 4, alignof(std::pair<const int, int>)> mapResource;
+        typedef PoolAllocator<std::pair<const int, int>, sizeof(std::pair<const int, int>) + sizeof(void*) * 4> Allocator;
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Allocator> map(0, std::hash<int>(), std::equal_to<int>(), &mapResource);
+        for (int i = 0; i < 1000; i++)
+            map[i] = i;
+        for (int i = 0; i < 1000; i += 2)
+            map.erase(i);
+        BOOST_CHECK_EQUAL(map.size(), 500U);
+        BOOST_CHECK_EQUAL(map[999], 999);
+        BOOST_CHECK_EQUAL(mapResource.NumAllocatedChunks(), 1U);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
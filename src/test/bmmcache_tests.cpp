@@ -4,6 +4,7 @@
 
 #include <bmmcache.h>
 #include <deque>
+#include <fs.h>
 #include <random.h>
 #include <uint256.h>
 #include <validation.h>
@@ -872,4 +873,135 @@ BOOST_AUTO_TEST_CASE(bmmcache_replace_tip)
     BOOST_CHECK(vOrphan == vOrphanCheck);
 }
 
+BOOST_AUTO_TEST_CASE(bmmcache_journal_replay)
+{
+    // Test that changes recorded to the journal are restored by replaying it
+
+    fs::path path = fs::temp_directory_path() / fs::unique_path();
+
+    BMMCacheJournal journal;
+    BOOST_CHECK(journal.Open(path));
+
+    BMMCache cache;
+    cache.SetJournal(&journal);
+
+    uint256 hashBMM = GetRandHash();
+    uint256 txidDeposit = GetRandHash();
+    uint256 hashBundle = GetRandHash();
+    uint256 wtid = GetRandHash();
+    cache.CacheVerifiedBMM(hashBMM);
+    cache.CacheVerifiedDeposit(txidDeposit);
+    cache.StoreBroadcastedWithdrawalBundle(hashBundle);
+    cache.CacheWithdrawalID(wtid);
+
+    // Cache a 10 block chain and then reorg the last 3 blocks
+    std::deque<uint256> dHashNew = GenerateRandomHashChain(10);
+    bool fReorg = false;
+    std::vector<uint256> vOrphan;
+    BOOST_CHECK(cache.UpdateMainBlockCache(dHashNew, fReorg, vOrphan));
+
+    std::deque<uint256> dHashReorg;
+    dHashReorg.push_back(cache.GetMainBlockHashCache()[6]);
+    dHashReorg.push_back(GetRandHash());
+    BOOST_CHECK(cache.UpdateMainBlockCache(dHashReorg, fReorg, vOrphan));
+    BOOST_CHECK(fReorg);
+    BOOST_CHECK(vOrphan.size() == 3);
+    BOOST_CHECK(cache.GetCachedBlockCount() == 8);
+
+    // Repeated entries are not journaled
+    size_t nEntries = journal.GetEntryCount();
+    cache.CacheVerifiedBMM(hashBMM);
+    BOOST_CHECK(journal.GetEntryCount() == nEntries);
+
+    journal.Close();
+
+    // Write a torn entry at the end of the journal, replay should ignore it
+    FILE* file = fsbridge::fopen(path, "ab");
+    BOOST_CHECK(file);
+    fputc(BMM_JOURNAL_VERIFIED_BMM, file);
+    fclose(file);
+
+    BMMCache cacheReplay;
+    BOOST_CHECK(BMMCacheJournal::Replay(path, cacheReplay) == nEntries);
+    BOOST_CHECK(cacheReplay.HaveVerifiedBMM(hashBMM));
+    BOOST_CHECK(cacheReplay.HaveVerifiedDeposit(txidDeposit));
+    BOOST_CHECK(cacheReplay.HaveBroadcastedWithdrawalBundle(hashBundle));
+    BOOST_CHECK(cacheReplay.IsMyWT(wtid));
+    BOOST_CHECK(cacheReplay.GetMainBlockHashCache() == cache.GetMainBlockHashCache());
+
+    // Replaying the same journal again is harmless
+    BOOST_CHECK(BMMCacheJournal::Replay(path, cacheReplay) == nEntries);
+    BOOST_CHECK(cacheReplay.GetMainBlockHashCache() == cache.GetMainBlockHashCache());
+
+    // After a reset only entries appended since the reset are replayed
+    BOOST_CHECK(journal.Open(path));
+    BOOST_CHECK(journal.Reset(journal.GetEntryCount()));
+    uint256 hashBMMNew = GetRandHash();
+    cache.CacheVerifiedBMM(hashBMMNew);
+    journal.Close();
+
+    BMMCache cacheAfterReset;
+    BOOST_CHECK(BMMCacheJournal::Replay(path, cacheAfterReset) == 1);
+    BOOST_CHECK(cacheAfterReset.HaveVerifiedBMM(hashBMMNew));
+    BOOST_CHECK(!cacheAfterReset.HaveVerifiedBMM(hashBMM));
+
+    cache.SetJournal(nullptr);
+    fs::remove(path);
+}
+
+BOOST_FIXTURE_TEST_CASE(bmmcache_journal_load_corrupt, TestingSetup)
+{
+    // Test that a journal whose first entry is corrupt is compacted at load,
+    // so that entries appended afterwards can be replayed
+
+    fs::path path = GetDataDir() / "bmmjournal.dat";
+    FILE* file = fsbridge::fopen(path, "wb");
+    BOOST_CHECK(file);
+    std::vector<unsigned char> vchGarbage(41, 0xff);
+    fwrite(vchGarbage.data(), 1, vchGarbage.size(), file);
+    fclose(file);
+
+    LoadBMMCacheJournal();
+    BOOST_CHECK_EQUAL(fs::file_size(path), 0U);
+
+    uint256 hashBMM = GetRandHash();
+    bmmCache.CacheVerifiedBMM(hashBMM);
+    CloseBMMCacheJournal();
+
+    BMMCache cacheReplay;
+    BOOST_CHECK(BMMCacheJournal::Replay(path, cacheReplay) == 1);
+    BOOST_CHECK(cacheReplay.HaveVerifiedBMM(hashBMM));
+
+    fs::remove(path);
+}
+
+BOOST_FIXTURE_TEST_CASE(bmmcache_journal_compact_empty, TestingSetup)
+{
+    // Test that compacting the journal after the main block cache was reset
+    // does not bring back the blocks of an older cache file
+
+    fs::path path = GetDataDir() / "bmmjournal.dat";
+    LoadBMMCacheJournal();
+
+    std::deque<uint256> dHash = GenerateRandomHashChain(10);
+    bool fReorg = false;
+    std::vector<uint256> vOrphan;
+    BOOST_CHECK(bmmCache.UpdateMainBlockCache(dHash, fReorg, vOrphan));
+    BOOST_CHECK(CompactBMMCacheJournal());
+
+    bmmCache.ResetMainBlockCache();
+    BOOST_CHECK(CompactBMMCacheJournal());
+    CloseBMMCacheJournal();
+
+    // Startup reads the cache file and then replays the journal
+    bmmCache.CacheMainBlockHash(GetRandHash());
+    bmmCache.ResetMainBlockCache();
+    LoadMainBlockCache();
+    BMMCacheJournal::Replay(path, bmmCache);
+    BOOST_CHECK_EQUAL(bmmCache.GetCachedBlockCount(), 0);
+
+    fs::remove(path);
+    fs::remove(GetDataDir() / "mainblockhash.dat");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -20,6 +20,29 @@
 #include <memory>
 #include <random.h>
 
+struct FailingIdCheck {
+    size_t check_id;
+    bool fails;
+    FailingIdCheck(size_t check_id_in, bool fails_in) : check_id(check_id_in), fails(fails_in){};
+    FailingIdCheck() : check_id(0), fails(false){};
+    bool operator()()
+    {
+        return !fails;
+    }
+    void swap(FailingIdCheck& x)
+    {
+        std::swap(check_id, x.check_id);
+        std::swap(fails, x.fails);
+    };
+};
+
+// Outside the test suite, whose namespace can't specialize CheckQueueOrder
+template <>
+struct CheckQueueOrder<FailingIdCheck> {
+    static const bool fOrdered = true;
+    static bool Before(const FailingIdCheck& a, const FailingIdCheck& b) { return a.check_id < b.check_id; }
+};
+
 // BasicTestingSetup not sufficient because nScriptCheckThreads is not set
 // otherwise.
 BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, TestingSetup)
@@ -138,6 +161,7 @@ std::atomic<size_t> MemoryCheck::fake_allocated_memory{0};
 typedef CCheckQueue<FakeCheckCheckCompletion> Correct_Queue;
 typedef CCheckQueue<FakeCheck> Standard_Queue;
 typedef CCheckQueue<FailingCheck> Failing_Queue;
+typedef CCheckQueue<FailingIdCheck> FailingId_Queue;
 typedef CCheckQueue<UniqueCheck> Unique_Queue;
 typedef CCheckQueue<MemoryCheck> Memory_Queue;
 typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
@@ -269,6 +293,74 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
     tg.join_all();
 }
 
+// Test that Wait hands back the check which failed, and that it is not
+// handed back again by a later run without failures.
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Returns_Failed_Check)
+{
+    auto fail_queue = std::unique_ptr<FailingId_Queue>(new FailingId_Queue {QUEUE_BATCH_SIZE});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+       tg.create_thread([&]{fail_queue->Thread();});
+    }
+
+    for (size_t times = 0; times < 100; ++times) {
+        const size_t fail_id = InsecureRandRange(1000);
+        {
+            CCheckQueueControl<FailingIdCheck> control(fail_queue.get());
+            std::vector<FailingIdCheck> vChecks;
+            for (size_t k = 0; k < 1000; k++)
+                vChecks.emplace_back(k, k == fail_id);
+            control.Add(vChecks);
+            FailingIdCheck failed;
+            BOOST_REQUIRE(!control.Wait(&failed));
+            BOOST_REQUIRE(failed.fails);
+            BOOST_REQUIRE_EQUAL(failed.check_id, fail_id);
+        }
+        {
+            CCheckQueueControl<FailingIdCheck> control(fail_queue.get());
+            std::vector<FailingIdCheck> vChecks;
+            for (size_t k = 0; k < 1000; k++)
+                vChecks.emplace_back(k, false);
+            control.Add(vChecks);
+            FailingIdCheck failed;
+            BOOST_REQUIRE(control.Wait(&failed));
+            BOOST_REQUIRE(!failed.fails);
+        }
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+// Test that when several checks fail, the first one in order is handed
+// back, whichever thread ran into a failure first
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Returns_First_Failed_Check)
+{
+    auto fail_queue = std::unique_ptr<FailingId_Queue>(new FailingId_Queue {QUEUE_BATCH_SIZE});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+        tg.create_thread([&]{fail_queue->Thread();});
+    }
+
+    for (size_t i = 0; i < 100; i++) {
+        const size_t first_id = InsecureRandRange(1000);
+        CCheckQueueControl<FailingIdCheck> control(fail_queue.get());
+        for (size_t k = 0; k < 1000; k += 100) {
+            std::vector<FailingIdCheck> vChecks;
+            for (size_t j = k; j < k + 100; j++)
+                vChecks.emplace_back(j, j >= first_id && InsecureRandBool());
+            if (k <= first_id && first_id < k + 100)
+                vChecks[first_id - k].fails = true;
+            control.Add(vChecks);
+        }
+        FailingIdCheck failed;
+        BOOST_REQUIRE(!control.Wait(&failed));
+        BOOST_REQUIRE(failed.fails);
+        BOOST_REQUIRE_EQUAL(failed.check_id, first_id);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
 // Test that unique checks are actually all called individually, rather than
 // just one check being called repeatedly. Test that checks are not called
 // more than once as well
@@ -4,6 +4,7 @@
 
 #include <coins.h>
 #include <script/standard.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <undo.h>
 #include <utilstrencodings.h>
@@ -11,8 +12,12 @@
 #include <validation.h>
 #include <consensus/validation.h>
 
-#include <vector>
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
@@ -57,7 +62,7 @@ public:
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coin;
+                map_[it->first] = it->second.GetCoin();
                 if (it->second.coin.IsSpent() && InsecureRandRange(3) == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
@@ -559,9 +564,10 @@ size_t InsertCoinsMapEntry(CCoinsMap& map, CAmount value, char flags)
         return 0;
     }
     assert(flags != NO_ENTRY);
-    CCoinsCacheEntry entry;
+    Coin coin;
+    SetCoinsValue(value, coin);
+    CCoinsCacheEntry entry(std::move(coin));
     entry.flags = flags;
-    SetCoinsValue(value, entry.coin);
     auto inserted = map.emplace(OUTPOINT, std::move(entry));
     assert(inserted.second);
     return inserted.first->second.coin.DynamicMemoryUsage();
@@ -577,7 +583,7 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
         if (it->second.coin.IsSpent()) {
             value = PRUNED;
         } else {
-            value = it->second.coin.out.nValue;
+            value = it->second.GetCoin().out.nValue;
         }
         flags = it->second.flags;
         assert(flags != NO_ENTRY);
@@ -586,7 +592,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
     InsertCoinsMapEntry(map, value, flags);
     view.BatchWrite(map, {});
 }
@@ -855,4 +862,387 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_flush_memory)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    size_t nUsageEmpty = cache.DynamicMemoryUsage();
+
+    for (int i = 0; i < 10000; i++) {
+        Coin coin;
+        coin.out.nValue = InsecureRand32();
+        coin.nHeight = 1;
+        cache.AddCoin(COutPoint(InsecureRand256(), 0), std::move(coin), false);
+    }
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() > nUsageEmpty);
+
+    // Flushing gives the memory of the pool back
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nUsageEmpty);
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_prefetch)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    COutPoint outpoint(InsecureRand256(), 0);
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+
+    // A prefetched coin is cached clean
+    cache.PrefetchCoin(outpoint, Coin(coin));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    BOOST_CHECK_EQUAL(cache.map().at(outpoint).flags, 0);
+    cache.SelfTest();
+
+    // Existing entries, including spent ones, are kept
+    cache.SpendCoin(outpoint);
+    cache.PrefetchCoin(outpoint, Coin(coin));
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoint));
+    cache.SelfTest();
+
+    // Spent coins aren't cached
+    COutPoint outpointSpent(InsecureRand256(), 0);
+    cache.PrefetchCoin(outpointSpent, Coin());
+    BOOST_CHECK(!cache.map().count(outpointSpent));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_compact)
+{
+    std::vector<unsigned char> vchPubKey(33, 0x42);
+    vchPubKey[0] = 0x03;
+    std::vector<unsigned char> vchPubKeyFull(65, 0x42);
+    vchPubKeyFull[0] = 0x04;
+
+    std::vector<CScript> vScript;
+    vScript.push_back(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35")))));
+    vScript.push_back(GetScriptForDestination(CScriptID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4")))));
+    vScript.push_back(CScript() << OP_0 << ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"));
+    vScript.push_back(CScript() << OP_0 << ToByteVector(InsecureRand256()));
+    vScript.push_back(CScript() << vchPubKey << OP_CHECKSIG);
+    vScript.push_back(CScript() << vchPubKeyFull << OP_CHECKSIG);
+    vScript.push_back(CScript());
+    vScript.push_back(CScript() << OP_TRUE);
+    vScript.push_back(CScript() << std::vector<unsigned char>(200, 0x42) << OP_DROP << OP_TRUE);
+
+    for (const CScript& script : vScript) {
+        Coin coin(CTxOut(InsecureRandRange(MAX_MONEY), script), InsecureRandBits(31), InsecureRandBool());
+        CompactCoin compact(coin);
+        BOOST_CHECK(!compact.IsSpent());
+
+        // Copies, moves and decompression keep the coin intact
+        CompactCoin copy(compact);
+        CompactCoin moved(std::move(copy));
+        Coin coinOut = moved.Decompress();
+        BOOST_CHECK(coinOut.out == coin.out);
+        BOOST_CHECK_EQUAL(coinOut.nHeight, coin.nHeight);
+        BOOST_CHECK_EQUAL(coinOut.fCoinBase, coin.fCoinBase);
+
+        // Only long non-standard scripts go to the heap
+        BOOST_CHECK_EQUAL(compact.DynamicMemoryUsage() > 0, script.size() > 35);
+
+        compact.Clear();
+        BOOST_CHECK(compact.IsSpent());
+        BOOST_CHECK(compact.Decompress().IsSpent());
+        BOOST_CHECK_EQUAL(compact.DynamicMemoryUsage(), 0);
+    }
+
+#ifdef ENABLE_COMPACT_COINS
+    // The cache entry flags fit behind the coin without padding
+    BOOST_CHECK_EQUAL(sizeof(CCoinsCacheEntry), sizeof(CompactCoin) + 1);
+    BOOST_CHECK(sizeof(CCoinsCacheEntry) < sizeof(Coin) + 1);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_rolling_stats)
+{
+    std::vector<std::pair<COutPoint, Coin> > vCoin;
+    for (int i = 0; i < 3; i++) {
+        CScript script = CScript() << OP_TRUE;
+        vCoin.emplace_back(COutPoint(InsecureRand256(), i), Coin(CTxOut(i + 1, script), 10 + i, i == 0));
+    }
+
+    CCoinsRollingStats stats;
+    for (const auto& item : vCoin)
+        stats.AddCoin(item.first, item.second);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 3);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 6);
+
+    // The hash doesn't depend on the order coins were added in
+    CCoinsRollingStats statsReverse;
+    for (auto it = vCoin.rbegin(); it != vCoin.rend(); ++it)
+        statsReverse.AddCoin(it->first, it->second);
+    BOOST_CHECK(stats.GetHash() == statsReverse.GetHash());
+
+    // Spending a coin is the same as never adding it
+    CCoinsRollingStats statsSpent;
+    statsSpent.AddCoin(vCoin[0].first, vCoin[0].second);
+    statsSpent.AddCoin(vCoin[1].first, vCoin[1].second);
+    stats.RemoveCoin(vCoin[2].first, vCoin[2].second);
+    BOOST_CHECK(stats.GetHash() == statsSpent.GetHash());
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 2);
+    BOOST_CHECK_EQUAL(stats.nBogoSize, statsSpent.nBogoSize);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 3);
+    BOOST_CHECK(stats.GetHash() != CCoinsRollingStats().GetHash());
+}
+
+BOOST_FIXTURE_TEST_CASE(ccoins_rolling_stats_window, TestingSetup)
+{
+    const uint256 hashTip = chainActive.Tip()->GetBlockHash();
+    const uint256 hashStale = InsecureRand256();
+
+    CCoinsRollingStats stats;
+    stats.AddCoin(COutPoint(InsecureRand256(), 0), Coin(CTxOut(1, CScript() << OP_TRUE), 1, false));
+    BOOST_CHECK(pblocktree->WriteCoinsRollingStats(hashStale, stats));
+
+    // Loading drops the statistics of blocks outside the active chain and
+    // computes those of the tip
+    BOOST_CHECK(LoadCoinsRollingStats());
+    CCoinsRollingStats statsOut;
+    BOOST_CHECK(!pblocktree->ReadCoinsRollingStats(hashStale, statsOut));
+    BOOST_CHECK(pblocktree->ReadCoinsRollingStats(hashTip, statsOut));
+    BOOST_CHECK(GetCoinsRollingStats(hashTip, statsOut));
+
+    BOOST_CHECK(pblocktree->EraseCoinsRollingStats(hashTip));
+    BOOST_CHECK(!pblocktree->ReadCoinsRollingStats(hashTip, statsOut));
+
+    // With -coinsrollingstats=0 nothing is kept
+    BOOST_CHECK(pblocktree->WriteCoinsRollingStats(hashTip, stats));
+    fCoinsRollingStatsEnabled = false;
+    BOOST_CHECK(LoadCoinsRollingStats());
+    BOOST_CHECK(!pblocktree->ReadCoinsRollingStats(hashTip, statsOut));
+    BOOST_CHECK(!GetCoinsRollingStats(hashTip, statsOut));
+    fCoinsRollingStatsEnabled = DEFAULT_COINS_ROLLING_STATS;
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_sync)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+
+    COutPoint outpointOld(InsecureRand256(), 0);
+    cache.AddCoin(outpointOld, Coin(coin), false);
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Flush());
+
+    COutPoint outpointNew(InsecureRand256(), 0);
+    cache.AddCoin(outpointNew, Coin(coin), false);
+    cache.SpendCoin(outpointOld);
+    uint256 hashBlock = InsecureRand256();
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.Sync());
+
+    // The base has the changes
+    Coin coinOut;
+    BOOST_CHECK(base.GetCoin(outpointNew, coinOut));
+    // CCoinsViewTest keeps some of the spent entries it is given and
+    // returns them from GetCoin
+    BOOST_CHECK(!base.GetCoin(outpointOld, coinOut) || coinOut.IsSpent());
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+
+    // Unspent coins stay cached and unmodified, spent ones are dropped
+    BOOST_CHECK(cache.HaveCoinInCache(outpointNew));
+    BOOST_CHECK_EQUAL(cache.map().at(outpointNew).flags, 0);
+    BOOST_CHECK(!cache.map().count(outpointOld));
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+
+    std::vector<COutPoint> vOutpoint;
+    for (int i = 0; i < 10000; i++) {
+        vOutpoint.emplace_back(InsecureRand256(), 0);
+        cache.AddCoin(vOutpoint.back(), Coin(coin), false);
+    }
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Sync());
+
+    // A modified coin is kept whatever the limit
+    COutPoint outpointDirty(InsecureRand256(), 0);
+    cache.AddCoin(outpointDirty, Coin(coin), false);
+
+    // Under the limit nothing is evicted
+    size_t nUsage = cache.DynamicMemoryUsage();
+    cache.Trim(nUsage);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), vOutpoint.size() + 1);
+
+    // Over it only enough unmodified coins are evicted
+    cache.Trim(nUsage / 2);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nUsage / 2);
+    BOOST_CHECK(cache.GetCacheSize() > vOutpoint.size() / 4);
+    BOOST_CHECK(cache.GetCacheSize() < vOutpoint.size());
+    BOOST_CHECK(cache.map().at(outpointDirty).flags & CCoinsCacheEntry::DIRTY);
+    cache.SelfTest();
+
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.HaveCoinInCache(outpointDirty));
+    cache.SelfTest();
+
+    // Evicted coins are read from the base again
+    for (const COutPoint& outpoint : vOutpoint)
+        BOOST_CHECK(cache.HaveCoin(outpoint));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_background_write)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    db.SetBackgroundWrite(true);
+    CCoinsViewCache cache(&db);
+
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+
+    std::vector<COutPoint> vOutpoint;
+    for (int i = 0; i < 100; i++) {
+        vOutpoint.emplace_back(InsecureRand256(), 0);
+        cache.AddCoin(vOutpoint.back(), Coin(coin), false);
+    }
+    uint256 hashBlock = InsecureRand256();
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.Flush());
+
+    // Reads are consistent while the write may still be running
+    Coin coinOut;
+    BOOST_CHECK(db.GetCoin(vOutpoint[0], coinOut));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+    // A second write waits for the first one
+    CCoinsViewCache cache2(&db);
+    cache2.SpendCoin(vOutpoint[0]);
+    uint256 hashBlock2 = InsecureRand256();
+    cache2.SetBestBlock(hashBlock2);
+    BOOST_CHECK(cache2.Flush());
+    BOOST_CHECK(!db.HaveCoin(vOutpoint[0]));
+    BOOST_CHECK(db.HaveCoin(vOutpoint[1]));
+
+    BOOST_CHECK(db.WaitForBackgroundWrite());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock2);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+
+    size_t nCoins = 0;
+    std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    for (; pcursor->Valid(); pcursor->Next())
+        nCoins++;
+    BOOST_CHECK_EQUAL(nCoins, vOutpoint.size() - 1);
+    BOOST_CHECK_EQUAL(db.PendingMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_background_write_cursor)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    db.SetBackgroundWrite(true);
+
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+
+    const int nBlocks = 20;
+    const size_t nCoinsPerBlock = 50;
+    std::vector<uint256> vBlockHash;
+    std::vector<COutPoint> vOutpoint;
+    for (int i = 0; i < nBlocks; i++) {
+        vBlockHash.push_back(InsecureRand256());
+        for (size_t j = 0; j < nCoinsPerBlock; j++)
+            vOutpoint.emplace_back(InsecureRand256(), 0);
+    }
+
+    // Cursors are created from other threads while writes are started, each
+    // one has to see exactly the coins of the block it reports
+    std::atomic<bool> fDone(false);
+    std::atomic<int> nMismatch(0);
+    std::vector<std::thread> vThread;
+    for (int i = 0; i < 4; i++) {
+        vThread.emplace_back([&] {
+            while (!fDone) {
+                std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+                size_t nCoins = 0;
+                for (; pcursor->Valid(); pcursor->Next())
+                    nCoins++;
+                const uint256 hashBest = pcursor->GetBestBlock();
+                size_t nExpected = 0;
+                if (!hashBest.IsNull()) {
+                    auto it = std::find(vBlockHash.begin(), vBlockHash.end(), hashBest);
+                    nExpected = it == vBlockHash.end() ? 0 : (it - vBlockHash.begin() + 1) * nCoinsPerBlock;
+                }
+                if (nCoins != nExpected)
+                    nMismatch++;
+            }
+        });
+    }
+
+    for (int i = 0; i < nBlocks; i++) {
+        CCoinsViewCache cache(&db);
+        for (size_t j = 0; j < nCoinsPerBlock; j++)
+            cache.AddCoin(vOutpoint[i * nCoinsPerBlock + j], Coin(coin), false);
+        cache.SetBestBlock(vBlockHash[i]);
+        BOOST_CHECK(cache.Flush());
+    }
+    fDone = true;
+    for (std::thread& thread : vThread)
+        thread.join();
+
+    BOOST_CHECK_EQUAL(nMismatch.load(), 0);
+    BOOST_CHECK(db.WaitForBackgroundWrite());
+    BOOST_CHECK(db.GetBestBlock() == vBlockHash.back());
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_cursor_start)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewCache cache(&db);
+
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+
+    std::set<COutPoint> setOutpoint;
+    for (int i = 0; i < 200; i++) {
+        COutPoint outpoint(InsecureRand256(), InsecureRandRange(3));
+        setOutpoint.insert(outpoint);
+        cache.AddCoin(outpoint, Coin(coin), true);
+    }
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Flush());
+
+    // Cursors starting at the first byte of the txid split the coins into
+    // disjoint ranges which together cover all of them
+    const int nParts = 3;
+    std::set<COutPoint> setSeen;
+    for (int t = 0; t < nParts; t++) {
+        const int nBegin = 256 * t / nParts;
+        const int nEnd = 256 * (t + 1) / nParts;
+        uint256 hashStart;
+        *hashStart.begin() = (unsigned char)nBegin;
+        std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor(hashStart));
+        for (; pcursor->Valid(); pcursor->Next()) {
+            COutPoint key;
+            BOOST_CHECK(pcursor->GetKey(key));
+            BOOST_CHECK(*key.hash.begin() >= nBegin);
+            if (*key.hash.begin() >= nEnd)
+                break;
+            BOOST_CHECK(setSeen.insert(key).second);
+        }
+    }
+    BOOST_CHECK(setSeen == setOutpoint);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
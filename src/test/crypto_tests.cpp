@@ -10,7 +10,10 @@
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
+#include <hash.h>
 #include <random.h>
+#include <streams.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
 
@@ -268,6 +271,52 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = InsecureRandBits(8);
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256d64_implementations)
+{
+    // 9 blocks so every width, including the 1-way tail, gets used
+    unsigned char in[64 * 9];
+    unsigned char out1[32 * 9], out2[32 * 9];
+    for (unsigned int j = 0; j < sizeof(in); ++j) {
+        in[j] = InsecureRandBits(8);
+    }
+
+    BOOST_CHECK(SHA256ForceImplementation("standard"));
+    for (int j = 0; j < 9; ++j) {
+        CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+    }
+
+    for (const std::string& name : {"standard", "sse4", "sse41", "avx2", "shani"}) {
+        if (!SHA256ForceImplementation(name)) {
+            BOOST_TEST_MESSAGE("SHA256 implementation " << name << " not available");
+            continue;
+        }
+        memset(out2, 0, sizeof(out2));
+        SHA256D64(out2, in, 9);
+        BOOST_CHECK_MESSAGE(memcmp(out1, out2, sizeof(out1)) == 0, name);
+        for (int j = 0; j < 9; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out2 + 32 * j);
+        }
+        BOOST_CHECK_MESSAGE(memcmp(out1, out2, sizeof(out1)) == 0, name);
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -524,6 +573,83 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector)
                  "fab78c9");
 }
 
+static MuHash3072 FromInt(unsigned char i)
+{
+    unsigned char tmp[32] = {i, 0};
+    return MuHash3072().Insert(tmp, sizeof(tmp));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    uint256 out;
+
+    for (int iter = 0; iter < 10; ++iter) {
+        uint256 res;
+        int table[4];
+        for (int i = 0; i < 4; ++i) {
+            table[i] = insecure_rand_ctx.randbits(3);
+        }
+        for (int order = 0; order < 4; ++order) {
+            MuHash3072 acc;
+            for (int i = 0; i < 4; ++i) {
+                int t = table[i ^ order];
+                if (t & 4) {
+                    acc /= FromInt(t & 3);
+                } else {
+                    acc *= FromInt(t & 3);
+                }
+            }
+            acc.Finalize(out);
+            if (order == 0) {
+                res = out;
+            } else {
+                BOOST_CHECK(res == out);
+            }
+        }
+
+        // Removing what was inserted leaves the set as it was, which isn't empty
+        unsigned char nX = insecure_rand_ctx.randbits(4);
+        MuHash3072 x = FromInt(nX);
+        MuHash3072 y = FromInt(insecure_rand_ctx.randbits(4));
+        uint256 z;
+        x *= y;
+        x /= y;
+        x.Finalize(z);
+        uint256 zBefore;
+        MuHash3072 xBefore = FromInt(nX);
+        xBefore.Finalize(zBefore);
+        BOOST_CHECK(z == zBefore);
+        MuHash3072 empty;
+        empty.Finalize(out);
+        BOOST_CHECK(z != out);
+
+        // Removing the only element gives the empty set
+        MuHash3072 w = FromInt(0);
+        w /= FromInt(0);
+        w.Finalize(z);
+        BOOST_CHECK(z == out);
+    }
+
+    MuHash3072 acc = FromInt(0);
+    acc *= FromInt(1);
+    acc /= FromInt(2);
+    acc.Finalize(out);
+    BOOST_CHECK_EQUAL(out.GetHex(), "10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863");
+
+    // Serialization keeps the set
+    MuHash3072 acc2 = FromInt(0);
+    unsigned char tmp[32] = {1, 0};
+    acc2.Insert(tmp, sizeof(tmp));
+    unsigned char tmp2[32] = {2, 0};
+    acc2.Remove(tmp2, sizeof(tmp2));
+    CDataStream ss(SER_DISK, 0);
+    ss << acc2;
+    MuHash3072 acc3;
+    ss >> acc3;
+    acc3.Finalize(out);
+    BOOST_CHECK_EQUAL(out.GetHex(), "10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863");
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests)
 {
     FastRandomContext ctx;
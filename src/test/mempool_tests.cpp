@@ -2,9 +2,13 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <coins.h>
+#include <consensus/validation.h>
 #include <policy/policy.h>
+#include <script/standard.h>
 #include <txmempool.h>
 #include <util.h>
+#include <validation.h>
 
 #include <test/test_bitcoin.h>
 
@@ -571,4 +575,67 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolParallelScriptCheckTest)
+{
+    // A transaction with enough inputs has its scripts checked on the
+    // script check threads; a failing input must still be rejected with
+    // the reason an inline check would have given.
+    LOCK(cs_main);
+
+    CScript redeemScript = CScript() << OP_TRUE;
+    CScript scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    const unsigned int nInputs = MEMPOOL_PARALLEL_SCRIPT_CHECK_INPUTS + 4;
+
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+    txFund.vout.resize(nInputs + 1);
+    for (unsigned int i = 0; i < nInputs; i++) {
+        txFund.vout[i].scriptPubKey = scriptPubKey;
+        txFund.vout[i].nValue = COIN;
+    }
+    // An extra output whose redeem script fails an OP_VERIFY
+    CScript redeemScriptVerify = CScript() << OP_FALSE << OP_VERIFY;
+    txFund.vout[nInputs].scriptPubKey = GetScriptForDestination(CScriptID(redeemScriptVerify));
+    txFund.vout[nInputs].nValue = COIN;
+    AddCoins(*pcoinsTip, txFund, 1);
+
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(nInputs);
+    for (unsigned int i = 0; i < nInputs; i++) {
+        txSpend.vin[i].prevout = COutPoint(txFund.GetHash(), i);
+        txSpend.vin[i].scriptSig = CScript() << ToByteVector(redeemScript);
+    }
+    txSpend.vout.resize(1);
+    txSpend.vout[0].scriptPubKey = scriptPubKey;
+    txSpend.vout[0].nValue = (nInputs - 1) * COIN;
+
+    // Spend the last input with a redeem script that does not match
+    CMutableTransaction txBad(txSpend);
+    txBad.vin[nInputs - 1].scriptSig = CScript() << ToByteVector(CScript() << OP_2);
+    uint64_t nParallel = nMempoolParallelScriptChecks;
+    CValidationState state;
+    BOOST_CHECK(!AcceptToMemoryPool(mempool, state, MakeTransactionRef(txBad), nullptr, nullptr, true, 0));
+    BOOST_CHECK_EQUAL(state.GetRejectReason().substr(0, 33), "mandatory-script-verify-flag-fail");
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+    BOOST_CHECK_EQUAL(nMempoolParallelScriptChecks.load(), nParallel + 1);
+
+    // With an earlier input failing differently as well, the reason comes
+    // from that earlier input, whichever thread checked which input first
+    CMutableTransaction txBadTwice(txBad);
+    txBadTwice.vin[2].prevout = COutPoint(txFund.GetHash(), nInputs);
+    txBadTwice.vin[2].scriptSig = CScript() << ToByteVector(redeemScriptVerify);
+    CValidationState stateTwice;
+    BOOST_CHECK(!AcceptToMemoryPool(mempool, stateTwice, MakeTransactionRef(txBadTwice), nullptr, nullptr, true, 0));
+    BOOST_CHECK_EQUAL(stateTwice.GetRejectReason(), strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(SCRIPT_ERR_VERIFY)));
+    BOOST_CHECK_EQUAL(nMempoolParallelScriptChecks.load(), nParallel + 2);
+
+    CValidationState stateGood;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, stateGood, MakeTransactionRef(txSpend), nullptr, nullptr, true, 0));
+    BOOST_CHECK(mempool.exists(txSpend.GetHash()));
+    BOOST_CHECK_EQUAL(nMempoolParallelScriptChecks.load(), nParallel + 3);
+
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
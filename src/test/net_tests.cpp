@@ -9,6 +9,8 @@
 #include <serialize.h>
 #include <streams.h>
 #include <net.h>
+#include <net_processing.h>
+#include <netmessagemaker.h>
 #include <netbase.h>
 #include <chainparams.h>
 #include <util.h>
@@ -71,6 +73,8 @@ CDataStream AddrmanToStream(CAddrManSerializationMock& _addrman)
     return CDataStream(vchData, SER_DISK, CLIENT_VERSION);
 }
 
+CService ip(uint32_t i);
+
 BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(cnode_listen_port)
@@ -185,4 +189,285 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+static CNode* AddMessageHandlerTestNode(PeerLogicValidation& peerLogic, NodeId id)
+{
+    CAddress addr(CService(CNetAddr(), 7777 + id), NODE_NETWORK);
+    CNode* pnode = new CNode(id, ServiceFlags(NODE_NETWORK | NODE_WITNESS), 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", true);
+    pnode->SetSendVersion(PROTOCOL_VERSION);
+    pnode->SetRecvVersion(PROTOCOL_VERSION);
+    peerLogic.InitializeNode(pnode);
+    pnode->nVersion = PROTOCOL_VERSION;
+    pnode->fSuccessfullyConnected = true;
+    CConnmanTest::AddNode(*pnode);
+    return pnode;
+}
+
+static void StartMessageHandlerTest(CConnman* connman, PeerLogicValidation* peerLogic, int nThreads)
+{
+    CConnman::Options options;
+    options.m_msgproc = peerLogic;
+    options.nSendBufferMaxSize = 1000 * DEFAULT_MAXSENDBUFFER;
+    options.nReceiveFloodSize = 1000 * DEFAULT_MAXRECEIVEBUFFER;
+    options.nMessageHandlerThreads = nThreads;
+    connman->Init(options);
+    CConnmanTest::StartMessageHandlers();
+}
+
+static void StopMessageHandlerTest(PeerLogicValidation& peerLogic, const std::vector<CNode*>& vNodes)
+{
+    CConnmanTest::StopMessageHandlers();
+    bool dummy;
+    for (CNode* pnode : vNodes)
+        peerLogic.FinalizeNode(pnode->GetId(), dummy);
+    CConnmanTest::ClearNodes();
+}
+
+//! Wait until the message handlers have processed everything queued for the nodes
+static bool WaitForMessageHandlers(const std::vector<CNode*>& vNodes)
+{
+    for (int i = 0; i < 3000; i++) {
+        bool fDone = true;
+        for (CNode* pnode : vNodes) {
+            LOCK(pnode->cs_msgProcessing);
+            LOCK(pnode->cs_vProcessMsg);
+            fDone &= pnode->vProcessMsg.empty();
+        }
+        if (fDone)
+            return true;
+        MilliSleep(10);
+    }
+    return false;
+}
+
+//! Commands and payloads of the messages queued to be sent to a node
+static std::vector<std::pair<std::string, std::vector<unsigned char>>> GetQueuedMessages(CNode* pnode)
+{
+    std::vector<std::pair<std::string, std::vector<unsigned char>>> vMsg;
+    LOCK(pnode->cs_vSend);
+    for (auto it = pnode->vSendMsg.begin(); it != pnode->vSendMsg.end(); ++it) {
+        CMessageHeader hdr(Params().MessageStart());
+        CDataStream ssHeader(**it, SER_NETWORK, PROTOCOL_VERSION);
+        ssHeader >> hdr;
+        std::vector<unsigned char> payload;
+        if (hdr.nMessageSize) {
+            ++it;
+            payload = **it;
+        }
+        vMsg.emplace_back(hdr.GetCommand(), payload);
+    }
+    return vMsg;
+}
+
+BOOST_FIXTURE_TEST_CASE(message_handler_order, TestingSetup)
+{
+    // More workers than peers, so that workers compete for the same peer
+    StartMessageHandlerTest(connman, peerLogic.get(), 8);
+
+    std::vector<CNode*> vNodes;
+    for (NodeId id = 0; id < 4; id++)
+        vNodes.push_back(AddMessageHandlerTestNode(*peerLogic, id));
+
+    // Pings arrive at all peers while the workers are running, each peer
+    // has to get its pongs back in the order of its pings
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    const uint64_t nPings = 250;
+    for (uint64_t nonce = 1; nonce <= nPings; nonce++) {
+        for (CNode* pnode : vNodes)
+            CConnmanTest::ReceiveMessage(*pnode, msgMaker.Make(NetMsgType::PING, nonce + 1000 * pnode->GetId()));
+    }
+    BOOST_CHECK(WaitForMessageHandlers(vNodes));
+
+    for (CNode* pnode : vNodes) {
+        std::vector<uint64_t> vNonce;
+        for (const auto& msg : GetQueuedMessages(pnode)) {
+            if (msg.first != NetMsgType::PONG)
+                continue;
+            CDataStream ss(msg.second, SER_NETWORK, PROTOCOL_VERSION);
+            uint64_t nonce;
+            ss >> nonce;
+            vNonce.push_back(nonce);
+        }
+        BOOST_REQUIRE_EQUAL(vNonce.size(), nPings);
+        for (uint64_t i = 0; i < nPings; i++)
+            BOOST_CHECK_EQUAL(vNonce[i], i + 1 + 1000 * pnode->GetId());
+    }
+
+    StopMessageHandlerTest(*peerLogic, vNodes);
+}
+
+BOOST_FIXTURE_TEST_CASE(message_handler_addr_relay, TestingSetup)
+{
+    StartMessageHandlerTest(connman, peerLogic.get(), 4);
+
+    std::vector<CNode*> vNodes;
+    for (NodeId id = 0; id < 8; id++)
+        vNodes.push_back(AddMessageHandlerTestNode(*peerLogic, id));
+
+    // Every peer announces addresses, which the workers handling them relay
+    // into the vAddrToSend of other peers while those are being drained
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::map<NodeId, std::vector<CAddress>> mapAddr;
+    for (int nMsg = 0; nMsg < 20; nMsg++) {
+        for (CNode* pnode : vNodes) {
+            std::vector<CAddress> vAddr;
+            for (int i = 0; i < 10; i++) {
+                // 8.x.x.x, which is routable
+                CAddress addr(ip(0x08 | (InsecureRandBits(24) << 8)), ServiceFlags(NODE_NETWORK | NODE_WITNESS));
+                addr.nTime = GetAdjustedTime();
+                vAddr.push_back(addr);
+            }
+            mapAddr[pnode->GetId()].insert(mapAddr[pnode->GetId()].end(), vAddr.begin(), vAddr.end());
+            CConnmanTest::ReceiveMessage(*pnode, msgMaker.Make(NetMsgType::ADDR, vAddr));
+        }
+    }
+    BOOST_CHECK(WaitForMessageHandlers(vNodes));
+    CConnmanTest::StopMessageHandlers();
+
+    // Each address is known to its sender and has been queued for, or sent
+    // to, at least one other peer
+    for (const auto& item : mapAddr) {
+        for (const CAddress& addr : item.second) {
+            bool fRelayed = false;
+            for (CNode* pnode : vNodes) {
+                LOCK(pnode->cs_vAddrToSend);
+                if (pnode->GetId() == item.first) {
+                    BOOST_CHECK(pnode->addrKnown.contains(addr.GetKey()));
+                    continue;
+                }
+                fRelayed |= pnode->addrKnown.contains(addr.GetKey()) ||
+                    std::find(pnode->vAddrToSend.begin(), pnode->vAddrToSend.end(), addr) != pnode->vAddrToSend.end();
+            }
+            BOOST_CHECK(fRelayed);
+        }
+    }
+
+    StopMessageHandlerTest(*peerLogic, vNodes);
+}
+
+#ifndef WIN32
+BOOST_FIXTURE_TEST_CASE(socket_events, TestingSetup)
+{
+    int fds[2], fdsIdle[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fdsIdle) == 0);
+    SOCKET hSocket = fds[0];
+    SOCKET hPeerSocket = fds[1];
+    BOOST_REQUIRE(SetSocketNonBlocking(hSocket, true));
+
+    CAddress addr(CService(CNetAddr(), 7777), NODE_NETWORK);
+    CNode* pnode = new CNode(0, NODE_NETWORK, 0, hSocket, addr, 0, 0, CAddress(), "", true);
+    CConnmanTest::AddNode(*pnode);
+    CNode* pnodeIdle = new CNode(1, NODE_NETWORK, 0, fdsIdle[0], addr, 0, 0, CAddress(), "", true);
+    CConnmanTest::AddNode(*pnodeIdle);
+
+    // Nothing to read and nothing queued to send
+    std::set<SOCKET> recv_set, send_set, error_set;
+    std::vector<CNode*> ready_nodes;
+    CConnmanTest::SocketEvents(recv_set, send_set, error_set, ready_nodes);
+    BOOST_CHECK(recv_set.empty());
+    BOOST_CHECK(send_set.empty());
+    BOOST_CHECK(ready_nodes.empty());
+
+    // Data arriving makes the socket readable, and only that node is returned
+    BOOST_REQUIRE(send(hPeerSocket, "x", 1, 0) == 1);
+    CConnmanTest::SocketEvents(recv_set, send_set, error_set, ready_nodes);
+    BOOST_CHECK(recv_set.count(hSocket));
+    BOOST_CHECK(send_set.empty());
+    BOOST_CHECK(ready_nodes == std::vector<CNode*>{pnode});
+
+    // Queued data is drained before more is received
+    {
+        LOCK(pnode->cs_vSend);
+        pnode->vSendMsg.push_back(std::make_shared<const std::vector<unsigned char>>(1));
+    }
+    g_connman->UpdateSocketInterest(pnode);
+    recv_set.clear();
+    CConnmanTest::SocketEvents(recv_set, send_set, error_set, ready_nodes);
+    BOOST_CHECK(recv_set.empty());
+    BOOST_CHECK(send_set.count(hSocket));
+    BOOST_CHECK(ready_nodes == std::vector<CNode*>{pnode});
+
+    // Receiving is paused while the process queue is full
+    {
+        LOCK(pnode->cs_vSend);
+        pnode->vSendMsg.clear();
+    }
+    pnode->fPauseRecv = true;
+    g_connman->UpdateSocketInterest(pnode);
+    send_set.clear();
+    CConnmanTest::SocketEvents(recv_set, send_set, error_set, ready_nodes);
+    BOOST_CHECK(recv_set.empty());
+    BOOST_CHECK(send_set.empty());
+    BOOST_CHECK(ready_nodes.empty());
+
+    // and resumes once there is room again
+    pnode->fPauseRecv = false;
+    g_connman->UpdateSocketInterest(pnode);
+    CConnmanTest::SocketEvents(recv_set, send_set, error_set, ready_nodes);
+    BOOST_CHECK(recv_set.count(hSocket));
+    BOOST_CHECK(ready_nodes == std::vector<CNode*>{pnode});
+
+    CConnmanTest::ClearNodes();
+    CloseSocket(hPeerSocket);
+    SOCKET hIdlePeerSocket = fdsIdle[1];
+    CloseSocket(hIdlePeerSocket);
+}
+
+BOOST_FIXTURE_TEST_CASE(shared_message_send, TestingSetup)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    SOCKET hSocket = fds[0];
+    SOCKET hPeerSocket = fds[1];
+    BOOST_REQUIRE(SetSocketNonBlocking(hSocket, true));
+    BOOST_REQUIRE(SetSocketNonBlocking(hPeerSocket, true));
+
+    CAddress addr(CService(CNetAddr(), 7777), NODE_NETWORK);
+    CNode* pnode = new CNode(0, NODE_NETWORK, 0, hSocket, addr, 0, 0, CAddress(), "", true);
+    CConnmanTest::AddNode(*pnode);
+
+    // Large enough not to fit in the socket buffer at once
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::vector<unsigned char> payload(1000000);
+    for (size_t i = 0; i < payload.size(); i++)
+        payload[i] = (unsigned char)i;
+    CSharedNetMsg msg = CConnman::ShareMessage(msgMaker.Make(NetMsgType::TX, payload));
+    BOOST_CHECK_EQUAL(msg.header->size(), (size_t)CMessageHeader::HEADER_SIZE);
+
+    std::vector<unsigned char> expected;
+    for (int i = 0; i < 3; i++) {
+        g_connman->PushMessage(pnode, msg);
+        expected.insert(expected.end(), msg.header->begin(), msg.header->end());
+        expected.insert(expected.end(), msg.data->begin(), msg.data->end());
+    }
+    CSharedNetMsg ping = CConnman::ShareMessage(msgMaker.Make(NetMsgType::PING, (uint64_t)42));
+    g_connman->PushMessage(pnode, msgMaker.Make(NetMsgType::PING, (uint64_t)42));
+    expected.insert(expected.end(), ping.header->begin(), ping.header->end());
+    expected.insert(expected.end(), ping.data->begin(), ping.data->end());
+
+    // The payload is queued by reference, not copied per push
+    BOOST_CHECK(msg.data.use_count() > 1);
+
+    std::vector<unsigned char> received;
+    char buf[0x10000];
+    for (int i = 0; i < 100000 && received.size() < expected.size(); i++) {
+        ssize_t nBytes = recv(hPeerSocket, buf, sizeof(buf), 0);
+        if (nBytes > 0)
+            received.insert(received.end(), buf, buf + nBytes);
+        CConnmanTest::SocketSendData(*pnode);
+    }
+    BOOST_CHECK(received == expected);
+    {
+        LOCK(pnode->cs_vSend);
+        BOOST_CHECK(pnode->vSendMsg.empty());
+        BOOST_CHECK_EQUAL(pnode->nSendSize, 0U);
+        BOOST_CHECK_EQUAL(pnode->nSendBytes, expected.size());
+    }
+    BOOST_CHECK_EQUAL(msg.data.use_count(), 1);
+
+    CConnmanTest::ClearNodes();
+    CloseSocket(hPeerSocket);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,20 +3,25 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 // TODO move all BMM Cache tests to bmmcache_tests.cpp
+#include "bloom.h"
 #include "bmmcache.h"
 #include "base58.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "init.h"
 #include "miner.h"
 #include "policy/policy.h"
+#include "policy/withdrawalbundle.h"
 #include "random.h"
 #include "script/sigcache.h"
 #include "sidechain.h"
+#include "sidechainperf.h"
 #include "uint256.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "validation.h"
+#include "validationinterface.h"
 
 #include "test/test_bitcoin.h"
 
@@ -285,6 +290,773 @@ BOOST_AUTO_TEST_CASE(sidechain_deposit_sort_deposits)
     BOOST_CHECK(vDepositSorted == vD);
 }
 
+BOOST_AUTO_TEST_CASE(sidechain_perf_stats)
+{
+    ResetSidechainPerfStats();
+
+    // Record latencies 1 - 100 and check the percentiles
+    for (int64_t i = 100; i > 0; i--)
+        RecordSidechainTiming("test", i);
+
+    std::map<std::string, SidechainTimingStat> mapTiming = GetSidechainTimingStats();
+    BOOST_CHECK(mapTiming.count("test"));
+
+    const SidechainTimingStat& stat = mapTiming["test"];
+    BOOST_CHECK(stat.nCount == 100);
+    BOOST_CHECK(stat.nTotalMicros == 5050);
+    BOOST_CHECK(stat.nMaxMicros == 100);
+    BOOST_CHECK(stat.GetPercentile(50) == 50);
+    BOOST_CHECK(stat.GetPercentile(99) == 99);
+    BOOST_CHECK(stat.GetPercentile(100) == 100);
+
+    // Only the most recent samples are used for percentiles
+    SidechainTimingStat statRecent;
+    for (size_t i = 0; i < SIDECHAIN_PERF_SAMPLES; i++)
+        statRecent.Add(1000);
+    for (size_t i = 0; i < SIDECHAIN_PERF_SAMPLES; i++)
+        statRecent.Add(1);
+    BOOST_CHECK(statRecent.vSample.size() == SIDECHAIN_PERF_SAMPLES);
+    BOOST_CHECK(statRecent.GetPercentile(100) == 1);
+    BOOST_CHECK(statRecent.nMaxMicros == 1000);
+
+    RecordSidechainCacheLookup("test", true);
+    RecordSidechainCacheLookup("test", true);
+    RecordSidechainCacheLookup("test", false);
+
+    std::map<std::string, SidechainCacheStat> mapCache = GetSidechainCacheStats();
+    BOOST_CHECK(mapCache["test"].nHit == 2);
+    BOOST_CHECK(mapCache["test"].nMiss == 1);
+
+    ResetSidechainPerfStats();
+    BOOST_CHECK(GetSidechainTimingStats().empty());
+    BOOST_CHECK(GetSidechainCacheStats().empty());
+}
+
+BOOST_AUTO_TEST_CASE(sidechain_bmm_template_reuse)
+{
+    ResetSidechainPerfStats();
+
+    // The second BMM block for the same tip and mempool reuses the
+    // transaction selection
+    std::string strError = "";
+    CBlock block;
+    BOOST_CHECK(BlockAssembler(Params()).GenerateBMMBlock(block, strError, nullptr,
+                std::vector<CMutableTransaction>(), uint256(), GetCoinbaseScript()));
+    CBlock blockReused;
+    BOOST_CHECK(BlockAssembler(Params()).GenerateBMMBlock(blockReused, strError, nullptr,
+                std::vector<CMutableTransaction>(), uint256(), GetCoinbaseScript()));
+
+    BOOST_CHECK(blockReused.hashPrevBlock == block.hashPrevBlock);
+    BOOST_CHECK_EQUAL(blockReused.vtx.size(), block.vtx.size());
+    BOOST_CHECK(GetSidechainCacheStats()["BMM block template"].nHit >= 1);
+
+    // It is made again once the mempool has changed
+    ResetSidechainPerfStats();
+    mempool.AddTransactionsUpdated(1);
+    CBlock blockMempool;
+    BOOST_CHECK(BlockAssembler(Params()).GenerateBMMBlock(blockMempool, strError, nullptr,
+                std::vector<CMutableTransaction>(), uint256(), GetCoinbaseScript()));
+    BOOST_CHECK_EQUAL(GetSidechainCacheStats()["BMM block template"].nHit, 0);
+    BOOST_CHECK_EQUAL(GetSidechainCacheStats()["BMM block template"].nMiss, 1);
+
+    // The selection isn't reused by an assembler with other options
+    ResetSidechainPerfStats();
+    BlockAssembler::Options options;
+    options.blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE * 10);
+    CBlock blockOptions;
+    BOOST_CHECK(BlockAssembler(Params(), options).GenerateBMMBlock(blockOptions, strError, nullptr,
+                std::vector<CMutableTransaction>(), uint256(), GetCoinbaseScript()));
+    BOOST_CHECK_EQUAL(GetSidechainCacheStats()["BMM block template"].nHit, 0);
+
+    ResetSidechainPerfStats();
+}
+
+BOOST_AUTO_TEST_CASE(withdrawal_bundle_packing)
+{
+    // A greedy pick of the highest fee withdrawal would leave room for only
+    // one more. Packing should select the three smaller withdrawals instead.
+    std::vector<bool> vSelected = PackWithdrawalBundle({10, 6, 6, 6}, {6, 3, 3, 3}, 9);
+    BOOST_CHECK(vSelected == std::vector<bool>({false, true, true, true}));
+
+    // With equal fees packing should prefer paying out more withdrawals
+    vSelected = PackWithdrawalBundle({2, 1, 1}, {6, 3, 3}, 6);
+    BOOST_CHECK(vSelected == std::vector<bool>({false, true, true}));
+
+    // A withdrawal which doesn't fit should not stop smaller withdrawals after
+    // it from being selected
+    vSelected = PackWithdrawalBundle({5, 100, 3, 1}, {4, 20, 3, 3}, 10);
+    BOOST_CHECK(vSelected == std::vector<bool>({true, false, true, true}));
+
+    // Nothing fits
+    vSelected = PackWithdrawalBundle({5, 5}, {11, 12}, 10);
+    BOOST_CHECK(vSelected == std::vector<bool>({false, false}));
+}
+
+BOOST_AUTO_TEST_CASE(withdrawal_bundle_full)
+{
+    // More P2PKH (34 byte output) and P2SH (32 byte output) withdrawals than
+    // fit. Paying a fee equal to the output size makes the packing use every
+    // byte it can, so the bundle has to be sized exactly to stay in bounds.
+    std::vector<SidechainWithdrawal> vWithdrawal;
+    for (int i = 0; i < 500; i++) {
+        SidechainWithdrawal wt;
+        wt.nSidechain = THIS_SIDECHAIN;
+        if (i % 2)
+            wt.strDestination = "1BitcoinEaterAddressDontSendf59kuE";
+        else
+            wt.strDestination = EncodeDestination(CScriptID(CScript() << i));
+        wt.strRefundDestination = "";
+        wt.amount = 10 * COIN;
+        wt.mainchainFee = i % 2 ? 34 : 32;
+        wt.status = WITHDRAWAL_UNSPENT;
+        wt.hashBlindTx = GetRandHash();
+        vWithdrawal.push_back(wt);
+    }
+    BOOST_CHECK(psidechaintree->WriteWithdrawalUpdate(vWithdrawal));
+
+    const int nPackHeight = Params().GetConsensus().WithdrawalBundlePackHeight;
+    CTransactionRef withdrawalBundleTx;
+    CTransactionRef withdrawalBundleDataTx;
+    BOOST_REQUIRE(CreateWithdrawalBundleTx(nPackHeight, withdrawalBundleTx, withdrawalBundleDataTx));
+
+    // Within the limit, with no room left for another withdrawal
+    unsigned int nWeight = GetTransactionWeight(*withdrawalBundleTx);
+    BOOST_CHECK(nWeight <= MAX_WITHDRAWAL_BUNDLE_WEIGHT);
+    BOOST_CHECK(nWeight + 32 * WITNESS_SCALE_FACTOR > MAX_WITHDRAWAL_BUNDLE_WEIGHT);
+    BOOST_CHECK(withdrawalBundleTx->vout.size() < vWithdrawal.size() + 2);
+
+    CAmount amountFees = 0;
+    BOOST_CHECK(DecodeWithdrawalFees(withdrawalBundleTx->vout[1].scriptPubKey, amountFees));
+    CAmount amountFeesExpected = 0;
+    for (size_t i = 2; i < withdrawalBundleTx->vout.size(); i++)
+        amountFeesExpected += withdrawalBundleTx->vout[i].scriptPubKey.IsPayToScriptHash() ? 32 : 34;
+    BOOST_CHECK_EQUAL(amountFees, amountFeesExpected);
+
+    // Below the activation height withdrawals are taken in fee order, every
+    // P2PKH withdrawal before the first P2SH one
+    CTransactionRef withdrawalBundleTxOld;
+    BOOST_REQUIRE(CreateWithdrawalBundleTx(nPackHeight - 1, withdrawalBundleTxOld, withdrawalBundleDataTx));
+    BOOST_REQUIRE(withdrawalBundleTxOld->vout.size() > 2 + vWithdrawal.size() / 2);
+    for (size_t i = 2; i < withdrawalBundleTxOld->vout.size(); i++)
+        BOOST_CHECK_EQUAL(withdrawalBundleTxOld->vout[i].scriptPubKey.IsPayToScriptHash(), i >= 2 + vWithdrawal.size() / 2);
+}
+
+struct SidechainUpdateListener : public CValidationInterface
+{
+    std::vector<SidechainWithdrawal> vWithdrawal;
+    std::vector<SidechainWithdrawalBundle> vWithdrawalBundle;
+    int nReloaded = 0;
+
+    void SidechainWithdrawalsUpdated(const std::vector<SidechainWithdrawal>& vWithdrawalIn) override
+    {
+        vWithdrawal.insert(vWithdrawal.end(), vWithdrawalIn.begin(), vWithdrawalIn.end());
+    }
+
+    void SidechainWithdrawalBundleUpdated(const SidechainWithdrawalBundle& withdrawalBundle) override
+    {
+        vWithdrawalBundle.push_back(withdrawalBundle);
+    }
+
+    void SidechainDBReloaded() override
+    {
+        nReloaded++;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(sidechain_update_notifications)
+{
+    SidechainUpdateListener listener;
+    RegisterValidationInterface(&listener);
+
+    SidechainWithdrawal wt;
+    wt.nSidechain = THIS_SIDECHAIN;
+    wt.strDestination = "1BitcoinEaterAddressDontSendf59kuE";
+    wt.strRefundDestination = "sVf5Jjy6EuVdq2oKFDaQAxb6rTYbmQZAPT";
+    wt.amount = 10 * COIN;
+    wt.mainchainFee = 1 * COIN;
+    wt.status = WITHDRAWAL_UNSPENT;
+    wt.hashBlindTx = uint256();
+
+    // New withdrawal
+    std::vector<std::pair<uint256, const SidechainObj *> > vObj;
+    vObj.push_back(std::make_pair(wt.GetID(), (const SidechainObj *) &wt));
+    BOOST_CHECK(psidechaintree->WriteSidechainIndex(vObj));
+
+    // Withdrawal added to a bundle, which should also update the withdrawal
+    SidechainWithdrawalBundle withdrawalBundle;
+    withdrawalBundle.nSidechain = THIS_SIDECHAIN;
+    withdrawalBundle.vWithdrawalID.push_back(wt.GetID());
+    withdrawalBundle.status = WITHDRAWAL_BUNDLE_CREATED;
+    BOOST_CHECK(psidechaintree->WriteWithdrawalBundleUpdate(withdrawalBundle));
+
+    // Loading a snapshot replaces everything, listeners must read it again
+    DBRecordList vRecord;
+    DBRecordList vArchiveRecord;
+    psidechaintree->ReadSnapshot(vRecord, vArchiveRecord);
+    BOOST_CHECK(psidechaintree->LoadSnapshot(vRecord, vArchiveRecord));
+
+    SyncWithValidationInterfaceQueue();
+    UnregisterValidationInterface(&listener);
+
+    BOOST_CHECK_EQUAL(listener.nReloaded, 1);
+
+    BOOST_CHECK_EQUAL(listener.vWithdrawal.size(), 2U);
+    BOOST_CHECK(listener.vWithdrawal[0].status == WITHDRAWAL_UNSPENT);
+    BOOST_CHECK(listener.vWithdrawal[1].status == WITHDRAWAL_IN_BUNDLE);
+    BOOST_CHECK(listener.vWithdrawal[1].GetID() == wt.GetID());
+
+    BOOST_CHECK_EQUAL(listener.vWithdrawalBundle.size(), 1U);
+    BOOST_CHECK(listener.vWithdrawalBundle[0].GetID() == withdrawalBundle.GetID());
+}
+
+BOOST_AUTO_TEST_CASE(sidechain_list_pagination)
+{
+    // Write withdrawals, half of them spent
+    std::vector<SidechainWithdrawal> vWithdrawal;
+    for (int i = 0; i < 10; i++) {
+        SidechainWithdrawal wt;
+        wt.nSidechain = THIS_SIDECHAIN;
+        wt.strDestination = "1BitcoinEaterAddressDontSendf59kuE";
+        wt.strRefundDestination = "";
+        wt.amount = (i + 1) * COIN;
+        wt.mainchainFee = 0;
+        wt.status = i % 2 ? WITHDRAWAL_SPENT : WITHDRAWAL_UNSPENT;
+        wt.hashBlindTx = GetRandHash();
+        vWithdrawal.push_back(wt);
+    }
+    BOOST_CHECK(psidechaintree->WriteWithdrawalUpdate(vWithdrawal));
+
+    // Page through all of the withdrawals
+    std::set<uint256> setID;
+    uint256 hashAfter;
+    int nPages = 0;
+    do {
+        uint256 hashNext;
+        std::vector<SidechainWithdrawal> vPage = psidechaintree->ListWithdrawals(hashAfter, 3, 0, hashNext);
+        BOOST_CHECK(vPage.size() <= 3);
+        for (const SidechainWithdrawal& wt : vPage)
+            BOOST_CHECK(setID.insert(wt.GetID()).second);
+        hashAfter = hashNext;
+        nPages++;
+    } while (!hashAfter.IsNull() && nPages < 10);
+
+    BOOST_CHECK_EQUAL(nPages, 4);
+    BOOST_CHECK_EQUAL(setID.size(), 10U);
+
+    // Filter by status. The last page should not have a cursor.
+    uint256 hashNext;
+    std::vector<SidechainWithdrawal> vUnspent = psidechaintree->ListWithdrawals(uint256(), 5, WITHDRAWAL_UNSPENT, hashNext);
+    BOOST_CHECK_EQUAL(vUnspent.size(), 5U);
+    BOOST_CHECK(hashNext.IsNull());
+    for (const SidechainWithdrawal& wt : vUnspent)
+        BOOST_CHECK(wt.status == WITHDRAWAL_UNSPENT);
+
+    // With a bound on the records read per call, filtered pages may come back
+    // short or empty but following the cursor still finds every match
+    std::set<uint256> setUnspent;
+    uint256 hashAfter2;
+    nPages = 0;
+    do {
+        std::vector<SidechainWithdrawal> vPage = psidechaintree->ListWithdrawals(hashAfter2, 5, WITHDRAWAL_UNSPENT, hashNext, 2);
+        BOOST_CHECK(vPage.size() <= 2);
+        for (const SidechainWithdrawal& wt : vPage) {
+            BOOST_CHECK(wt.status == WITHDRAWAL_UNSPENT);
+            BOOST_CHECK(setUnspent.insert(wt.GetID()).second);
+        }
+        hashAfter2 = hashNext;
+        nPages++;
+    } while (!hashAfter2.IsNull() && nPages < 20);
+    BOOST_CHECK_EQUAL(nPages, 5);
+    BOOST_CHECK_EQUAL(setUnspent.size(), 5U);
+
+    // Withdrawal bundles are also indexed by transaction hash, which should
+    // not be listed twice
+    SidechainWithdrawalBundle withdrawalBundle;
+    withdrawalBundle.nSidechain = THIS_SIDECHAIN;
+    withdrawalBundle.tx.vin.resize(1);
+    withdrawalBundle.tx.vin[0].scriptSig = CScript() << OP_0;
+    withdrawalBundle.tx.vout.push_back(CTxOut(1 * COIN, CScript() << OP_TRUE));
+    withdrawalBundle.nFailHeight = 0;
+    std::vector<std::pair<uint256, const SidechainObj *> > vObj;
+    vObj.push_back(std::make_pair(withdrawalBundle.GetID(), (const SidechainObj *) &withdrawalBundle));
+    BOOST_CHECK(psidechaintree->WriteSidechainIndex(vObj));
+
+    std::vector<SidechainWithdrawalBundle> vBundle = psidechaintree->ListWithdrawalBundles(uint256(), 10, 0, hashNext);
+    BOOST_CHECK_EQUAL(vBundle.size(), 1U);
+    BOOST_CHECK(hashNext.IsNull());
+
+    vBundle = psidechaintree->ListWithdrawalBundles(uint256(), 10, WITHDRAWAL_BUNDLE_FAILED, hashNext);
+    BOOST_CHECK(vBundle.empty());
+}
+
+BOOST_AUTO_TEST_CASE(sidechain_hash_bloom_filter)
+{
+    // Hashes inserted into the filter.
+    std::vector<uint256> vHash;
+    CHashBloomFilter filter(1000, 0.001);
+    for (int i = 0; i < 1000; i++) {
+        uint256 hash = GetRandHash();
+        filter.insert(hash);
+        vHash.push_back(hash);
+    }
+    BOOST_CHECK(!filter.IsFull());
+
+    // No false negatives.
+    for (const uint256& hash : vHash)
+        BOOST_CHECK(filter.contains(hash));
+
+    // Roughly the expected false positive rate.
+    int nHits = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (filter.contains(GetRandHash()))
+            nHits++;
+    }
+    BOOST_CHECK(nHits < 100);
+
+    // Inserting past nElements makes the filter full but it still contains
+    // everything.
+    for (int i = 0; i < 1000; i++) {
+        uint256 hash = GetRandHash();
+        filter.insert(hash);
+        vHash.push_back(hash);
+    }
+    BOOST_CHECK(filter.IsFull());
+    for (const uint256& hash : vHash)
+        BOOST_CHECK(filter.contains(hash));
+}
+
+BOOST_AUTO_TEST_CASE(sidechain_key_filter)
+{
+    // Nothing in the filter yet
+    BOOST_CHECK(!psidechaintree->HaveDeposits());
+
+    // Write more deposits than the filter was sized for so that it has to be
+    // rebuilt
+    std::vector<SidechainDeposit> vDeposit;
+    for (unsigned int i = 0; i < SIDECHAIN_FILTER_MIN_ELEMENTS; i++) {
+        SidechainDeposit deposit;
+        deposit.nSidechain = THIS_SIDECHAIN;
+        deposit.strDest = "";
+        deposit.amtUserPayout = i;
+        deposit.nBurnIndex = 0;
+        deposit.nTx = i;
+        deposit.hashMainchainBlock = GetRandHash();
+        vDeposit.push_back(deposit);
+    }
+    std::vector<std::pair<uint256, const SidechainObj *> > vObj;
+    for (const SidechainDeposit& deposit : vDeposit)
+        vObj.push_back(std::make_pair(deposit.GetHash(), (const SidechainObj *) &deposit));
+    BOOST_CHECK(psidechaintree->WriteSidechainIndex(vObj));
+
+    BOOST_CHECK(psidechaintree->HaveDeposits());
+
+    // Every deposit must still be found
+    for (const SidechainDeposit& deposit : vDeposit) {
+        BOOST_CHECK(psidechaintree->HaveDepositNonAmount(deposit.GetID()));
+        SidechainDeposit depositRead;
+        BOOST_CHECK(psidechaintree->GetDeposit(deposit.GetID(), depositRead));
+        BOOST_CHECK(depositRead == deposit);
+    }
+
+    // Deposits which don't exist
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(!psidechaintree->HaveDepositNonAmount(GetRandHash()));
+
+    // WithdrawalBundle is found by ID and by transaction hash
+    SidechainWithdrawalBundle withdrawalBundle;
+    withdrawalBundle.nSidechain = THIS_SIDECHAIN;
+    withdrawalBundle.tx.vin.resize(1);
+    withdrawalBundle.tx.vin[0].scriptSig = CScript() << OP_0;
+    withdrawalBundle.tx.vout.push_back(CTxOut(1 * COIN, CScript() << OP_TRUE));
+    withdrawalBundle.nFailHeight = 0;
+    BOOST_CHECK(!psidechaintree->HaveWithdrawalBundle(withdrawalBundle.tx.GetHash()));
+
+    BOOST_CHECK(psidechaintree->WriteWithdrawalBundleUpdate(withdrawalBundle));
+    BOOST_CHECK(psidechaintree->HaveWithdrawalBundle(withdrawalBundle.tx.GetHash()));
+    BOOST_CHECK(psidechaintree->HaveWithdrawalBundle(withdrawalBundle.GetID()));
+}
+
+BOOST_AUTO_TEST_CASE(sidechain_db_dedup)
+{
+    SidechainWithdrawalBundle withdrawalBundle;
+    withdrawalBundle.nSidechain = THIS_SIDECHAIN;
+    withdrawalBundle.tx.vin.resize(1);
+    withdrawalBundle.tx.vin[0].scriptSig = CScript() << OP_0;
+    withdrawalBundle.tx.vout.push_back(CTxOut(1 * COIN, CScript() << OP_TRUE));
+    withdrawalBundle.nFailHeight = 0;
+    uint256 id = withdrawalBundle.GetID();
+    uint256 hashWithdrawalBundle = withdrawalBundle.tx.GetHash();
+
+    SidechainDeposit deposit;
+    deposit.nSidechain = THIS_SIDECHAIN;
+    deposit.strDest = "";
+    deposit.amtUserPayout = 1;
+    deposit.nBurnIndex = 0;
+    deposit.nTx = 1;
+    deposit.hashMainchainBlock = GetRandHash();
+
+    std::vector<std::pair<uint256, const SidechainObj *> > vObj;
+    vObj.push_back(std::make_pair(id, (const SidechainObj *) &withdrawalBundle));
+    vObj.push_back(std::make_pair(deposit.GetID(), (const SidechainObj *) &deposit));
+    BOOST_CHECK(psidechaintree->WriteSidechainIndex(vObj));
+    BOOST_CHECK(psidechaintree->WriteWithdrawalBundleUpdate(withdrawalBundle));
+
+    // Found by ID and by transaction hash
+    SidechainWithdrawalBundle withdrawalBundleRead;
+    BOOST_CHECK(psidechaintree->GetWithdrawalBundle(id, withdrawalBundleRead));
+    BOOST_CHECK(withdrawalBundleRead.GetID() == id);
+    BOOST_CHECK(psidechaintree->GetWithdrawalBundle(hashWithdrawalBundle, withdrawalBundleRead));
+    BOOST_CHECK(withdrawalBundleRead.GetID() == id);
+
+    // Only one copy of each is stored
+    BOOST_CHECK(psidechaintree->GetWithdrawalBundles(THIS_SIDECHAIN).size() == 1);
+    BOOST_CHECK(psidechaintree->GetDeposits(THIS_SIDECHAIN).size() == 1);
+    BOOST_CHECK(!psidechaintree->Exists(std::make_pair('P', hashWithdrawalBundle)));
+
+    // Write the old layout, with a full copy of the WithdrawalBundle under the
+    // transaction hash, to a database on disk and check that it is upgraded
+    {
+        CSidechainTreeDB db(1 << 20, false, true);
+        db.Erase('v');
+        db.Erase(std::make_pair('p', hashWithdrawalBundle));
+        db.Write(std::make_pair('P', id), withdrawalBundle);
+        db.Write(std::make_pair('P', hashWithdrawalBundle), withdrawalBundle);
+        db.Write(std::make_pair('D', deposit.GetID()), deposit);
+    }
+    CSidechainTreeDB db(1 << 20, false, false);
+    BOOST_CHECK(!db.Exists(std::make_pair('P', hashWithdrawalBundle)));
+    BOOST_CHECK(db.GetWithdrawalBundles(THIS_SIDECHAIN).size() == 1);
+    BOOST_CHECK(db.GetDeposits(THIS_SIDECHAIN).size() == 1);
+    BOOST_CHECK(db.HaveWithdrawalBundle(hashWithdrawalBundle));
+    BOOST_CHECK(db.GetWithdrawalBundle(hashWithdrawalBundle, withdrawalBundleRead));
+    BOOST_CHECK(withdrawalBundleRead.GetID() == id);
+}
+
+BOOST_AUTO_TEST_CASE(sidechain_archive_settled)
+{
+    CSidechainTreeDB db(1 << 20, true, true, 10 /* nArchiveDepth */);
+
+    std::vector<SidechainWithdrawal> vWithdrawal;
+    for (int i = 0; i < 2; i++) {
+        SidechainWithdrawal wt;
+        wt.nSidechain = THIS_SIDECHAIN;
+        wt.strDestination = "1BitcoinEaterAddressDontSendf59kuE";
+        wt.strRefundDestination = "";
+        wt.amount = (i + 1) * COIN;
+        wt.mainchainFee = 0;
+        wt.hashBlindTx = GetRandHash();
+        vWithdrawal.push_back(wt);
+    }
+    BOOST_CHECK(db.WriteWithdrawalUpdate(vWithdrawal));
+
+    // A paid out WithdrawalBundle of the first withdrawal and a newer one
+    std::vector<SidechainWithdrawalBundle> vWithdrawalBundle;
+    for (int i = 0; i < 2; i++) {
+        SidechainWithdrawalBundle withdrawalBundle;
+        withdrawalBundle.nSidechain = THIS_SIDECHAIN;
+        withdrawalBundle.tx.vin.resize(1);
+        withdrawalBundle.tx.vin[0].scriptSig = CScript() << OP_0;
+        withdrawalBundle.tx.vout.push_back(CTxOut((i + 1) * COIN, CScript() << OP_TRUE));
+        withdrawalBundle.nFailHeight = 0;
+        vWithdrawalBundle.push_back(withdrawalBundle);
+    }
+    vWithdrawalBundle[0].vWithdrawalID.push_back(vWithdrawal[0].GetID());
+    for (const SidechainWithdrawalBundle& withdrawalBundle : vWithdrawalBundle) {
+        std::vector<std::pair<uint256, const SidechainObj *> > vObj;
+        vObj.push_back(std::make_pair(withdrawalBundle.GetID(), (const SidechainObj *) &withdrawalBundle));
+        BOOST_CHECK(db.WriteSidechainIndex(vObj));
+    }
+    vWithdrawalBundle[0].status = WITHDRAWAL_BUNDLE_SPENT;
+    BOOST_CHECK(db.WriteWithdrawalBundleUpdate(vWithdrawalBundle[0]));
+
+    std::vector<SidechainDeposit> vDeposit;
+    for (int i = 0; i < 2; i++) {
+        SidechainDeposit deposit;
+        deposit.nSidechain = THIS_SIDECHAIN;
+        deposit.strDest = "";
+        deposit.amtUserPayout = i;
+        deposit.nBurnIndex = 0;
+        deposit.nTx = i;
+        deposit.hashMainchainBlock = GetRandHash();
+        vDeposit.push_back(deposit);
+    }
+    std::vector<std::pair<uint256, const SidechainObj *> > vObj;
+    for (const SidechainDeposit& deposit : vDeposit)
+        vObj.push_back(std::make_pair(deposit.GetID(), (const SidechainObj *) &deposit));
+    BOOST_CHECK(db.WriteSidechainIndex(vObj));
+
+    // Nothing is archived until it has been settled for nArchiveDepth blocks
+    BOOST_CHECK(db.ArchiveSettled(100));
+    BOOST_CHECK(db.ArchiveSettled(105));
+    BOOST_CHECK_EQUAL(db.GetWithdrawals(THIS_SIDECHAIN, false).size(), 2U);
+    BOOST_CHECK_EQUAL(db.GetWithdrawalBundles(THIS_SIDECHAIN, false).size(), 2U);
+    BOOST_CHECK_EQUAL(db.GetDeposits(THIS_SIDECHAIN, false).size(), 2U);
+
+    // Only the last deposit is still queued for the next archive pass
+    BOOST_CHECK(!db.Exists(std::make_pair('n', std::make_pair('D', vDeposit[0].GetID()))));
+    BOOST_CHECK(db.Exists(std::make_pair('n', std::make_pair('D', vDeposit[1].GetID()))));
+    BOOST_CHECK(!db.Exists(std::make_pair('n', std::make_pair('W', vWithdrawal[0].GetID()))));
+
+    // The paid out withdrawal & WithdrawalBundle and the old deposit are
+    // archived. The unspent withdrawal and last WithdrawalBundle & deposit are
+    // kept. Readers still see them, so listeners aren't asked to reload.
+    // Notifications of the writes above are still queued, deliver them
+    // before listening.
+    SyncWithValidationInterfaceQueue();
+    SidechainUpdateListener listener;
+    RegisterValidationInterface(&listener);
+    BOOST_CHECK(db.ArchiveSettled(110));
+    BOOST_CHECK_EQUAL(db.GetWithdrawals(THIS_SIDECHAIN, false).size(), 1U);
+    BOOST_CHECK_EQUAL(db.GetWithdrawalBundles(THIS_SIDECHAIN, false).size(), 1U);
+    BOOST_CHECK_EQUAL(db.GetDeposits(THIS_SIDECHAIN, false).size(), 1U);
+
+    // Readers include archived objects unless told not to
+    BOOST_CHECK_EQUAL(db.GetWithdrawals(THIS_SIDECHAIN).size(), 2U);
+    BOOST_CHECK_EQUAL(db.GetWithdrawalBundles(THIS_SIDECHAIN).size(), 2U);
+    BOOST_CHECK_EQUAL(db.GetDeposits(THIS_SIDECHAIN).size(), 2U);
+
+    // Archived objects are still listed, a page at a time across both databases
+    uint256 hashNext;
+    BOOST_CHECK_EQUAL(db.ListWithdrawals(uint256(), 10, 0, hashNext).size(), 2U);
+    BOOST_CHECK_EQUAL(db.ListWithdrawals(uint256(), 10, WITHDRAWAL_SPENT, hashNext).size(), 1U);
+    BOOST_CHECK_EQUAL(db.ListWithdrawalBundles(uint256(), 10, 0, hashNext).size(), 2U);
+    BOOST_CHECK_EQUAL(db.ListDeposits(uint256(), 10, hashNext).size(), 2U);
+    std::vector<SidechainWithdrawal> vPage = db.ListWithdrawals(uint256(), 1, 0, hashNext);
+    BOOST_CHECK_EQUAL(vPage.size(), 1U);
+    BOOST_CHECK(!hashNext.IsNull());
+    uint256 hashAfter = hashNext;
+    std::vector<SidechainWithdrawal> vPageNext = db.ListWithdrawals(hashAfter, 1, 0, hashNext);
+    BOOST_CHECK_EQUAL(vPageNext.size(), 1U);
+    BOOST_CHECK(hashNext.IsNull());
+    BOOST_CHECK(vPage[0].GetID() != vPageNext[0].GetID());
+
+    // Archived objects can still be looked up
+    SidechainWithdrawal wt;
+    BOOST_CHECK(db.GetWithdrawal(vWithdrawal[0].GetID(), wt));
+    BOOST_CHECK(wt.status == WITHDRAWAL_SPENT);
+    SidechainWithdrawalBundle withdrawalBundle;
+    BOOST_CHECK(db.HaveWithdrawalBundle(vWithdrawalBundle[0].tx.GetHash()));
+    BOOST_CHECK(db.GetWithdrawalBundle(vWithdrawalBundle[0].tx.GetHash(), withdrawalBundle));
+    BOOST_CHECK(withdrawalBundle.status == WITHDRAWAL_BUNDLE_SPENT);
+    BOOST_CHECK(db.HaveDepositNonAmount(vDeposit[0].GetID()));
+
+    // Undoing the payout moves the WithdrawalBundle & withdrawal back and
+    // notifies listeners of both
+    vWithdrawalBundle[0].status = WITHDRAWAL_BUNDLE_CREATED;
+    BOOST_CHECK(db.WriteWithdrawalBundleUpdate(vWithdrawalBundle[0]));
+    SyncWithValidationInterfaceQueue();
+    UnregisterValidationInterface(&listener);
+    BOOST_CHECK_EQUAL(listener.nReloaded, 0);
+    BOOST_CHECK_EQUAL(listener.vWithdrawalBundle.size(), 1U);
+    BOOST_CHECK(listener.vWithdrawalBundle[0].status == WITHDRAWAL_BUNDLE_CREATED);
+    BOOST_CHECK_EQUAL(listener.vWithdrawal.size(), 1U);
+    BOOST_CHECK(listener.vWithdrawal[0].status == WITHDRAWAL_IN_BUNDLE);
+    BOOST_CHECK_EQUAL(db.GetWithdrawals(THIS_SIDECHAIN).size(), 2U);
+    BOOST_CHECK_EQUAL(db.GetWithdrawalBundles(THIS_SIDECHAIN).size(), 2U);
+    BOOST_CHECK(db.GetWithdrawal(vWithdrawal[0].GetID(), wt));
+    BOOST_CHECK(wt.status == WITHDRAWAL_IN_BUNDLE);
+
+    // Unsettled objects aren't archived
+    BOOST_CHECK(db.ArchiveSettled(200));
+    BOOST_CHECK(db.ArchiveSettled(300));
+    BOOST_CHECK_EQUAL(db.GetWithdrawals(THIS_SIDECHAIN, false).size(), 2U);
+    BOOST_CHECK_EQUAL(db.GetWithdrawalBundles(THIS_SIDECHAIN, false).size(), 2U);
+
+    // A newer deposit lets the queued one be archived
+    SidechainDeposit deposit = vDeposit[1];
+    deposit.nTx = 2;
+    vObj.clear();
+    vObj.push_back(std::make_pair(deposit.GetID(), (const SidechainObj *) &deposit));
+    BOOST_CHECK(db.WriteSidechainIndex(vObj));
+    BOOST_CHECK(db.ArchiveSettled(400));
+    BOOST_CHECK_EQUAL(db.GetDeposits(THIS_SIDECHAIN, false).size(), 2U);
+    BOOST_CHECK(db.ArchiveSettled(410));
+    BOOST_CHECK_EQUAL(db.GetDeposits(THIS_SIDECHAIN, false).size(), 1U);
+    BOOST_CHECK_EQUAL(db.GetDeposits(THIS_SIDECHAIN).size(), 3U);
+    BOOST_CHECK(!db.Exists(std::make_pair('D', vDeposit[1].GetID())));
+}
+
+BOOST_AUTO_TEST_CASE(sidechain_db_snapshot)
+{
+    CSidechainTreeDB db(1 << 20, true, true, 10 /* nArchiveDepth */);
+
+    SidechainWithdrawal wt;
+    wt.nSidechain = THIS_SIDECHAIN;
+    wt.strDestination = "1BitcoinEaterAddressDontSendf59kuE";
+    wt.strRefundDestination = "";
+    wt.amount = COIN;
+    wt.mainchainFee = 0;
+    wt.hashBlindTx = GetRandHash();
+    BOOST_CHECK(db.WriteWithdrawalUpdate(std::vector<SidechainWithdrawal>{wt}));
+
+    std::vector<SidechainDeposit> vDeposit;
+    for (int i = 0; i < 2; i++) {
+        SidechainDeposit deposit;
+        deposit.nSidechain = THIS_SIDECHAIN;
+        deposit.strDest = "";
+        deposit.amtUserPayout = i;
+        deposit.nBurnIndex = 0;
+        deposit.nTx = i;
+        deposit.hashMainchainBlock = GetRandHash();
+        vDeposit.push_back(deposit);
+    }
+    std::vector<std::pair<uint256, const SidechainObj *> > vObj;
+    for (const SidechainDeposit& deposit : vDeposit)
+        vObj.push_back(std::make_pair(deposit.GetID(), (const SidechainObj *) &deposit));
+    BOOST_CHECK(db.WriteSidechainIndex(vObj));
+
+    // Archive the first deposit
+    BOOST_CHECK(db.ArchiveSettled(100));
+    BOOST_CHECK(db.ArchiveSettled(110));
+    BOOST_CHECK_EQUAL(db.GetDeposits(THIS_SIDECHAIN, false).size(), 1U);
+
+    DBRecordList vRecord;
+    DBRecordList vArchiveRecord;
+    db.ReadSnapshot(vRecord, vArchiveRecord);
+    BOOST_CHECK(!vRecord.empty());
+    BOOST_CHECK(!vArchiveRecord.empty());
+
+    // Loading the snapshot replaces everything in another database
+    CSidechainTreeDB dbLoad(1 << 20, true, true, 10 /* nArchiveDepth */);
+    SidechainWithdrawal wtOther = wt;
+    wtOther.hashBlindTx = GetRandHash();
+    BOOST_CHECK(dbLoad.WriteWithdrawalUpdate(std::vector<SidechainWithdrawal>{wtOther}));
+
+    BOOST_CHECK(dbLoad.LoadSnapshot(vRecord, vArchiveRecord));
+
+    SidechainWithdrawal wtRead;
+    BOOST_CHECK(dbLoad.GetWithdrawal(wt.GetID(), wtRead));
+    BOOST_CHECK(!dbLoad.GetWithdrawal(wtOther.GetID(), wtRead));
+    BOOST_CHECK_EQUAL(dbLoad.GetDeposits(THIS_SIDECHAIN, false).size(), 1U);
+    BOOST_CHECK(dbLoad.HaveDepositNonAmount(vDeposit[0].GetID()));
+    BOOST_CHECK(dbLoad.HaveDepositNonAmount(vDeposit[1].GetID()));
+
+    DBRecordList vRecordLoad;
+    DBRecordList vArchiveRecordLoad;
+    dbLoad.ReadSnapshot(vRecordLoad, vArchiveRecordLoad);
+    BOOST_CHECK(vRecordLoad == vRecord);
+    BOOST_CHECK(vArchiveRecordLoad == vArchiveRecord);
+}
+
+BOOST_AUTO_TEST_CASE(sidechain_state_snapshot)
+{
+    SidechainWithdrawal wt;
+    wt.nSidechain = THIS_SIDECHAIN;
+    wt.strDestination = "1BitcoinEaterAddressDontSendf59kuE";
+    wt.strRefundDestination = "";
+    wt.amount = COIN;
+    wt.mainchainFee = 0;
+    wt.hashBlindTx = GetRandHash();
+    BOOST_CHECK(psidechaintree->WriteWithdrawalUpdate(std::vector<SidechainWithdrawal>{wt}));
+
+    uint256 hashBMM = GetRandHash();
+    bmmCache.CacheVerifiedBMM(hashBMM);
+
+    fs::path path = fs::temp_directory_path() / fs::unique_path();
+
+    SidechainStateInfo info;
+    std::string strError;
+    BOOST_CHECK(DumpSidechainState(path, info, strError));
+    BOOST_CHECK(info.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK(!info.hashContent.IsNull());
+
+    // Dumping the same state again gives the same hash
+    fs::path path2 = fs::temp_directory_path() / fs::unique_path();
+    SidechainStateInfo info2;
+    BOOST_CHECK(DumpSidechainState(path2, info2, strError));
+    BOOST_CHECK(info2.hashContent == info.hashContent);
+    fs::remove(path2);
+
+    // The snapshot isn't loaded unless it matches the trusted hash
+    SidechainStateInfo infoLoad;
+    BOOST_CHECK(!LoadSidechainState(path, GetRandHash(), infoLoad, strError));
+
+    // A snapshot rejected before our state was changed leaves it usable
+    bool fSnapshotFlag = false;
+    pblocktree->ReadFlag("sidechainsnapshot", fSnapshotFlag);
+    BOOST_CHECK(!fSnapshotFlag);
+    BOOST_CHECK(!fHaveSnapshotChain);
+    BOOST_CHECK(!ShutdownRequested());
+
+    // Change our state and load the snapshot to restore it
+    SidechainWithdrawal wtOther = wt;
+    wtOther.hashBlindTx = GetRandHash();
+    BOOST_CHECK(psidechaintree->WriteWithdrawalUpdate(std::vector<SidechainWithdrawal>{wtOther}));
+    uint256 hashBMMOther = GetRandHash();
+    bmmCache.CacheVerifiedBMM(hashBMMOther);
+    uint256 wtidOther = GetRandHash();
+    bmmCache.CacheWithdrawalID(wtidOther);
+
+    BOOST_CHECK(LoadSidechainState(path, info.hashContent, infoLoad, strError));
+    BOOST_CHECK_EQUAL(infoLoad.nCoins, info.nCoins);
+    BOOST_CHECK_EQUAL(infoLoad.nRecords, info.nRecords);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == info.hashBlock);
+
+    SidechainWithdrawal wtRead;
+    BOOST_CHECK(psidechaintree->GetWithdrawal(wt.GetID(), wtRead));
+    BOOST_CHECK(!psidechaintree->GetWithdrawal(wtOther.GetID(), wtRead));
+    BOOST_CHECK(bmmCache.HaveVerifiedBMM(hashBMM));
+
+    // Our caches were replaced, not merged
+    BOOST_CHECK(!bmmCache.HaveVerifiedBMM(hashBMMOther));
+    BOOST_CHECK(!bmmCache.IsMyWT(wtidOther));
+
+    fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(sidechain_state_snapshot_headers)
+{
+    // Add the header of a block we don't have the data of, like a new node
+    // which synced headers up to the snapshot tip
+    CBlockIndex* pindexSnapshot = nullptr;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindexGenesis = chainActive.Tip();
+
+        CBlockHeader header = pindexGenesis->GetBlockHeader();
+        header.hashPrevBlock = pindexGenesis->GetBlockHash();
+        header.nTime++;
+
+        pindexSnapshot = new CBlockIndex(header);
+        BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(header.GetHash(), pindexSnapshot)).first;
+        pindexSnapshot->phashBlock = &((*mi).first);
+        pindexSnapshot->pprev = pindexGenesis;
+        pindexSnapshot->nHeight = 1;
+        pindexSnapshot->BuildSkip();
+        pindexSnapshot->nTimeMax = pindexSnapshot->nTime;
+        pindexSnapshot->RaiseValidity(BLOCK_VALID_TREE);
+
+        // Our coins claim to be at the snapshot block while dumping
+        pcoinsTip->SetBestBlock(pindexSnapshot->GetBlockHash());
+    }
+
+    fs::path path = fs::temp_directory_path() / fs::unique_path();
+
+    SidechainStateInfo info;
+    std::string strError;
+    BOOST_CHECK(DumpSidechainState(path, info, strError));
+    BOOST_CHECK(info.hashBlock == pindexSnapshot->GetBlockHash());
+
+    {
+        LOCK(cs_main);
+        pcoinsTip->SetBestBlock(chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK(pcoinsTip->Flush());
+    }
+
+    SidechainStateInfo infoLoad;
+    BOOST_CHECK(LoadSidechainState(path, info.hashContent, infoLoad, strError));
+    fs::remove(path);
+
+    // The snapshot block is our tip without its block data
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip() == pindexSnapshot);
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == pindexSnapshot->GetBlockHash());
+    BOOST_CHECK(fHaveSnapshotChain);
+    BOOST_CHECK(!(pindexSnapshot->nStatus & BLOCK_HAVE_DATA));
+    BOOST_CHECK(pindexSnapshot->IsValid(BLOCK_VALID_SCRIPTS));
+    BOOST_CHECK(pindexSnapshot->nChainTx > 0);
+}
+
 BOOST_AUTO_TEST_CASE(IsWithdrawalBundleFailCommit)
 {
     uint256 hashWithdrawalBundle = GetRandHash();
@@ -21,8 +21,11 @@
 
 void CConnmanTest::AddNode(CNode& node)
 {
-    LOCK(g_connman->cs_vNodes);
-    g_connman->vNodes.push_back(&node);
+    {
+        LOCK(g_connman->cs_vNodes);
+        g_connman->vNodes.push_back(&node);
+    }
+    g_connman->UpdateSocketInterest(&node);
 }
 
 void CConnmanTest::ClearNodes()
@@ -34,6 +37,58 @@ void CConnmanTest::ClearNodes()
     g_connman->vNodes.clear();
 }
 
+void CConnmanTest::SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set, std::vector<CNode*>& ready_nodes)
+{
+    ready_nodes.clear();
+    g_connman->SocketEvents(recv_set, send_set, error_set, ready_nodes);
+    LOCK(g_connman->cs_vNodes);
+    for (CNode* pnode : ready_nodes)
+        pnode->Release();
+}
+
+size_t CConnmanTest::SocketSendData(CNode& node)
+{
+    LOCK(node.cs_vSend);
+    return g_connman->SocketSendData(&node);
+}
+
+void CConnmanTest::ReceiveMessage(CNode& node, CSerializedNetMsg&& msg)
+{
+    CSharedNetMsg shared = CConnman::ShareMessage(std::move(msg));
+    std::vector<unsigned char> vch(*shared.header);
+    if (shared.data)
+        vch.insert(vch.end(), shared.data->begin(), shared.data->end());
+
+    bool notify = false;
+    bool fReceived = node.ReceiveMsgBytes(reinterpret_cast<const char*>(vch.data()), vch.size(), notify);
+    assert(fReceived && notify);
+    {
+        LOCK(node.cs_vProcessMsg);
+        node.nProcessQueueSize += vch.size();
+        node.vProcessMsg.splice(node.vProcessMsg.end(), node.vRecvMsg);
+    }
+    g_connman->WakeMessageHandler();
+}
+
+void CConnmanTest::StartMessageHandlers()
+{
+    g_connman->flagInterruptMsgProc = false;
+    for (int n = 0; n < g_connman->nMessageHandlerThreads; n++)
+        g_connman->threadMessageHandlers.emplace_back(&CConnman::ThreadMessageHandler, g_connman.get(), n);
+}
+
+void CConnmanTest::StopMessageHandlers()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_connman->mutexMsgProc);
+        g_connman->flagInterruptMsgProc = true;
+    }
+    g_connman->condMsgProc.notify_all();
+    for (std::thread& thread : g_connman->threadMessageHandlers)
+        thread.join();
+    g_connman->threadMessageHandlers.clear();
+}
+
 uint256 insecure_rand_seed = GetRandHash();
 FastRandomContext insecure_rand_ctx(insecure_rand_seed);
 
@@ -94,6 +149,8 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i < nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadInputPrefetch);
         g_connman = std::unique_ptr<CConnman>(new CConnman(0x1337, 0x1337)); // Deterministic randomness for tests.
         connman = g_connman.get();
         peerLogic.reset(new PeerLogicValidation(connman, scheduler));
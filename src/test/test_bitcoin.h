@@ -50,9 +50,17 @@ struct BasicTestingSetup {
  */
 class CConnman;
 class CNode;
+struct CSerializedNetMsg;
 struct CConnmanTest {
     static void AddNode(CNode& node);
     static void ClearNodes();
+    static void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set, std::vector<CNode*>& ready_nodes);
+    static size_t SocketSendData(CNode& node);
+    //! Queue a message for processing as if it had arrived on the node's socket
+    static void ReceiveMessage(CNode& node, CSerializedNetMsg&& msg);
+    //! Start and stop the message handler threads of g_connman, see CConnman::Init
+    static void StartMessageHandlers();
+    static void StopMessageHandlers();
 };
 
 class PeerLogicValidation;
@@ -10,10 +10,12 @@
 #include <hash.h>
 #include <random.h>
 #include <sidechain.h>
+#include <sidechainperf.h>
 #include <uint256.h>
 #include <util.h>
 #include <ui_interface.h>
 #include <init.h>
+#include <validationinterface.h>
 
 #include <stdint.h>
 
@@ -30,9 +32,21 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_COINS_ROLLING_STATS = 'u';
 
 static const char DB_LAST_SIDECHAIN_DEPOSIT = 'x';
 static const char DB_LAST_SIDECHAIN_WITHDRAWAL_BUNDLE = 'w';
+static const char DB_SIDECHAIN_WITHDRAWAL_BUNDLE_TXID = 'p';
+static const char DB_SIDECHAIN_VERSION = 'v';
+static const char DB_SIDECHAIN_SETTLED_HEIGHT = 's';
+static const char DB_SIDECHAIN_SETTLED_INDEX = 'h';
+static const char DB_SIDECHAIN_SETTLED_PENDING = 'n';
+
+//! Version 1: WithdrawalBundle(s) are stored once under their ID and indexed
+//! by transaction hash with DB_SIDECHAIN_WITHDRAWAL_BUNDLE_TXID
+//! Version 2: Objects written in a settled state are queued for the archive
+//! pass with DB_SIDECHAIN_SETTLED_PENDING
+static const int SIDECHAIN_DB_VERSION = 2;
 
 namespace {
 
@@ -56,21 +70,71 @@ struct CoinEntry {
     }
 };
 
+/** Key of a settled sidechain object in the index by settled height */
+struct SettledIndexEntry {
+    char key;
+    uint32_t nHeight;
+    std::pair<char, uint256> obj;
+    SettledIndexEntry() : key(DB_SIDECHAIN_SETTLED_INDEX), nHeight(0) {}
+    SettledIndexEntry(int nHeightIn, const std::pair<char, uint256>& objIn) : key(DB_SIDECHAIN_SETTLED_INDEX), nHeight(nHeightIn), obj(objIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        s << key;
+        // Big endian so that the index is ordered by height
+        ser_writedata32be(s, nHeight);
+        s << obj;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        s >> key;
+        nHeight = ser_readdata32be(s);
+        s >> obj;
+    }
+};
+
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true), fBackgroundWrite(false), nPendingUsage(0), fPendingWriteFailed(false)
+{
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
+CCoinsViewDB::~CCoinsViewDB()
 {
+    WaitForBackgroundWrite();
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        LOCK(cs_pending);
+        CoinsWriteMap::const_iterator it = mapPending.find(outpoint);
+        if (it != mapPending.end()) {
+            if (it->second.IsSpent())
+                return false;
+            coin = it->second;
+            return true;
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        LOCK(cs_pending);
+        CoinsWriteMap::const_iterator it = mapPending.find(outpoint);
+        if (it != mapPending.end())
+            return !it->second.IsSpent();
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        LOCK(cs_pending);
+        if (!hashPending.IsNull())
+            return hashPending;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -86,13 +150,15 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
-    CDBBatch batch(db);
-    size_t count = 0;
-    size_t changed = 0;
-    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
-    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
+    // Only one write at a time, this also makes sure that the database is
+    // up to date before we read the old tip from it. cs_write is held until
+    // the new write has started, so a concurrent Cursor() waits for it too.
+    LOCK(cs_write);
+    if (!WaitForBackgroundWrite())
+        return false;
+
     uint256 old_tip = GetBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
@@ -103,6 +169,85 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
         }
     }
 
+    // In the background case the coins go straight to mapPending, where
+    // reads find them until the write is done
+    CoinsWriteMap mapWrite;
+    size_t count = mapCoins.size();
+    {
+        LOCK(cs_pending);
+        CoinsWriteMap& mapTarget = fBackgroundWrite ? mapPending : mapWrite;
+        for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                Coin coin;
+                it->second.MoveCoin(coin);
+                mapTarget.emplace(it->first, std::move(coin));
+            }
+        }
+        if (fBackgroundWrite) {
+            hashPending = hashBlock;
+            nPendingUsage = memusage::DynamicUsage(mapPending);
+            for (const auto& item : mapPending)
+                nPendingUsage += item.second.DynamicMemoryUsage();
+        }
+        LogPrint(BCLog::COINDB, "Writing %u changed transaction outputs (out of %u) to coin database%s...\n",
+                 (unsigned int)mapTarget.size(), (unsigned int)count, fBackgroundWrite ? " in the background" : "");
+    }
+
+    if (!fBackgroundWrite)
+        return WriteCoins(mapWrite, hashBlock, old_tip);
+
+    threadWrite = std::thread(&CCoinsViewDB::ThreadWrite, this, hashBlock, old_tip);
+    return true;
+}
+
+void CCoinsViewDB::ThreadWrite(const uint256 hashBlock, const uint256 old_tip)
+{
+    RenameThread("bitcoin-coinsflush");
+
+    // mapPending is only modified by this thread until it is joined, so it
+    // can be read without holding cs_pending
+    bool fOk;
+    try {
+        fOk = WriteCoins(mapPending, hashBlock, old_tip);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        fOk = false;
+    }
+
+    LOCK(cs_pending);
+    if (fOk) {
+        mapPending.clear();
+        hashPending.SetNull();
+        nPendingUsage = 0;
+    } else {
+        // Keep the coins so that reads stay consistent until shutdown
+        fPendingWriteFailed = true;
+    }
+}
+
+bool CCoinsViewDB::WaitForBackgroundWrite() const
+{
+    {
+        LOCK(cs_write);
+        if (threadWrite.joinable())
+            threadWrite.join();
+    }
+
+    LOCK(cs_pending);
+    return !fPendingWriteFailed;
+}
+
+size_t CCoinsViewDB::PendingMemoryUsage() const
+{
+    LOCK(cs_pending);
+    return nPendingUsage;
+}
+
+bool CCoinsViewDB::WriteCoins(const CoinsWriteMap &mapWrite, const uint256 &hashBlock, const uint256 &old_tip) {
+    CDBBatch batch(db);
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
+
     // In the first batch, mark the database as being in the middle of a
     // transition from old_tip to hashBlock.
     // A vector is used for future extensibility, as we may want to support
@@ -110,18 +255,12 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
-        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            CoinEntry entry(&it->first);
-            if (it->second.coin.IsSpent())
-                batch.Erase(entry);
-            else
-                batch.Write(entry, it->second.coin);
-            changed++;
-        }
-        count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+    for (const auto& item : mapWrite) {
+        CoinEntry entry(&item.first);
+        if (item.second.IsSpent())
+            batch.Erase(entry);
+        else
+            batch.Write(entry, item.second);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -142,7 +281,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
-    LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs to coin database...\n", (unsigned int)mapWrite.size());
     return ret;
 }
 
@@ -176,11 +315,22 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    return Cursor(uint256());
+}
+
+CCoinsViewCursor *CCoinsViewDB::Cursor(const uint256 &hashStart) const
+{
+    // The cursor reads the database directly. Keep a new write from starting
+    // until the iterator has taken its snapshot of the database.
+    LOCK(cs_write);
+    WaitForBackgroundWrite();
+
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COIN);
+    const COutPoint outpointStart(hashStart, 0);
+    i->pcursor->Seek(CoinEntry(&outpointStart));
     // Cache key of first record
     if (i->pcursor->Valid()) {
         CoinEntry entry(&i->keyTmp.second);
@@ -251,6 +401,31 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::WriteCoinsRollingStats(const uint256 &hashBlock, const CCoinsRollingStats &stats) {
+    return Write(std::make_pair(DB_COINS_ROLLING_STATS, hashBlock), stats);
+}
+
+bool CBlockTreeDB::ReadCoinsRollingStats(const uint256 &hashBlock, CCoinsRollingStats &stats) {
+    return Read(std::make_pair(DB_COINS_ROLLING_STATS, hashBlock), stats);
+}
+
+bool CBlockTreeDB::EraseCoinsRollingStats(const uint256 &hashBlock) {
+    return Erase(std::make_pair(DB_COINS_ROLLING_STATS, hashBlock));
+}
+
+bool CBlockTreeDB::PruneCoinsRollingStats(const std::set<uint256> &setKeep) {
+    CDBBatch batch(*this);
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    for (pcursor->Seek(std::make_pair(DB_COINS_ROLLING_STATS, uint256())); pcursor->Valid(); pcursor->Next()) {
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_COINS_ROLLING_STATS)
+            break;
+        if (!setKeep.count(key.second))
+            batch.Erase(key);
+    }
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -303,78 +478,313 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
     return true;
 }
 
-CSidechainTreeDB::CSidechainTreeDB(size_t nCacheSize, bool fMemory, bool fWipe)
-    : CDBWrapper(GetDataDir() / "blocks" / "sidechain", nCacheSize, fMemory, fWipe) { }
+//! Whether the status of a sidechain object means it will not change again
+static bool IsSettledStatus(const SidechainWithdrawal& wt)
+{
+    return wt.status == WITHDRAWAL_SPENT;
+}
+
+static bool IsSettledStatus(const SidechainWithdrawalBundle& withdrawalBundle)
+{
+    return withdrawalBundle.status == WITHDRAWAL_BUNDLE_SPENT || withdrawalBundle.status == WITHDRAWAL_BUNDLE_FAILED;
+}
+
+static bool IsSettledStatus(const SidechainDeposit& deposit)
+{
+    return true;
+}
+
+//! Queue an object which was written with a settled status for the next archive pass
+static void WriteSettledPending(CDBBatch& batch, const std::pair<char, uint256>& key)
+{
+    batch.Write(std::make_pair(DB_SIDECHAIN_SETTLED_PENDING, key), '1');
+}
+
+CSidechainTreeDB::CSidechainTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, int nArchiveDepthIn)
+    : CDBWrapper(GetDataDir() / "blocks" / "sidechain", nCacheSize, fMemory, fWipe),
+      dbArchive(GetDataDir() / "blocks" / "sidechainarchive", SIDECHAIN_ARCHIVE_DB_CACHE, fMemory, fWipe),
+      nArchiveDepth(nArchiveDepthIn)
+{
+    if (!Upgrade())
+        throw std::runtime_error("Failed to upgrade sidechain database");
+
+    RebuildFilter(DB_SIDECHAIN_DEPOSIT_OP);
+    RebuildFilter(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP);
+}
+
+bool CSidechainTreeDB::Upgrade()
+{
+    int nVersion = 0;
+    if (!Read(DB_SIDECHAIN_VERSION, nVersion)) {
+        // A new database doesn't need to be upgraded
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->SeekToFirst();
+        if (!pcursor->Valid())
+            return Write(DB_SIDECHAIN_VERSION, SIDECHAIN_DB_VERSION);
+    }
+
+    if (nVersion >= SIDECHAIN_DB_VERSION)
+        return true;
+
+    LogPrintf("%s: Upgrading sidechain database from version %d to %d\n", __func__, nVersion, SIDECHAIN_DB_VERSION);
+
+    if (nVersion < 1) {
+        // WithdrawalBundle(s) used to be written in full under both their ID
+        // and their transaction hash. Keep the copy under the ID and replace
+        // the other with an index entry.
+        CDBBatch batch(*this);
+        size_t nRemoved = 0;
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        pcursor->Seek(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, uint256()));
+        while (pcursor->Valid()) {
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP)
+                break;
+
+            SidechainWithdrawalBundle withdrawalBundle;
+            if (!pcursor->GetSidechainValue(withdrawalBundle)) {
+                LogPrintf("%s: Failed to read WithdrawalBundle!\n", __func__);
+                return false;
+            }
+
+            uint256 id = withdrawalBundle.GetID();
+            if (key.second != id) {
+                batch.Erase(key);
+                nRemoved++;
+
+                // Only the copy under the transaction hash might be left
+                if (!Exists(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id)))
+                    batch.Write(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id), withdrawalBundle);
+            }
+            batch.Write(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_TXID, withdrawalBundle.tx.GetHash()), id);
+
+            pcursor->Next();
+        }
+
+        if (!WriteBatch(batch, true))
+            return false;
+
+        LogPrintf("%s: Removed %u duplicate WithdrawalBundle(s)\n", __func__, nRemoved);
+    }
+
+    if (nVersion < 2) {
+        // Queue every object for the next archive pass, which only looks at
+        // objects written since the previous one
+        CDBBatch batch(*this);
+        for (char sidechainop : { DB_SIDECHAIN_WITHDRAWAL_OP, DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, DB_SIDECHAIN_DEPOSIT_OP }) {
+            std::unique_ptr<CDBIterator> pcursor(NewIterator());
+            pcursor->Seek(std::make_pair(sidechainop, uint256()));
+            while (pcursor->Valid()) {
+                std::pair<char, uint256> key;
+                if (!pcursor->GetKey(key) || key.first != sidechainop)
+                    break;
+
+                WriteSettledPending(batch, key);
+                pcursor->Next();
+            }
+        }
+
+        if (!WriteBatch(batch, true))
+            return false;
+    }
+
+    if (!Write(DB_SIDECHAIN_VERSION, SIDECHAIN_DB_VERSION, true))
+        return false;
+
+    GetMainSignals().SidechainDBReloaded();
+
+    return true;
+}
+
+void CSidechainTreeDB::RebuildFilter(char sidechainop)
+{
+    // Keys written while the database is being read are added to the old
+    // filter, so AddToFilter has to wait until the new one is in place
+    LOCK(cs_filter);
+
+    // WithdrawalBundle(s) can also be looked up by transaction hash
+    std::vector<char> vPrefix = { sidechainop };
+    if (sidechainop == DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP)
+        vPrefix.push_back(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_TXID);
+
+    // Read only the keys, including archived objects
+    std::vector<uint256> vHash;
+    for (CDBWrapper* db : { (CDBWrapper*) this, &dbArchive }) {
+        for (char prefix : vPrefix) {
+            std::unique_ptr<CDBIterator> pcursor(db->NewIterator());
+            pcursor->Seek(std::make_pair(prefix, uint256()));
+            while (pcursor->Valid()) {
+                std::pair<char, uint256> key;
+                if (!pcursor->GetKey(key) || key.first != prefix)
+                    break;
+
+                vHash.push_back(key.second);
+                pcursor->Next();
+            }
+        }
+    }
+
+    // Leave room for the filter to grow before it has to be rebuilt again
+    unsigned int nElements = std::max((unsigned int)vHash.size() * 2, SIDECHAIN_FILTER_MIN_ELEMENTS);
+    std::unique_ptr<CHashBloomFilter> pfilter(new CHashBloomFilter(nElements, SIDECHAIN_FILTER_FP_RATE));
+    for (const uint256& hash : vHash)
+        pfilter->insert(hash);
+
+    if (sidechainop == DB_SIDECHAIN_DEPOSIT_OP)
+        pfilterDeposit = std::move(pfilter);
+    else
+    if (sidechainop == DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP)
+        pfilterWithdrawalBundle = std::move(pfilter);
+}
+
+void CSidechainTreeDB::AddToFilter(char sidechainop, const uint256& hash)
+{
+    LOCK(cs_filter);
+    CHashBloomFilter* pfilter = nullptr;
+    if (sidechainop == DB_SIDECHAIN_DEPOSIT_OP)
+        pfilter = pfilterDeposit.get();
+    else
+    if (sidechainop == DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP)
+        pfilter = pfilterWithdrawalBundle.get();
+
+    // Objects are rewritten when their status changes, don't count them twice
+    if (pfilter && !pfilter->contains(hash))
+        pfilter->insert(hash);
+}
+
+void CSidechainTreeDB::RebuildFullFilters()
+{
+    LOCK(cs_filter);
+    if (pfilterDeposit->IsFull())
+        RebuildFilter(DB_SIDECHAIN_DEPOSIT_OP);
+    if (pfilterWithdrawalBundle->IsFull())
+        RebuildFilter(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP);
+}
+
+bool CSidechainTreeDB::FilterContains(char sidechainop, const uint256& hash) const
+{
+    LOCK(cs_filter);
+    if (sidechainop == DB_SIDECHAIN_DEPOSIT_OP)
+        return pfilterDeposit->contains(hash);
+    else
+    if (sidechainop == DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP)
+        return pfilterWithdrawalBundle->contains(hash);
+
+    return true;
+}
 
 bool CSidechainTreeDB::WriteSidechainIndex(const std::vector<std::pair<uint256, const SidechainObj *> > &list)
 {
     CDBBatch batch(*this);
+    std::vector<SidechainWithdrawal> vWithdrawalNew;
+    std::vector<SidechainWithdrawalBundle> vWithdrawalBundleNew;
+    std::vector<std::pair<char, uint256> > vKey;
     for (std::vector<std::pair<uint256, const SidechainObj *> >::const_iterator it=list.begin(); it!=list.end(); it++) {
         const uint256 &objid = it->first;
         const SidechainObj *obj = it->second;
         std::pair<char, uint256> key = std::make_pair(obj->sidechainop, objid);
+        vKey.push_back(key);
 
         if (obj->sidechainop == DB_SIDECHAIN_WITHDRAWAL_OP) {
             const SidechainWithdrawal *ptr = (const SidechainWithdrawal *) obj;
             batch.Write(key, *ptr);
+            if (IsSettledStatus(*ptr))
+                WriteSettledPending(batch, key);
+
+            vWithdrawalNew.push_back(*ptr);
         }
         else
         if (obj->sidechainop == DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP) {
             const SidechainWithdrawalBundle *ptr = (const SidechainWithdrawalBundle *) obj;
-            batch.Write(key, *ptr);
+            uint256 id = ptr->GetID();
+            batch.Write(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id), *ptr);
+            if (IsSettledStatus(*ptr))
+                WriteSettledPending(batch, std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id));
 
             // Also index the WithdrawalBundle by the WithdrawalBundle transaction hash
             uint256 hashWithdrawalBundle = ptr->tx.GetHash();
-            std::pair<char, uint256> keyTx = std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, hashWithdrawalBundle);
-            batch.Write(keyTx, *ptr);
+            batch.Write(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_TXID, hashWithdrawalBundle), id);
+
+            AddToFilter(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id);
+            AddToFilter(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, hashWithdrawalBundle);
 
             // Update DB_LAST_SIDECHAIN_WITHDRAWAL_BUNDLE
             batch.Write(DB_LAST_SIDECHAIN_WITHDRAWAL_BUNDLE, hashWithdrawalBundle);
 
             LogPrintf("%s: Writing new WithdrawalBundle and updating DB_LAST_SIDECHAIN_WITHDRAWAL_BUNDLE to: %s",
                     __func__, hashWithdrawalBundle.ToString());
+
+            vWithdrawalBundleNew.push_back(*ptr);
         }
         else
         if (obj->sidechainop == DB_SIDECHAIN_DEPOSIT_OP) {
             const SidechainDeposit *ptr = (const SidechainDeposit *) obj;
-            batch.Write(key, *ptr);
 
-            // Also index the deposit by the non amount hash
+            // Deposits are stored by the non amount hash
             uint256 hashNonAmount = ptr->GetID();
             batch.Write(std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, hashNonAmount), *ptr);
+            WriteSettledPending(batch, std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, hashNonAmount));
+
+            AddToFilter(DB_SIDECHAIN_DEPOSIT_OP, hashNonAmount);
 
             // Update DB_LAST_SIDECHAIN_DEPOSIT
             batch.Write(DB_LAST_SIDECHAIN_DEPOSIT, hashNonAmount);
         }
     }
 
-    return WriteBatch(batch, true);
+    if (!WriteBatch(batch, true))
+        return false;
+
+    // Notify as soon as the new versions can be read, objects restored from
+    // the archive included
+    if (!vWithdrawalNew.empty())
+        GetMainSignals().SidechainWithdrawalsUpdated(vWithdrawalNew);
+    for (const SidechainWithdrawalBundle& withdrawalBundle : vWithdrawalBundleNew)
+        GetMainSignals().SidechainWithdrawalBundleUpdated(withdrawalBundle);
+
+    RebuildFullFilters();
+
+    return Unarchive(vKey);
 }
 
 bool CSidechainTreeDB::WriteWithdrawalUpdate(const std::vector<SidechainWithdrawal>& vWithdrawal)
 {
     CDBBatch batch(*this);
+    std::vector<std::pair<char, uint256> > vKey;
 
     for (const SidechainWithdrawal& wt : vWithdrawal)
     {
         std::pair<char, uint256> key = std::make_pair(wt.sidechainop, wt.GetID());
         batch.Write(key, wt);
+        if (IsSettledStatus(wt))
+            WriteSettledPending(batch, key);
+        vKey.push_back(key);
     }
 
-    return WriteBatch(batch, true);
+    if (!WriteBatch(batch, true))
+        return false;
+
+    if (!vWithdrawal.empty())
+        GetMainSignals().SidechainWithdrawalsUpdated(vWithdrawal);
+
+    return Unarchive(vKey);
 }
 
 bool CSidechainTreeDB::WriteWithdrawalBundleUpdate(const SidechainWithdrawalBundle& withdrawalBundle)
 {
     CDBBatch batch(*this);
 
-    std::pair<char, uint256> key = std::make_pair(withdrawalBundle.sidechainop, withdrawalBundle.GetID());
-    batch.Write(key, withdrawalBundle);
+    uint256 id = withdrawalBundle.GetID();
+    batch.Write(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id), withdrawalBundle);
+    if (IsSettledStatus(withdrawalBundle))
+        WriteSettledPending(batch, std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id));
 
     // Also index the WithdrawalBundle by the WithdrawalBundle transaction hash
     uint256 hashWithdrawalBundle = withdrawalBundle.tx.GetHash();
-    std::pair<char, uint256> keyTx = std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, hashWithdrawalBundle);
-    batch.Write(keyTx, withdrawalBundle);
+    batch.Write(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_TXID, hashWithdrawalBundle), id);
+
+    AddToFilter(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id);
+    AddToFilter(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, hashWithdrawalBundle);
 
     // Also write withdrawal status updates if WithdrawalBundle status changes
     std::vector<SidechainWithdrawal> vUpdate;
@@ -405,7 +815,14 @@ bool CSidechainTreeDB::WriteWithdrawalBundleUpdate(const SidechainWithdrawalBund
         return false;
     }
 
-    return WriteBatch(batch, true);
+    if (!WriteBatch(batch, true))
+        return false;
+
+    GetMainSignals().SidechainWithdrawalBundleUpdated(withdrawalBundle);
+
+    RebuildFullFilters();
+
+    return Unarchive({ std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id) });
 }
 
 bool CSidechainTreeDB::WriteLastWithdrawalBundleHash(const uint256& hash)
@@ -418,12 +835,25 @@ bool CSidechainTreeDB::GetWithdrawal(const uint256& objid, SidechainWithdrawal&
     if (ReadSidechain(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_OP, objid), withdrawal))
         return true;
 
+    if (dbArchive.ReadSidechain(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_OP, objid), withdrawal))
+        return true;
+
     return false;
 }
 
 bool CSidechainTreeDB::GetWithdrawalBundle(const uint256& objid, SidechainWithdrawalBundle& withdrawalBundle)
 {
-    if (ReadSidechain(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, objid), withdrawalBundle))
+    if (!FilterContains(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, objid))
+        return false;
+
+    // Look up the ID if objid is a WithdrawalBundle transaction hash
+    uint256 id = objid;
+    Read(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_TXID, objid), id);
+
+    if (ReadSidechain(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id), withdrawalBundle))
+        return true;
+
+    if (dbArchive.ReadSidechain(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, id), withdrawalBundle))
         return true;
 
     return false;
@@ -431,121 +861,187 @@ bool CSidechainTreeDB::GetWithdrawalBundle(const uint256& objid, SidechainWithdr
 
 bool CSidechainTreeDB::GetDeposit(const uint256& objid, SidechainDeposit& deposit)
 {
+    if (!FilterContains(DB_SIDECHAIN_DEPOSIT_OP, objid))
+        return false;
+
     if (ReadSidechain(std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, objid), deposit))
         return true;
 
+    if (dbArchive.ReadSidechain(std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, objid), deposit))
+        return true;
+
     return false;
 }
 
-std::vector<SidechainWithdrawal> CSidechainTreeDB::GetWithdrawals(const uint8_t& nSidechain)
+namespace {
+
+/** Iterates over the keys of one type of sidechain object in a database */
+class SidechainObjectCursor
 {
-    const char sidechainop = DB_SIDECHAIN_WITHDRAWAL_OP;
-    std::ostringstream ss;
-    ::Serialize(ss, std::make_pair(std::make_pair(sidechainop, nSidechain), uint256()));
+public:
+    SidechainObjectCursor(CDBWrapper& db, char sidechainopIn, const uint256& hashStart) :
+        pcursor(db.NewIterator()), sidechainop(sidechainopIn)
+    {
+        pcursor->Seek(std::make_pair(sidechainop, hashStart));
+        ReadKey();
+    }
 
-    std::vector<SidechainWithdrawal> vWT;
+    bool Valid() const { return fValid; }
+    const uint256& GetHash() const { return hash; }
+    template <typename T> bool GetValue(T& obj) const { return pcursor->GetSidechainValue(obj); }
 
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-    pcursor->Seek(ss.str());
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
+    void Next()
+    {
+        pcursor->Next();
+        ReadKey();
+    }
 
-        std::pair<char, uint256> key;
-        SidechainWithdrawal wt;
-        if (pcursor->GetKey(key) && key.first == sidechainop) {
-            if (pcursor->GetSidechainValue(wt))
-                vWT.push_back(wt);
-        }
+private:
+    std::unique_ptr<CDBIterator> pcursor;
+    const char sidechainop;
+    bool fValid;
+    uint256 hash;
 
-        pcursor->Next();
+    void ReadKey()
+    {
+        std::pair<char, uint256> key;
+        fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == sidechainop;
+        if (fValid)
+            hash = key.second;
     }
+};
 
-    return vWT;
-}
+} // namespace
 
-std::vector<SidechainWithdrawalBundle> CSidechainTreeDB::GetWithdrawalBundles(const uint8_t& nSidechain)
+/**
+ * Read sidechain objects of type T which fInclude accepts from the sidechain
+ * database and, unless pdbArchive is null, the archive database, merged in key
+ * order. Starts after the key (sidechainop, hashAfter) and reads at most
+ * nMaxScan records. An object in both databases, left by an interrupted
+ * archive pass, is read from the sidechain database.
+ */
+template <typename T, typename F>
+static std::vector<T> ListSidechainObjects(CDBWrapper& db, CDBWrapper* pdbArchive, char sidechainop, const uint256& hashAfter, size_t nLimit, F fInclude, uint256& hashNext, size_t nMaxScan)
 {
-    const char sidechainop = DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP;
-    std::ostringstream ss;
-    ::Serialize(ss, std::make_pair(std::make_pair(sidechainop, nSidechain), uint256()));
+    std::vector<T> vObj;
+    uint256 hashLast;
+    uint256 hashLastScanned;
+    size_t nScanned = 0;
+    hashNext.SetNull();
 
-    std::vector<SidechainWithdrawalBundle> vWithdrawalBundle;
+    if (!nLimit)
+        return vObj;
 
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-    pcursor->Seek(ss.str());
-    while (pcursor->Valid()) {
+    SidechainObjectCursor cursor(db, sidechainop, hashAfter);
+    std::unique_ptr<SidechainObjectCursor> pcursorArchive;
+    if (pdbArchive)
+        pcursorArchive.reset(new SidechainObjectCursor(*pdbArchive, sidechainop, hashAfter));
+
+    while (true) {
         boost::this_thread::interruption_point();
 
-        std::pair<char, uint256> key;
-        SidechainWithdrawalBundle withdrawalBundle;
-        if (pcursor->GetKey(key) && key.first == sidechainop) {
-            if (pcursor->GetSidechainValue(withdrawalBundle)) {
-                // Only return the WithdrawalBundle(s) indexed by ID
-                if (key.second == withdrawalBundle.GetID())
-                    vWithdrawalBundle.push_back(withdrawalBundle);
+        // Take the lower key of the two databases
+        bool fArchive = pcursorArchive && pcursorArchive->Valid();
+        if (fArchive && cursor.Valid()) {
+            if (cursor.GetHash() == pcursorArchive->GetHash())
+                pcursorArchive->Next();
+            fArchive = pcursorArchive->Valid() && pcursorArchive->GetHash() < cursor.GetHash();
+        }
+        SidechainObjectCursor& cursorNext = fArchive ? *pcursorArchive : cursor;
+        if (!cursorNext.Valid())
+            break;
+
+        const uint256 hash = cursorNext.GetHash();
+        if (!hashAfter.IsNull() && hash == hashAfter) {
+            cursorNext.Next();
+            continue;
+        }
+
+        // Don't let a filter which skips most records turn one call into a
+        // scan of the whole index, continue after what was read instead
+        if (nScanned == nMaxScan) {
+            hashNext = hashLastScanned;
+            break;
+        }
+        nScanned++;
+        hashLastScanned = hash;
+
+        T obj;
+        if (cursorNext.GetValue(obj) && fInclude(obj)) {
+            // Only set hashNext once we know there is another object
+            if (vObj.size() == nLimit) {
+                hashNext = hashLast;
+                break;
             }
+            vObj.push_back(obj);
+            hashLast = hash;
         }
 
-        pcursor->Next();
+        cursorNext.Next();
     }
-    return vWithdrawalBundle;
+
+    return vObj;
 }
 
-std::vector<SidechainDeposit> CSidechainTreeDB::GetDeposits(const uint8_t& nSidechain)
+std::vector<SidechainWithdrawal> CSidechainTreeDB::ListWithdrawals(const uint256& hashAfter, size_t nLimit, char status, uint256& hashNext, size_t nMaxScan)
 {
-    const char sidechainop = DB_SIDECHAIN_DEPOSIT_OP;
-    std::ostringstream ss;
-    ::Serialize(ss, std::make_pair(std::make_pair(sidechainop, nSidechain), uint256()));
+    return ListSidechainObjects<SidechainWithdrawal>(*this, &dbArchive, DB_SIDECHAIN_WITHDRAWAL_OP, hashAfter, nLimit,
+            [status](const SidechainWithdrawal& wt) { return !status || wt.status == status; }, hashNext, nMaxScan);
+}
 
-    std::vector<SidechainDeposit> vDeposit;
+std::vector<SidechainWithdrawalBundle> CSidechainTreeDB::ListWithdrawalBundles(const uint256& hashAfter, size_t nLimit, char status, uint256& hashNext, size_t nMaxScan)
+{
+    return ListSidechainObjects<SidechainWithdrawalBundle>(*this, &dbArchive, DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, hashAfter, nLimit,
+            [status](const SidechainWithdrawalBundle& bundle) { return !status || bundle.status == status; }, hashNext, nMaxScan);
+}
 
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-    pcursor->Seek(ss.str());
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
+std::vector<SidechainDeposit> CSidechainTreeDB::ListDeposits(const uint256& hashAfter, size_t nLimit, uint256& hashNext, size_t nMaxScan)
+{
+    return ListSidechainObjects<SidechainDeposit>(*this, &dbArchive, DB_SIDECHAIN_DEPOSIT_OP, hashAfter, nLimit,
+            [](const SidechainDeposit& deposit) { return true; }, hashNext, nMaxScan);
+}
 
-        std::pair<char, uint256> key;
-        SidechainDeposit deposit;
-        if (pcursor->GetKey(key) && key.first == sidechainop) {
-            if (pcursor->GetSidechainValue(deposit))
-                // Only return the deposits(s) indexed by ID
-                if (key.second == deposit.GetID())
-                    vDeposit.push_back(deposit);
-        }
+std::vector<SidechainWithdrawal> CSidechainTreeDB::GetWithdrawals(const uint8_t& nSidechain, bool fIncludeArchived)
+{
+    uint256 hashNext;
+    return ListSidechainObjects<SidechainWithdrawal>(*this, fIncludeArchived ? &dbArchive : nullptr, DB_SIDECHAIN_WITHDRAWAL_OP, uint256(),
+            std::numeric_limits<size_t>::max(), [](const SidechainWithdrawal& wt) { return true; }, hashNext, std::numeric_limits<size_t>::max());
+}
 
-        pcursor->Next();
-    }
-    return vDeposit;
+std::vector<SidechainWithdrawalBundle> CSidechainTreeDB::GetWithdrawalBundles(const uint8_t& nSidechain, bool fIncludeArchived)
+{
+    uint256 hashNext;
+    return ListSidechainObjects<SidechainWithdrawalBundle>(*this, fIncludeArchived ? &dbArchive : nullptr, DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, uint256(),
+            std::numeric_limits<size_t>::max(), [](const SidechainWithdrawalBundle& bundle) { return true; }, hashNext, std::numeric_limits<size_t>::max());
 }
 
-bool CSidechainTreeDB::HaveDeposits()
+std::vector<SidechainDeposit> CSidechainTreeDB::GetDeposits(const uint8_t& nSidechain, bool fIncludeArchived)
 {
-    const char sidechainop = DB_SIDECHAIN_DEPOSIT_OP;
-    std::ostringstream ss;
-    ::Serialize(ss, std::make_pair(std::make_pair(sidechainop, DB_SIDECHAIN_DEPOSIT_OP), uint256()));
+    uint256 hashNext;
+    return ListSidechainObjects<SidechainDeposit>(*this, fIncludeArchived ? &dbArchive : nullptr, DB_SIDECHAIN_DEPOSIT_OP, uint256(),
+            std::numeric_limits<size_t>::max(), [](const SidechainDeposit& deposit) { return true; }, hashNext, std::numeric_limits<size_t>::max());
+}
 
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
-    pcursor->Seek(ss.str());
+bool CSidechainTreeDB::HaveDeposits()
+{
+    // Only the key has to be read to know that there is a deposit
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, uint256()));
     if (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
         std::pair<char, uint256> key;
-        SidechainDeposit d;
-        if (pcursor->GetKey(key) && key.first == sidechainop) {
-            if (pcursor->GetSidechainValue(d))
-                return true;
-        }
+        if (pcursor->GetKey(key) && key.first == DB_SIDECHAIN_DEPOSIT_OP)
+            return true;
     }
     return false;
 }
 
 bool CSidechainTreeDB::HaveDepositNonAmount(const uint256& hashNonAmount)
 {
-    SidechainDeposit deposit;
-    if (ReadSidechain(std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, hashNonAmount),
-                deposit))
-        return true;
+    if (!FilterContains(DB_SIDECHAIN_DEPOSIT_OP, hashNonAmount))
+        return false;
 
-    return false;
+    return Exists(std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, hashNonAmount)) ||
+        dbArchive.Exists(std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, hashNonAmount));
 }
 
 bool CSidechainTreeDB::GetLastDeposit(SidechainDeposit& deposit)
@@ -559,6 +1055,9 @@ bool CSidechainTreeDB::GetLastDeposit(SidechainDeposit& deposit)
     if (ReadSidechain(std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, objid), deposit))
         return true;
 
+    if (dbArchive.ReadSidechain(std::make_pair(DB_SIDECHAIN_DEPOSIT_OP, objid), deposit))
+        return true;
+
     return false;
 }
 
@@ -573,11 +1072,209 @@ bool CSidechainTreeDB::GetLastWithdrawalBundleHash(uint256& hash)
 
 bool CSidechainTreeDB::HaveWithdrawalBundle(const uint256& hashWithdrawalBundle) const
 {
-    SidechainWithdrawalBundle withdrawalBundle;
-    if (ReadSidechain(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, hashWithdrawalBundle), withdrawalBundle))
+    if (!FilterContains(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, hashWithdrawalBundle))
+        return false;
+
+    return Exists(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_TXID, hashWithdrawalBundle)) ||
+        Exists(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, hashWithdrawalBundle)) ||
+        dbArchive.Exists(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP, hashWithdrawalBundle));
+}
+
+namespace {
+
+enum class SettledState {
+    //! Missing, or not in a settled state
+    NONE,
+    //! Settled, but kept as the last object of its type
+    LAST,
+    SETTLED,
+};
+
+} // namespace
+
+/**
+ * Read the sidechain object of type T under key from db and check whether it
+ * can be archived. Settled objects are also written to pbatchArchive unless
+ * it is null.
+ */
+template <typename T>
+static SettledState CheckSettledObject(CDBWrapper& db, const std::pair<char, uint256>& key, const uint256& idLast, CDBBatch* pbatchArchive)
+{
+    T obj;
+    if (!db.ReadSidechain(key, obj) || !IsSettledStatus(obj))
+        return SettledState::NONE;
+
+    if (key.second == idLast)
+        return SettledState::LAST;
+
+    if (pbatchArchive)
+        pbatchArchive->Write(key, obj);
+
+    return SettledState::SETTLED;
+}
+
+bool CSidechainTreeDB::ArchiveSettled(int nHeight)
+{
+    if (nArchiveDepth <= 0)
         return true;
 
-    return false;
+    SidechainPerfTimer timer("CSidechainTreeDB::ArchiveSettled");
+
+    // Keep the last deposit & WithdrawalBundle in the sidechain database
+    uint256 hashLastDeposit;
+    Read(DB_LAST_SIDECHAIN_DEPOSIT, hashLastDeposit);
+
+    uint256 hashLastWithdrawalBundle;
+    uint256 idLastWithdrawalBundle;
+    if (Read(DB_LAST_SIDECHAIN_WITHDRAWAL_BUNDLE, hashLastWithdrawalBundle))
+        Read(std::make_pair(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_TXID, hashLastWithdrawalBundle), idLastWithdrawalBundle);
+
+    auto checkSettled = [&](const std::pair<char, uint256>& key, CDBBatch* pbatchArchive) {
+        if (key.first == DB_SIDECHAIN_WITHDRAWAL_OP)
+            return CheckSettledObject<SidechainWithdrawal>(*this, key, uint256(), pbatchArchive);
+        if (key.first == DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP)
+            return CheckSettledObject<SidechainWithdrawalBundle>(*this, key, idLastWithdrawalBundle, pbatchArchive);
+        if (key.first == DB_SIDECHAIN_DEPOSIT_OP)
+            return CheckSettledObject<SidechainDeposit>(*this, key, hashLastDeposit, pbatchArchive);
+        return SettledState::NONE;
+    };
+
+    // Index objects written in a settled state since the last pass by the
+    // height they were first seen settled at. The last deposit &
+    // WithdrawalBundle stay queued until a newer one is written.
+    CDBBatch batchIndex(*this);
+    std::unique_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(std::make_pair(DB_SIDECHAIN_SETTLED_PENDING, std::make_pair('\0', uint256())));
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+
+        std::pair<char, std::pair<char, uint256> > keyPending;
+        if (!pcursor->GetKey(keyPending) || keyPending.first != DB_SIDECHAIN_SETTLED_PENDING)
+            break;
+
+        const std::pair<char, uint256>& key = keyPending.second;
+        SettledState state = checkSettled(key, nullptr);
+        if (state != SettledState::LAST)
+            batchIndex.Erase(keyPending);
+
+        if (state == SettledState::SETTLED) {
+            std::pair<char, uint256> keyHeight = std::make_pair(DB_SIDECHAIN_SETTLED_HEIGHT, key.second);
+            int nSettledHeight;
+            if (!Read(keyHeight, nSettledHeight)) {
+                nSettledHeight = nHeight;
+                batchIndex.Write(keyHeight, nSettledHeight);
+            }
+            batchIndex.Write(SettledIndexEntry(nSettledHeight, key), '1');
+        }
+
+        pcursor->Next();
+    }
+
+    if (!WriteBatch(batchIndex, true))
+        return false;
+
+    // Archive the objects which have been settled for nArchiveDepth blocks,
+    // dropping index entries of objects which were reorged back out of the
+    // settled state
+    CDBBatch batch(*this);
+    CDBBatch batchArchive(dbArchive);
+    size_t nArchived = 0;
+
+    pcursor.reset(NewIterator());
+    pcursor->Seek(SettledIndexEntry());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+
+        SettledIndexEntry entry;
+        if (!pcursor->GetKey(entry) || entry.key != DB_SIDECHAIN_SETTLED_INDEX)
+            break;
+        if ((int)entry.nHeight > nHeight - nArchiveDepth)
+            break;
+
+        SettledState state = checkSettled(entry.obj, &batchArchive);
+        if (state == SettledState::SETTLED) {
+            batch.Erase(entry.obj);
+            nArchived++;
+        }
+        else
+        if (state == SettledState::LAST) {
+            WriteSettledPending(batch, entry.obj);
+        }
+        batch.Erase(entry);
+        batch.Erase(std::make_pair(DB_SIDECHAIN_SETTLED_HEIGHT, entry.obj.second));
+
+        pcursor->Next();
+    }
+
+    // Write the archive first so that an interrupted pass leaves a duplicate
+    // in the archive rather than losing objects
+    if (nArchived && !dbArchive.WriteBatch(batchArchive, true))
+        return false;
+
+    if (!WriteBatch(batch, true))
+        return false;
+
+    // Readers see archived objects too, so listeners don't need to reload
+    if (nArchived)
+        LogPrintf("%s: Archived %u settled sidechain object(s) at height %d\n", __func__, nArchived, nHeight);
+
+    return true;
+}
+
+static void ReadAllRecords(CDBWrapper& db, DBRecordList& vRecord)
+{
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next())
+        vRecord.emplace_back(pcursor->GetKeyBytes(), pcursor->GetValueBytes());
+}
+
+static bool ReplaceAllRecords(CDBWrapper& db, const DBRecordList& vRecord)
+{
+    CDBBatch batch(db);
+
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next())
+        batch.EraseBytes(pcursor->GetKeyBytes());
+
+    for (const auto& record : vRecord)
+        batch.WriteBytes(record.first, record.second);
+
+    return db.WriteBatch(batch, true);
+}
+
+void CSidechainTreeDB::ReadSnapshot(DBRecordList& vRecord, DBRecordList& vArchiveRecord)
+{
+    ReadAllRecords(*this, vRecord);
+    ReadAllRecords(dbArchive, vArchiveRecord);
+}
+
+bool CSidechainTreeDB::LoadSnapshot(const DBRecordList& vRecord, const DBRecordList& vArchiveRecord)
+{
+    if (!ReplaceAllRecords(*this, vRecord))
+        return false;
+    if (!ReplaceAllRecords(dbArchive, vArchiveRecord))
+        return false;
+
+    RebuildFilter(DB_SIDECHAIN_DEPOSIT_OP);
+    RebuildFilter(DB_SIDECHAIN_WITHDRAWAL_BUNDLE_OP);
+
+    GetMainSignals().SidechainDBReloaded();
+
+    return true;
+}
+
+bool CSidechainTreeDB::Unarchive(const std::vector<std::pair<char, uint256> >& vKey)
+{
+    CDBBatch batch(dbArchive);
+    for (const std::pair<char, uint256>& key : vKey) {
+        if (dbArchive.Exists(key))
+            batch.Erase(key);
+    }
+
+    if (batch.SizeEstimate() == 0)
+        return true;
+
+    return dbArchive.WriteBatch(batch, true);
 }
 
 namespace {
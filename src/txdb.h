@@ -6,12 +6,18 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include <bloom.h>
 #include <coins.h>
 #include <dbwrapper.h>
 #include <chain.h>
+#include <sync.h>
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -30,6 +36,8 @@ static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 static const int64_t nDefaultDbCache = 450;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = true;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -42,6 +50,18 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! Minimum number of keys the sidechain tree DB key filters are sized for
+static const unsigned int SIDECHAIN_FILTER_MIN_ELEMENTS = 10000;
+//! False positive rate of the sidechain tree DB key filters
+static const double SIDECHAIN_FILTER_FP_RATE = 0.001;
+//! -sidechainarchive default (0 = don't archive settled sidechain objects)
+static const int DEFAULT_SIDECHAIN_ARCHIVE_DEPTH = 0;
+//! Number of blocks between sidechain archive passes
+static const int SIDECHAIN_ARCHIVE_INTERVAL = 100;
+//! Cache size of the sidechain archive DB (bytes)
+static const size_t SIDECHAIN_ARCHIVE_DB_CACHE = 1 << 20;
+//! Maximum number of records one sidechain list call reads
+static const size_t MAX_SIDECHAIN_LIST_SCAN = 10000;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -73,8 +93,36 @@ class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+private:
+    /** Coins to be written to the database, spent coins are erased */
+    typedef std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> CoinsWriteMap;
+
+    /**
+     * With background writes enabled BatchWrite() takes the modified coins
+     * out of the cache's map and a thread writes them while the caller
+     * continues. Until the write is done reads look at mapPending first, so
+     * the view is always consistent with the last hashBlock handed to it.
+     */
+    bool fBackgroundWrite;
+
+    //! Held while threadWrite is started or joined. Acquire before cs_pending.
+    mutable CCriticalSection cs_write;
+    mutable std::thread threadWrite;
+
+    mutable CCriticalSection cs_pending;
+    CoinsWriteMap mapPending;
+    uint256 hashPending;
+    //! Memory used by mapPending, see PendingMemoryUsage()
+    size_t nPendingUsage;
+    mutable bool fPendingWriteFailed;
+
+    void ThreadWrite(const uint256 hashBlock, const uint256 old_tip);
+    bool WriteCoins(const CoinsWriteMap &mapWrite, const uint256 &hashBlock, const uint256 &old_tip);
+
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
@@ -82,10 +130,22 @@ public:
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
+    //! Cursor starting at the first coin with a txid of at least hashStart, in
+    //! key order (which compares the txid bytes from the lowest one)
+    CCoinsViewCursor *Cursor(const uint256 &hashStart) const;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    //! Write the coins in the background (see -backgroundflush)
+    void SetBackgroundWrite(bool fEnable) { fBackgroundWrite = fEnable; }
+
+    //! Wait until a background write is done. Returns false if it failed.
+    bool WaitForBackgroundWrite() const;
+
+    //! Memory used by the coins that are still being written in the background
+    size_t PendingMemoryUsage() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -126,16 +186,34 @@ public:
     bool ReadReindexing(bool &fReindexing);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
+    //! UTXO set statistics after connecting a block
+    bool WriteCoinsRollingStats(const uint256 &hashBlock, const CCoinsRollingStats &stats);
+    bool ReadCoinsRollingStats(const uint256 &hashBlock, CCoinsRollingStats &stats);
+    bool EraseCoinsRollingStats(const uint256 &hashBlock);
+    //! Erase the UTXO set statistics of all blocks not in setKeep
+    bool PruneCoinsRollingStats(const std::set<uint256> &setKeep);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&, const uint256&)> insertBlockIndex);
 };
 
-/** Access to the sidechain database (blocks/sidechain/) */
+/** Serialized keys & values of database records */
+typedef std::vector<std::pair<std::vector<unsigned char>, std::vector<unsigned char> > > DBRecordList;
+
+/**
+ * Access to the sidechain database (blocks/sidechain/)
+ *
+ * Settled objects (paid out withdrawals, paid out or failed WithdrawalBundle(s)
+ * and deposits other than the last one) can be moved to the archive database
+ * (blocks/sidechainarchive/) nArchiveDepth blocks after they settle so that
+ * scans of the sidechain database only see recent objects. Archived objects
+ * are still returned by ID lookups and list readers, and are moved back when
+ * they are updated.
+ */
 class CSidechainTreeDB : public CDBWrapper
 {
 public:
-    CSidechainTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CSidechainTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, int nArchiveDepthIn = DEFAULT_SIDECHAIN_ARCHIVE_DEPTH);
     bool WriteSidechainIndex(const std::vector<std::pair<uint256, const SidechainObj *> > &list);
     bool WriteWithdrawalUpdate(const std::vector<SidechainWithdrawal>& vWithdrawal);
     bool WriteWithdrawalBundleUpdate(const SidechainWithdrawalBundle& withdrawalBundle);
@@ -151,9 +229,69 @@ public:
 
     bool HaveWithdrawalBundle(const uint256& hashWithdrawalBundle) const;
 
-    std::vector<SidechainWithdrawal> GetWithdrawals(const uint8_t & /* nSidechain */);
-    std::vector<SidechainWithdrawalBundle> GetWithdrawalBundles(const uint8_t & /* nSidechain */);
-    std::vector<SidechainDeposit> GetDeposits(const uint8_t & /* nSidechain */);
+    /**
+     * Read every sidechain object of a type. Archived objects are only
+     * settled ones, callers which look for unsettled objects can leave them
+     * out with fIncludeArchived.
+     */
+    std::vector<SidechainWithdrawal> GetWithdrawals(const uint8_t & /* nSidechain */, bool fIncludeArchived = true);
+    std::vector<SidechainWithdrawalBundle> GetWithdrawalBundles(const uint8_t & /* nSidechain */, bool fIncludeArchived = true);
+    std::vector<SidechainDeposit> GetDeposits(const uint8_t & /* nSidechain */, bool fIncludeArchived = true);
+
+    /**
+     * Page through sidechain objects, archived ones included, in database key
+     * order (by ID), returning at most
+     * nLimit objects with an ID after hashAfter (null to start at the first).
+     * A status of 0 matches any status. hashNext is set to the hashAfter of
+     * the next page, or null if there are no more objects.
+     *
+     * At most nMaxScan records are read per call. If that many are skipped by
+     * the status filter the page ends early, possibly empty, and hashNext
+     * continues after the last record read.
+     */
+    std::vector<SidechainWithdrawal> ListWithdrawals(const uint256& hashAfter, size_t nLimit, char status, uint256& hashNext, size_t nMaxScan = MAX_SIDECHAIN_LIST_SCAN);
+    std::vector<SidechainWithdrawalBundle> ListWithdrawalBundles(const uint256& hashAfter, size_t nLimit, char status, uint256& hashNext, size_t nMaxScan = MAX_SIDECHAIN_LIST_SCAN);
+    std::vector<SidechainDeposit> ListDeposits(const uint256& hashAfter, size_t nLimit, uint256& hashNext, size_t nMaxScan = MAX_SIDECHAIN_LIST_SCAN);
+
+    /**
+     * Archive objects which have been settled for nArchiveDepth blocks at
+     * sidechain height nHeight. Objects written in a settled state are
+     * stamped with the height at which an archive pass first sees them, and
+     * only objects stamped at least nArchiveDepth blocks ago are read.
+     */
+    bool ArchiveSettled(int nHeight);
+
+    /** Read every record of the sidechain database and archive database */
+    void ReadSnapshot(DBRecordList& vRecord, DBRecordList& vArchiveRecord);
+    /** Replace the contents of the sidechain database and archive database */
+    bool LoadSnapshot(const DBRecordList& vRecord, const DBRecordList& vArchiveRecord);
+
+private:
+    //! Archive database for settled objects
+    CDBWrapper dbArchive;
+    //! Number of blocks settled objects are kept before being archived, or 0
+    int nArchiveDepth;
+
+    //! Remove objects which are being written back from the archive
+    bool Unarchive(const std::vector<std::pair<char, uint256> >& vKey);
+
+    //! Guards the key filters
+    mutable CCriticalSection cs_filter;
+    //! Filters of deposit & WithdrawalBundle keys so that existence checks
+    //! for objects which are not in the database don't have to read it
+    std::unique_ptr<CHashBloomFilter> pfilterDeposit;
+    std::unique_ptr<CHashBloomFilter> pfilterWithdrawalBundle;
+
+    //! Upgrade the database layout to SIDECHAIN_DB_VERSION
+    bool Upgrade();
+    //! Rebuild the key filter for sidechainop from the keys in the database
+    void RebuildFilter(char sidechainop);
+    //! Add a key to the key filter for sidechainop
+    void AddToFilter(char sidechainop, const uint256& hash);
+    //! Rebuild key filters which have more keys than they were sized for
+    void RebuildFullFilters();
+    //! False if the key is definitely not in the database
+    bool FilterContains(char sidechainop, const uint256& hash) const;
 };
 
 #endif // BITCOIN_TXDB_H
@@ -34,6 +34,7 @@
 #include <script/sigcache.h>
 #include <script/standard.h>
 #include <sidechainclient.h>
+#include <sidechainperf.h>
 #include <timedata.h>
 #include <tinyformat.h>
 #include <txdb.h>
@@ -151,6 +152,13 @@ private:
       */
     std::set<CBlockIndex*> g_failed_blocks;
 
+    /**
+     * ActivateBestChain() releases cs_main between its steps. This keeps a
+     * second caller, such as another message handler thread, from connecting
+     * blocks in between, so tip changes and their notifications stay in order.
+     */
+    CCriticalSection m_cs_chainstate;
+
 public:
     CChain chainActive;
     BlockMap mapBlockIndex;
@@ -166,9 +174,10 @@ public:
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock);
 
     // Block (dis)connection on a given view:
-    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
+    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CCoinsRollingStats* pstats = nullptr);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, bool fCheckBMM = true);
+                    CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, bool fCheckBMM = true,
+                    CCoinsRollingStats* pstats = nullptr);
 
     // Block disconnection on our pcoinsTip:
     bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool);
@@ -176,6 +185,7 @@ public:
     // Manual block validity manipulation:
     bool PreciousBlock(CValidationState& state, const CChainParams& params, CBlockIndex *pindex);
     bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, CBlockIndex *pindex);
+    bool InvalidateBlocks(CValidationState& state, const CChainParams& chainparams, const std::vector<CBlockIndex*>& vIndex);
     bool ResetBlockFailureFlags(CBlockIndex *pindex);
 
     bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
@@ -184,6 +194,9 @@ public:
 
     void PruneBlockIndexCandidates();
 
+    /** Make pindex the tip without connecting blocks, after loading a state snapshot */
+    void SetSnapshotTip(CBlockIndex* pindex);
+
     void UnloadBlockIndex();
 
 private:
@@ -209,6 +222,8 @@ CCriticalSection cs_main;
 
 BMMCache bmmCache;
 
+static BMMCacheJournal bmmJournal;
+
 BlockMap& mapBlockIndex = g_chainstate.mapBlockIndex;
 std::map<uint256, CBlockIndex*>& mapBlockMainHashIndex = g_chainstate.mapBlockMainHashIndex;
 CChain& chainActive = g_chainstate.chainActive;
@@ -218,12 +233,16 @@ CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
+std::atomic<uint64_t> nMempoolParallelScriptChecks(0);
 bool fTxIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
+bool fHaveSnapshotChain = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
+bool fPrefetchInputs = DEFAULT_PREFETCH_INPUTS;
+bool fCoinsRollingStatsEnabled = DEFAULT_COINS_ROLLING_STATS;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -296,6 +315,10 @@ std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 std::unique_ptr<CSidechainTreeDB> psidechaintree;
 
+/** UTXO set statistics of the chain tip, kept up to date by ConnectTip and DisconnectTip once loaded */
+static CCoinsRollingStats coinsRollingStats;
+static bool fCoinsRollingStats = false;
+
 enum FlushStateMode {
     FLUSH_STATE_NONE,
     FLUSH_STATE_IF_NEEDED,
@@ -520,6 +543,34 @@ void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool, bool f
     LimitMempoolSize(mempool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
 }
 
+static bool RunScriptChecks(std::vector<CScriptCheck>& vChecks, CScriptCheck* pcheckFailed = nullptr);
+static bool ScriptCheckFailed(CValidationState &state, const CTransaction& tx, const CTxOut& out, unsigned int nIn,
+                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata, ScriptError error);
+
+/**
+ * CheckInputs for a transaction entering the mempool. The scripts of a
+ * transaction with many inputs are verified by the script check threads,
+ * with the calling thread joining in, instead of one after the other. If
+ * any of them fails, the reject reason is worked out from the first input
+ * which failed, as it is when they are checked one after the other.
+ */
+static bool CheckInputsForMempool(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view,
+                 unsigned int flags, PrecomputedTransactionData& txdata) {
+    if (!nScriptCheckThreads || tx.vin.size() < MEMPOOL_PARALLEL_SCRIPT_CHECK_INPUTS)
+        return CheckInputs(tx, state, view, true, flags, true, false, txdata);
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, view, true, flags, true, false, txdata, &vChecks))
+        return false;
+    nMempoolParallelScriptChecks++;
+    CScriptCheck checkFailed;
+    if (RunScriptChecks(vChecks, &checkFailed))
+        return true;
+    const unsigned int nIn = checkFailed.GetInputIndex();
+    const Coin& coin = view.AccessCoin(tx.vin[nIn].prevout);
+    return ScriptCheckFailed(state, tx, coin.out, nIn, flags, true, txdata, checkFailed.GetScriptError());
+}
+
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
 // were somehow broken and returning the wrong scriptPubKeys
 static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, CTxMemPool& pool,
@@ -969,7 +1020,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
+        if (!CheckInputsForMempool(tx, state, view, scriptVerifyFlags, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
@@ -1395,6 +1446,35 @@ void InitScriptExecutionCache() {
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+/**
+ * Sets the reject reason for input nIn of tx, whose script failed with error
+ * under flags. Always returns false.
+ */
+static bool ScriptCheckFailed(CValidationState &state, const CTransaction& tx, const CTxOut& out, unsigned int nIn,
+                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata, ScriptError error)
+{
+    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+        // Check whether the failure was caused by a
+        // non-mandatory script verification check, such as
+        // non-standard DER encodings or non-null dummy
+        // arguments; if so, don't trigger DoS protection to
+        // avoid splitting the network between upgraded and
+        // non-upgraded nodes.
+        CScriptCheck check2(out, tx, nIn,
+                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
+        if (check2())
+            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(error)));
+    }
+    // Failures of other flags indicate a transaction that is
+    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
+    // such nodes as they are not following the protocol. That
+    // said during an upgrade careful thought should be taken
+    // as to the correct behavior - we may want to continue
+    // peering with non-upgraded nodes even after soft-fork
+    // super-majority signaling has occurred.
+    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(error)));
+}
+
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set.
@@ -1458,26 +1538,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
                 } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check2(coin.out, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
-                        if (check2())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. an invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after soft-fork
-                    // super-majority signaling has occurred.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+                    return ScriptCheckFailed(state, tx, coin.out, i, flags, cacheSigStore, txdata, check.GetScriptError());
                 }
             }
 
@@ -1606,9 +1667,10 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-/** Undo the effects of this block (with given index) on the UTXO set represented by coins.
+/** Undo the effects of this block (with given index) on the UTXO set represented by coins,
+ *  and on pstats if given.
  *  When FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CCoinsRollingStats* pstats)
 {
     bool fClean = true;
 
@@ -1642,6 +1704,8 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || is_coinbase != coin.fCoinBase) {
                     fClean = false; // transaction output mismatch
                 }
+                if (pstats && is_spent)
+                    pstats->RemoveCoin(out, coin);
             }
 
             // If this output is a withdrawal bundle database entry, reset the
@@ -1743,6 +1807,8 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
+                if (pstats)
+                    pstats->AddCoin(out, view.AccessCoin(out));
             }
             // At this point, all of txundo.vprevout should have been moved out.
         }
@@ -1828,6 +1894,120 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static bool RunScriptChecks(std::vector<CScriptCheck>& vChecks, CScriptCheck* pcheckFailed)
+{
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    return control.Wait(pcheckFailed);
+}
+
+/**
+ * Reads a range of input coins from the coins database. Read errors are left
+ * for the block connection to hit again through pcoinsTip, whose base view
+ * shuts the node down on them; a worker thread can't handle them.
+ */
+class CInputPrefetch
+{
+private:
+    const std::vector<COutPoint>* pvOutPoint;
+    size_t nBegin;
+    size_t nEnd;
+    std::vector<std::pair<COutPoint, Coin> >* pvCoin;
+
+public:
+    CInputPrefetch(): pvOutPoint(nullptr), nBegin(0), nEnd(0), pvCoin(nullptr) {}
+    CInputPrefetch(const std::vector<COutPoint>* pvOutPointIn, size_t nBeginIn, size_t nEndIn, std::vector<std::pair<COutPoint, Coin> >* pvCoinIn) :
+        pvOutPoint(pvOutPointIn), nBegin(nBeginIn), nEnd(nEndIn), pvCoin(pvCoinIn) {}
+
+    bool operator()() {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            const COutPoint& outpoint = (*pvOutPoint)[i];
+            Coin coin;
+            try {
+                if (!pcoinsdbview->GetCoin(outpoint, coin))
+                    continue;
+            } catch (const std::runtime_error&) {
+                continue;
+            }
+            pvCoin->emplace_back(outpoint, std::move(coin));
+        }
+        return true;
+    }
+
+    void swap(CInputPrefetch& prefetch) {
+        std::swap(pvOutPoint, prefetch.pvOutPoint);
+        std::swap(nBegin, prefetch.nBegin);
+        std::swap(nEnd, prefetch.nEnd);
+        std::swap(pvCoin, prefetch.pvCoin);
+    }
+};
+
+/**
+ * A queue of its own rather than scriptcheckqueue, as a CCheckQueue runs one
+ * type of job. Its threads sleep on the queue's condition variable except
+ * while PrefetchInputs() runs, which is before the script checks of the same
+ * block are queued, so the two pools don't compete for cores. The reads mostly
+ * wait on disk, which is why they use as many threads as script checking.
+ */
+static CCheckQueue<CInputPrefetch> inputprefetchqueue(128);
+
+void ThreadInputPrefetch() {
+    RenameThread("bitcoin-prefetch");
+    inputprefetchqueue.Thread();
+}
+
+/**
+ * Read the input coins of a block which aren't in the coins cache yet from
+ * the coins database on the prefetch threads, so that connecting the block
+ * doesn't have to read them one at a time.
+ */
+static void PrefetchInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+
+    if (!fPrefetchInputs || !nScriptCheckThreads)
+        return;
+
+    // Outputs created by the block itself aren't in the database
+    std::set<uint256> setBlockTx;
+    for (const auto& tx : block.vtx)
+        setBlockTx.insert(tx->GetHash());
+
+    std::vector<COutPoint> vOutPoint;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (setBlockTx.count(txin.prevout.hash) || pcoinsTip->HaveCoinInCache(txin.prevout))
+                continue;
+            vOutPoint.push_back(txin.prevout);
+        }
+    }
+    if (vOutPoint.empty())
+        return;
+
+    // Each job writes to its own vector, allocated before any job starts
+    size_t nJobs = (vOutPoint.size() + INPUT_PREFETCH_BATCH_SIZE - 1) / INPUT_PREFETCH_BATCH_SIZE;
+    std::vector<std::vector<std::pair<COutPoint, Coin> > > vCoin(nJobs);
+
+    CCheckQueueControl<CInputPrefetch> control(&inputprefetchqueue);
+    std::vector<CInputPrefetch> vPrefetch;
+    vPrefetch.reserve(nJobs);
+    for (size_t i = 0; i < nJobs; i++) {
+        size_t nBegin = i * INPUT_PREFETCH_BATCH_SIZE;
+        size_t nEnd = std::min(nBegin + INPUT_PREFETCH_BATCH_SIZE, vOutPoint.size());
+        vCoin[i].reserve(nEnd - nBegin);
+        vPrefetch.emplace_back(&vOutPoint, nBegin, nEnd, &vCoin[i]);
+    }
+    control.Add(vPrefetch);
+    control.Wait();
+
+    for (auto& v : vCoin) {
+        for (auto& it : v)
+            pcoinsTip->PrefetchCoin(it.first, std::move(it.second));
+    }
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1922,7 +2102,8 @@ static int64_t nBlocksTotal = 0;
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, bool fCheckBMM)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, bool fCheckBMM,
+                  CCoinsRollingStats* pstats)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -2313,7 +2494,12 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             // If we haven't broadcasted the latest bundle yet, do it now
             if (!bmmCache.HaveBroadcastedWithdrawalBundle(hashLatestWithdrawalBundle)) {
                 std::string strHex = EncodeHexTx(withdrawalBundleLatest.tx);
-                if (client.BroadcastWithdrawalBundle(strHex)) {
+                bool fBroadcast = false;
+                {
+                    SidechainPerfTimer timer(SIDECHAIN_PERF_CS_MAIN_WAIT);
+                    fBroadcast = client.BroadcastWithdrawalBundle(strHex);
+                }
+                if (fBroadcast) {
                     bmmCache.StoreBroadcastedWithdrawalBundle(hashLatestWithdrawalBundle);
                 }
             }
@@ -2373,9 +2559,13 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             if (fFailCommit || scriptPubKey.IsWithdrawalBundleSpentCommit(hashWithdrawalBundle)) {
                 // Verify with the mainchain when we are also checking BMM
                 if (fCheckBMM) {
-                    bool fVerified = fFailCommit ?
-                        client.HaveFailedWithdrawalBundle(hashWithdrawalBundle) :
-                        client.HaveSpentWithdrawalBundle(hashWithdrawalBundle);
+                    bool fVerified = false;
+                    {
+                        SidechainPerfTimer timer(SIDECHAIN_PERF_CS_MAIN_WAIT);
+                        fVerified = fFailCommit ?
+                            client.HaveFailedWithdrawalBundle(hashWithdrawalBundle) :
+                            client.HaveSpentWithdrawalBundle(hashWithdrawalBundle);
+                    }
 
                     if (!fVerified)
                         return state.Error(strprintf("%s: Invalid Withdrawal Bundle update : %s - %s!\n",
@@ -2526,6 +2716,26 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             for (size_t i = 0; i < vSidechainObjects.size(); i++)
                 delete vSidechainObjects[i].second;
         }
+
+        // Move settled sidechain objects to the archive every so often
+        if (pindex->nHeight % SIDECHAIN_ARCHIVE_INTERVAL == 0 && !psidechaintree->ArchiveSettled(pindex->nHeight))
+            return state.Error("Failed to archive settled sidechain objects!");
+    }
+
+    if (pstats) {
+        // Apply the coins spent & created by the block to the UTXO set statistics
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *block.vtx[i];
+            if (i > 0) {
+                const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+                for (size_t j = 0; j < tx.vin.size(); j++)
+                    pstats->RemoveCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+            }
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (!tx.vout[o].scriptPubKey.IsUnspendable())
+                    pstats->AddCoin(COutPoint(tx.GetHash(), o), Coin(tx.vout[o], pindex->nHeight, tx.IsCoinBase()));
+            }
+        }
     }
 
     assert(pindex->phashBlock);
@@ -2587,8 +2797,18 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             nLastSetChain = nNow;
         }
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
+        // Coins that are still being written in the background count against
+        // the cache as well. If they alone push us over the limit, wait for
+        // the write to release them rather than dropping the cache.
+        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        int64_t nPendingSize = pcoinsdbview->PendingMemoryUsage();
+        if (mode == FLUSH_STATE_IF_NEEDED && nPendingSize > 0 && cacheSize + nPendingSize > nTotalSpace) {
+            if (!pcoinsdbview->WaitForBackgroundWrite())
+                return AbortNode(state, "Failed to write to coin database");
+            nPendingSize = pcoinsdbview->PendingMemoryUsage();
+        }
+        cacheSize += nPendingSize;
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
         // The cache is over the limit, we have to write now.
@@ -2627,6 +2847,9 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // Finally remove any pruned files
             if (fFlushForPrune)
                 UnlinkPrunedFiles(setFilesToPrune);
+            // Compact the BMM cache journal into the BMM cache files
+            if (bmmJournal.GetEntryCount() >= BMM_JOURNAL_COMPACT_ENTRIES)
+                CompactBMMCacheJournal();
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2639,7 +2862,17 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Keep the cached coins so that validation continues with a warm
+            // cache, and when we need the memory only evict enough of them
+            // to get back under 3/4 of the limit, leaving room for the
+            // coins still being written.
+            if (!pcoinsTip->Sync())
+                return AbortNode(state, "Failed to write to coin database");
+            if (fCacheLarge || fCacheCritical)
+                pcoinsTip->Trim(std::max<int64_t>((3 * nTotalSpace) / 4 - (int64_t)pcoinsdbview->PendingMemoryUsage(), 0));
+            // The coins database may still be written in the background,
+            // callers of FLUSH_STATE_ALWAYS and pruning need it on disk now.
+            if ((mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsdbview->WaitForBackgroundWrite())
                 return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
@@ -2754,11 +2987,15 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     {
         CCoinsViewCache view(pcoinsTip.get());
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        CCoinsRollingStats stats = coinsRollingStats;
+        if (DisconnectBlock(block, pindexDelete, view, fCoinsRollingStats ? &stats : nullptr) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
+        coinsRollingStats = stats;
     }
+    if (fCoinsRollingStats && !pblocktree->EraseCoinsRollingStats(pindexDelete->GetBlockHash()))
+        return AbortNode(state, "Failed to erase UTXO set statistics");
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED))
@@ -2787,6 +3024,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2882,9 +3120,14 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    PrefetchInputs(blockConnecting);
+    int64_t nTimePrefetchStart = nTime2;
+    nTime2 = GetTimeMicros(); nTimePrefetch += nTime2 - nTimePrefetchStart;
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTime2 - nTimePrefetchStart) * MILLI, nTimePrefetch * MICRO);
     {
         CCoinsViewCache view(pcoinsTip.get());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        CCoinsRollingStats stats = coinsRollingStats;
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, true, fCoinsRollingStats ? &stats : nullptr);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2895,6 +3138,17 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
         bool flushed = view.Flush();
         assert(flushed);
+        if (fCoinsRollingStats) {
+            coinsRollingStats = stats;
+            if (!pblocktree->WriteCoinsRollingStats(pindexNew->GetBlockHash(), stats))
+                return AbortNode(state, "Failed to write UTXO set statistics");
+            // Statistics are only kept for the last COINS_ROLLING_STATS_WINDOW blocks
+            if (pindexNew->nHeight >= (int)COINS_ROLLING_STATS_WINDOW) {
+                const CBlockIndex* pindexExpired = pindexNew->GetAncestor(pindexNew->nHeight - COINS_ROLLING_STATS_WINDOW);
+                if (!pblocktree->EraseCoinsRollingStats(pindexExpired->GetBlockHash()))
+                    return AbortNode(state, "Failed to erase UTXO set statistics");
+            }
+        }
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime4 - nTime3) * MILLI, nTimeFlush * MICRO, nTimeFlush * MILLI / nBlocksTotal);
@@ -3106,6 +3360,9 @@ bool CChainState::ActivateBestChain(CValidationState &state, const CChainParams&
     // sanely for performance or correctness!
     AssertLockNotHeld(cs_main);
 
+    // Only one caller at a time, see m_cs_chainstate
+    LOCK(m_cs_chainstate);
+
     CBlockIndex *pindexMostWork = nullptr;
     CBlockIndex *pindexNewTip = nullptr;
     int nStopAtHeight = gArgs.GetArg("-stopatheight", DEFAULT_STOPATHEIGHT);
@@ -3195,6 +3452,11 @@ bool PreciousBlock(CValidationState& state, const CChainParams& params, CBlockIn
 }
 
 bool CChainState::InvalidateBlock(CValidationState& state, const CChainParams& chainparams, CBlockIndex *pindex)
+{
+    return InvalidateBlocks(state, chainparams, std::vector<CBlockIndex*>{ pindex });
+}
+
+bool CChainState::InvalidateBlocks(CValidationState& state, const CChainParams& chainparams, const std::vector<CBlockIndex*>& vIndex)
 {
     AssertLockHeld(cs_main);
 
@@ -3204,12 +3466,18 @@ bool CChainState::InvalidateBlock(CValidationState& state, const CChainParams& c
     // are no blocks that meet the "have data and are not invalid per
     // nStatus" criteria for inclusion in setBlockIndexCandidates).
 
-    bool pindex_was_in_chain = false;
+    // Only the deepest of the blocks in chainActive has to be disconnected,
+    // which disconnects the others as well.
+    CBlockIndex *pindexDeepest = nullptr;
+    for (CBlockIndex *pindex : vIndex) {
+        if (chainActive.Contains(pindex) && (!pindexDeepest || pindex->nHeight < pindexDeepest->nHeight))
+            pindexDeepest = pindex;
+    }
+
     CBlockIndex *invalid_walk_tip = chainActive.Tip();
 
     DisconnectedBlockTransactions disconnectpool;
-    while (chainActive.Contains(pindex)) {
-        pindex_was_in_chain = true;
+    while (pindexDeepest && chainActive.Contains(pindexDeepest)) {
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
         if (!DisconnectTip(state, chainparams, &disconnectpool)) {
@@ -3222,18 +3490,20 @@ bool CChainState::InvalidateBlock(CValidationState& state, const CChainParams& c
 
     // Now mark the blocks we just disconnected as descendants invalid
     // (note this may not be all descendants).
-    while (pindex_was_in_chain && invalid_walk_tip != pindex) {
+    while (pindexDeepest && invalid_walk_tip != pindexDeepest) {
         invalid_walk_tip->nStatus |= BLOCK_FAILED_CHILD;
         setDirtyBlockIndex.insert(invalid_walk_tip);
         setBlockIndexCandidates.erase(invalid_walk_tip);
         invalid_walk_tip = invalid_walk_tip->pprev;
     }
 
-    // Mark the block itself as invalid.
-    pindex->nStatus |= BLOCK_FAILED_VALID;
-    setDirtyBlockIndex.insert(pindex);
-    setBlockIndexCandidates.erase(pindex);
-    g_failed_blocks.insert(pindex);
+    // Mark the blocks themselves as invalid.
+    for (CBlockIndex *pindex : vIndex) {
+        pindex->nStatus |= BLOCK_FAILED_VALID;
+        setDirtyBlockIndex.insert(pindex);
+        setBlockIndexCandidates.erase(pindex);
+        g_failed_blocks.insert(pindex);
+    }
 
     // DisconnectTip will add transactions to disconnectpool; try to add these
     // back to the mempool.
@@ -3249,13 +3519,17 @@ bool CChainState::InvalidateBlock(CValidationState& state, const CChainParams& c
         it++;
     }
 
-    InvalidChainFound(pindex);
-    uiInterface.NotifyBlockTip(IsInitialBlockDownload(), pindex->pprev);
+    for (CBlockIndex *pindex : vIndex)
+        InvalidChainFound(pindex);
+    uiInterface.NotifyBlockTip(IsInitialBlockDownload(), chainActive.Tip());
     return true;
 }
 bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, CBlockIndex *pindex) {
     return g_chainstate.InvalidateBlock(state, chainparams, pindex);
 }
+bool InvalidateBlocks(CValidationState& state, const CChainParams& chainparams, const std::vector<CBlockIndex*>& vIndex) {
+    return g_chainstate.InvalidateBlocks(state, chainparams, vIndex);
+}
 
 bool CChainState::ResetBlockFailureFlags(CBlockIndex *pindex) {
     AssertLockHeld(cs_main);
@@ -3472,7 +3746,7 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckMerkleRoot, bool fCheckBMM)
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckMerkleRoot, bool fCheckBMM, bool fCsMainHeld)
 {
     // These are checks that are independent of context.
 
@@ -3518,7 +3792,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
     // Verify BMM with mainchain
-    if (fCheckBMM && !VerifyBMM(block))
+    if (fCheckBMM && !VerifyBMM(block, fCsMainHeld))
         return state.DoS(1, false, REJECT_INVALID, "bad-bmm", true, "invalid bmm / failed to verify BMM for block");
 
     if (!fGenesis && fCheckBMM) {
@@ -3548,6 +3822,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Find deposits and verify that they exist with mainchain
     if (fCheckBMM) {
+        SidechainPerfTimer timer("CheckBlock deposit validation");
+
         for (const CTxOut& out : block.vtx[0]->vout) {
             const CScript& scriptPubKey = out.scriptPubKey;
 
@@ -3594,14 +3870,16 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     return true;
 }
 
-bool VerifyBMM(const CBlock& block)
+bool VerifyBMM(const CBlock& block, bool fCsMainHeld)
 {
     // Skip genesis block
     if (block.GetHash() == Params().GetConsensus().hashGenesisBlock)
         return true;
 
     // Have we already verified BMM for this block?
-    if (bmmCache.HaveVerifiedBMM(block.GetHash()))
+    bool fCached = bmmCache.HaveVerifiedBMM(block.GetHash());
+    RecordSidechainCacheLookup("verified BMM", fCached);
+    if (fCached)
         return true;
 
     // h*
@@ -3614,7 +3892,11 @@ bool VerifyBMM(const CBlock& block)
     uint256 txid;
     uint32_t nTime;
     SidechainClient client;
-    if (!client.VerifyBMM(block.hashMainchainBlock, hashMerkleRoot, txid, nTime)) {
+    int64_t nTimeStart = GetTimeMicros();
+    bool fVerified = client.VerifyBMM(block.hashMainchainBlock, hashMerkleRoot, txid, nTime);
+    if (fCsMainHeld)
+        RecordSidechainTiming(SIDECHAIN_PERF_CS_MAIN_WAIT, GetTimeMicros() - nTimeStart);
+    if (!fVerified) {
         LogPrintf("%s: Did not find BMM h*: %s in mainchain block: %s!\n", __func__, hashMerkleRoot.ToString(), block.hashMainchainBlock.ToString());
         return false;
     }
@@ -3635,7 +3917,9 @@ bool VerifyDeposit(const uint256& hashMainBlock, const uint256& txid, const int
     }
 
     // Have we already verified the deposit?
-    if (bmmCache.HaveVerifiedDeposit(txid))
+    bool fCached = bmmCache.HaveVerifiedDeposit(txid);
+    RecordSidechainCacheLookup("verified deposit", fCached);
+    if (fCached)
         return true;
 
     SidechainClient client;
@@ -4254,7 +4538,7 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         CValidationState state;
         // Ensure that CheckBlock() passes before calling AcceptBlock, as
         // belt-and-suspenders.
-        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
+        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus(), true, true, false /* fCsMainHeld */);
 
         LOCK(cs_main);
 
@@ -4624,6 +4908,11 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the chainstate was loaded from a sidechain state snapshot
+    pblocktree->ReadFlag("sidechainsnapshot", fHaveSnapshotChain);
+    if (fHaveSnapshotChain)
+        LogPrintf("LoadBlockIndexDB(): Chainstate was loaded from a snapshot\n");
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -4705,9 +4994,9 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
-            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+        if ((fPruneMode || fHaveSnapshotChain) && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning or below a snapshot, only go back as far as we have data.
+            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning or snapshot, no data)\n", pindex->nHeight);
             break;
         }
         CBlock block;
@@ -4997,6 +5286,7 @@ void UnloadBlockIndex()
     mapBlockIndex.clear();
     mapBlockMainHashIndex.clear();
     fHavePruned = false;
+    fHaveSnapshotChain = false;
 
     g_chainstate.UnloadBlockIndex();
 }
@@ -5235,8 +5525,9 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         }
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId <= 0);  // nSequenceId can't be set positive for blocks that aren't linked (negative is used for preciousblock)
         // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
-        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        if (!fHavePruned) {
+        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred
+        // and no snapshot was loaded.
+        if (!fHavePruned && !fHaveSnapshotChain) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
             assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
             assert(pindexFirstMissing == pindexFirstNeverProcessed);
@@ -5294,7 +5585,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindexFirstMissing == nullptr) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
         if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == nullptr && pindexFirstMissing != nullptr) {
             // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
-            assert(fHavePruned); // We must have pruned.
+            assert(fHavePruned || fHaveSnapshotChain); // We must have pruned or loaded a snapshot.
             // This block may have entered mapBlocksUnlinked if:
             //  - it has a descendant that at some point had more work than the
             //    tip, and
@@ -5573,11 +5864,11 @@ void LoadBMMCache()
     }
 }
 
-void DumpBMMCache()
+bool DumpBMMCache(const BMMCacheSnapshot& snapshot)
 {
-    std::vector<uint256> vHashWithdrawal = bmmCache.GetBroadcastedWithdrawalBundleCache();
-    std::vector<uint256> vHashBMM = bmmCache.GetVerifiedBMMCache();
-    std::vector<uint256> vDepositTXID = bmmCache.GetVerifiedDepositCache();
+    const std::vector<uint256>& vHashWithdrawal = snapshot.vBroadcastedWithdrawalBundle;
+    const std::vector<uint256>& vHashBMM = snapshot.vVerifiedBMM;
+    const std::vector<uint256>& vDepositTXID = snapshot.vVerifiedDeposit;
 
     int nWithdrawal = vHashWithdrawal.size();
     int nBMM = vHashBMM.size();
@@ -5586,7 +5877,7 @@ void DumpBMMCache()
     fs::path path = GetDataDir() / "bmm.dat.new";
     CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull()) {
-        return;
+        return false;
     }
 
     try {
@@ -5613,7 +5904,7 @@ void DumpBMMCache()
     }
     catch (const std::exception& e) {
         LogPrintf("%s: Error writing BMM cache: %s", __func__, e.what());
-        return;
+        return false;
     }
 
     FileCommit(fileout.Get());
@@ -5621,6 +5912,8 @@ void DumpBMMCache()
     RenameOver(GetDataDir() / "bmm.dat.new", GetDataDir() / "bmm.dat");
 
     LogPrintf("%s: Wrote BMM cache.\n", __func__);
+
+    return true;
 }
 
 void LoadMainBlockCache()
@@ -5657,18 +5950,18 @@ void LoadMainBlockCache()
         bmmCache.CacheMainBlockHash(u);
 }
 
-void DumpMainBlockCache()
+bool DumpMainBlockCache(const BMMCacheSnapshot& snapshot)
 {
-    std::vector<uint256> vHash = bmmCache.GetMainBlockHashCache();
-    if (vHash.empty())
-        return;
+    // An empty cache is written as well, so that a reset cache does not come
+    // back from an older file after the journal has been compacted
+    const std::vector<uint256>& vHash = snapshot.vMainBlockHash;
 
     int count = vHash.size();
 
     fs::path path = GetDataDir() / "mainblockhash.dat.new";
     CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull()) {
-        return;
+        return false;
     }
 
     try {
@@ -5682,7 +5975,7 @@ void DumpMainBlockCache()
     }
     catch (const std::exception& e) {
         LogPrintf("%s: Error writing main block cache: %s", __func__, e.what());
-        return;
+        return false;
     }
 
     FileCommit(fileout.Get());
@@ -5690,20 +5983,21 @@ void DumpMainBlockCache()
     RenameOver(GetDataDir() / "mainblockhash.dat.new", GetDataDir() / "mainblockhash.dat");
 
     LogPrintf("%s: Wrote %u\n", __func__, count);
+
+    return true;
 }
 
-void DumpWithdrawalIDCache()
+bool DumpWithdrawalIDCache(const BMMCacheSnapshot& snapshot)
 {
-    std::set<uint256> setWithdrawalID = bmmCache.GetCachedWithdrawalID();
-    if (setWithdrawalID.empty())
-        return;
+    // An empty cache is written as well, see DumpMainBlockCache()
+    const std::set<uint256>& setWithdrawalID = snapshot.setWithdrawalID;
 
     int count = setWithdrawalID.size();
 
     fs::path path = GetDataDir() / "withdrawalid.dat.new";
     CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull()) {
-        return;
+        return false;
     }
 
     try {
@@ -5717,7 +6011,7 @@ void DumpWithdrawalIDCache()
     }
     catch (const std::exception& e) {
         LogPrintf("%s: Error writing Withdrawal ID cache: %s", __func__, e.what());
-        return;
+        return false;
     }
 
     FileCommit(fileout.Get());
@@ -5725,6 +6019,8 @@ void DumpWithdrawalIDCache()
     RenameOver(GetDataDir() / "withdrawalid.dat.new", GetDataDir() / "withdrawalid.dat");
 
     LogPrintf("%s: Wrote %u\n", __func__, count);
+
+    return true;
 }
 
 void LoadWithdrawalIDCache()
@@ -5761,9 +6057,509 @@ void LoadWithdrawalIDCache()
         bmmCache.CacheWithdrawalID(u);
 }
 
+void LoadBMMCacheJournal()
+{
+    fs::path path = GetDataDir() / "bmmjournal.dat";
+
+    // Apply changes which were not compacted into the cache files because we
+    // did not shut down cleanly
+    size_t nApplied = BMMCacheJournal::Replay(path, bmmCache);
+    if (nApplied)
+        LogPrintf("%s: Replayed %u BMM cache journal entries\n", __func__, nApplied);
+
+    // Anything left in the journal, including a torn or corrupt entry that
+    // stopped the replay, has to go before we append to it. Entries written
+    // after garbage would never be replayed.
+    bool fCompact = fs::exists(path) && fs::file_size(path) != 0;
+
+    if (!bmmJournal.Open(path))
+        return;
+
+    bmmCache.SetJournal(&bmmJournal);
+
+    if (fCompact && !CompactBMMCacheJournal())
+        LogPrintf("%s: Failed to compact BMM cache journal\n", __func__);
+}
+
+bool CompactBMMCacheJournal()
+{
+    // Copy the caches together with the number of journal entries the copy
+    // covers. Entries appended while we are writing stay in the journal.
+    BMMCacheSnapshot snapshot;
+    size_t nEntries = bmmCache.GetPersistedCaches(snapshot);
+
+    bool fBMM = DumpBMMCache(snapshot);
+    bool fWithdrawalID = DumpWithdrawalIDCache(snapshot);
+    bool fMainBlock = DumpMainBlockCache(snapshot);
+
+    // Keep the journal unless everything it covers has been written
+    if (!fBMM || !fWithdrawalID || !fMainBlock)
+        return false;
+
+    if (!bmmJournal.IsOpen())
+        return true;
+
+    return bmmJournal.Reset(nEntries);
+}
+
+void CloseBMMCacheJournal()
+{
+    bmmCache.SetJournal(nullptr);
+    bmmJournal.Close();
+}
+
+bool LoadCoinsRollingStats(bool fForceScan)
+{
+    LOCK(cs_main);
+
+    fCoinsRollingStats = false;
+    coinsRollingStats = CCoinsRollingStats();
+
+    // Erase statistics of blocks which left the window or the active chain
+    // while we weren't maintaining them
+    std::set<uint256> setKeep;
+    if (fCoinsRollingStatsEnabled) {
+        for (const CBlockIndex* pindex = chainActive.Tip(); pindex && setKeep.size() < COINS_ROLLING_STATS_WINDOW; pindex = pindex->pprev)
+            setKeep.insert(pindex->GetBlockHash());
+    }
+    if (!pblocktree->PruneCoinsRollingStats(setKeep))
+        return error("%s: failed to erase UTXO set statistics", __func__);
+
+    if (!fCoinsRollingStatsEnabled)
+        return true;
+
+    const uint256 hashBlock = pcoinsTip->GetBestBlock();
+    if (hashBlock.IsNull()) {
+        // Empty chainstate
+        fCoinsRollingStats = true;
+        return true;
+    }
+    if (!fForceScan && pblocktree->ReadCoinsRollingStats(hashBlock, coinsRollingStats)) {
+        fCoinsRollingStats = true;
+        return true;
+    }
+
+    LogPrintf("Computing UTXO set statistics at block %s...\n", hashBlock.ToString());
+    int64_t nStart = GetTimeMillis();
+
+    if (!pcoinsTip->Flush() || !pcoinsdbview->WaitForBackgroundWrite())
+        return error("%s: failed to flush coins cache", __func__);
+
+    CCoinsRollingStats stats;
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+            return error("%s: unable to read coin", __func__);
+        stats.AddCoin(key, coin);
+    }
+
+    if (!pblocktree->WriteCoinsRollingStats(hashBlock, stats))
+        return error("%s: failed to write UTXO set statistics", __func__);
+
+    coinsRollingStats = stats;
+    fCoinsRollingStats = true;
+
+    LogPrintf("Computed UTXO set statistics of %u coins in %dms\n", stats.nTransactionOutputs, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool GetCoinsRollingStats(const uint256& hashBlock, CCoinsRollingStats& stats)
+{
+    LOCK(cs_main);
+
+    if (!fCoinsRollingStats)
+        return false;
+    if (hashBlock == pcoinsTip->GetBestBlock()) {
+        stats = coinsRollingStats;
+        return true;
+    }
+    return pblocktree->ReadCoinsRollingStats(hashBlock, stats);
+}
+
+void CChainState::SetSnapshotTip(CBlockIndex* pindex)
+{
+    // The snapshot content hash was trusted instead of validating these
+    // blocks, mark them as we would have after connecting them. Blocks we
+    // only have the header of keep BLOCK_HAVE_DATA unset, like pruned blocks,
+    // and get a placeholder transaction count so that nChainTx is set for
+    // them and for blocks connected on top of the snapshot.
+    std::vector<CBlockIndex*> vSnapshotBlocks;
+    for (CBlockIndex* pindexWalk = pindex; pindexWalk; pindexWalk = pindexWalk->pprev) {
+        if (pindexWalk->IsValid(BLOCK_VALID_SCRIPTS) && pindexWalk->nChainTx)
+            break;
+        vSnapshotBlocks.push_back(pindexWalk);
+    }
+    for (auto it = vSnapshotBlocks.rbegin(); it != vSnapshotBlocks.rend(); it++) {
+        CBlockIndex* pindexWalk = *it;
+        if (pindexWalk->nTx == 0)
+            pindexWalk->nTx = 1;
+        pindexWalk->nChainTx = (pindexWalk->pprev ? pindexWalk->pprev->nChainTx : 0) + pindexWalk->nTx;
+        if (pindexWalk->nSequenceId == 0) {
+            LOCK(cs_nBlockSequenceId);
+            pindexWalk->nSequenceId = nBlockSequenceId++;
+        }
+        pindexWalk->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindexWalk);
+    }
+
+    chainActive.SetTip(pindex);
+    setBlockIndexCandidates.insert(pindex);
+
+    // Blocks we already have above the snapshot can now be connected
+    std::deque<CBlockIndex*> queue;
+    queue.push_back(pindex);
+    while (!queue.empty()) {
+        CBlockIndex* pindexLinked = queue.front();
+        queue.pop_front();
+        auto range = mapBlocksUnlinked.equal_range(pindexLinked);
+        while (range.first != range.second) {
+            std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+            CBlockIndex* pindexChild = it->second;
+            pindexChild->nChainTx = pindexLinked->nChainTx + pindexChild->nTx;
+            {
+                LOCK(cs_nBlockSequenceId);
+                pindexChild->nSequenceId = nBlockSequenceId++;
+            }
+            if (!setBlockIndexCandidates.value_comp()(pindexChild, chainActive.Tip()))
+                setBlockIndexCandidates.insert(pindexChild);
+            queue.push_back(pindexChild);
+            range.first++;
+            mapBlocksUnlinked.erase(it);
+        }
+    }
+
+    PruneBlockIndexCandidates();
+}
+
+template<typename T>
+static void WriteSidechainStateItem(CAutoFile& fileout, CHashWriter& hasher, const T& item)
+{
+    fileout << item;
+    hasher << item;
+}
+
+bool DumpSidechainState(const fs::path& path, SidechainStateInfo& info, std::string& strError)
+{
+    SidechainPerfTimer timer("DumpSidechainState");
+
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    DBRecordList vRecord;
+    DBRecordList vArchiveRecord;
+    std::vector<uint256> vHashBMM;
+    std::vector<uint256> vDepositTXID;
+    std::vector<uint256> vHashWithdrawal;
+    std::vector<uint256> vMainBlockHash;
+    std::vector<uint256> vWithdrawalID;
+    {
+        LOCK(cs_main);
+
+        FlushStateToDisk();
+
+        // The cursor reads from a database snapshot so we can release cs_main
+        // while writing the coins
+        pcursor.reset(pcoinsdbview->Cursor());
+        info.hashBlock = pcursor->GetBestBlock();
+        info.nHeight = mapBlockIndex.count(info.hashBlock) ? mapBlockIndex[info.hashBlock]->nHeight : -1;
+
+        psidechaintree->ReadSnapshot(vRecord, vArchiveRecord);
+
+        vHashBMM = bmmCache.GetVerifiedBMMCache();
+        vDepositTXID = bmmCache.GetVerifiedDepositCache();
+        vHashWithdrawal = bmmCache.GetBroadcastedWithdrawalBundleCache();
+        vMainBlockHash = bmmCache.GetMainBlockHashCache();
+        std::set<uint256> setWithdrawalID = bmmCache.GetCachedWithdrawalID();
+        vWithdrawalID.assign(setWithdrawalID.begin(), setWithdrawalID.end());
+    }
+
+    fs::path pathNew = path;
+    pathNew += ".new";
+    CAutoFile fileout(fsbridge::fopen(pathNew, "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = "Failed to open snapshot file for writing";
+        return false;
+    }
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    info.nCoins = 0;
+    info.nRecords = vRecord.size() + vArchiveRecord.size();
+    try {
+        WriteSidechainStateItem(fileout, hasher, SIDECHAIN_STATE_DUMP_VERSION);
+        WriteSidechainStateItem(fileout, hasher, info.hashBlock);
+        WriteSidechainStateItem(fileout, hasher, info.nHeight);
+
+        // Coins, each preceded by true and terminated by false
+        for (; pcursor->Valid(); pcursor->Next()) {
+            COutPoint outpoint;
+            Coin coin;
+            if (!pcursor->GetKey(outpoint) || !pcursor->GetValue(coin)) {
+                strError = "Failed to read coin from database";
+                return false;
+            }
+            WriteSidechainStateItem(fileout, hasher, true);
+            WriteSidechainStateItem(fileout, hasher, outpoint);
+            WriteSidechainStateItem(fileout, hasher, coin);
+            info.nCoins++;
+        }
+        WriteSidechainStateItem(fileout, hasher, false);
+
+        // Sidechain database
+        WriteSidechainStateItem(fileout, hasher, vRecord);
+        WriteSidechainStateItem(fileout, hasher, vArchiveRecord);
+
+        // BMM caches
+        WriteSidechainStateItem(fileout, hasher, vHashBMM);
+        WriteSidechainStateItem(fileout, hasher, vDepositTXID);
+        WriteSidechainStateItem(fileout, hasher, vHashWithdrawal);
+        WriteSidechainStateItem(fileout, hasher, vMainBlockHash);
+        WriteSidechainStateItem(fileout, hasher, vWithdrawalID);
+
+        info.hashContent = hasher.GetHash();
+        fileout << info.hashContent;
+    }
+    catch (const std::exception& e) {
+        strError = strprintf("Error writing snapshot: %s", e.what());
+        return false;
+    }
+
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    if (!RenameOver(pathNew, path)) {
+        strError = "Failed to rename snapshot file";
+        return false;
+    }
+
+    LogPrintf("%s: Wrote %u coins and %u sidechain records at block %s\n", __func__,
+            info.nCoins, info.nRecords, info.hashBlock.ToString());
+
+    return true;
+}
+
+/** Read the header of a sidechain state snapshot */
+static bool ReadSidechainStateHeader(CHashVerifier<CAutoFile>& verifier, SidechainStateInfo& info, std::string& strError)
+{
+    int nVersion = 0;
+    verifier >> nVersion;
+    if (nVersion != SIDECHAIN_STATE_DUMP_VERSION) {
+        strError = strprintf("Unsupported snapshot version %d", nVersion);
+        return false;
+    }
+    verifier >> info.hashBlock;
+    verifier >> info.nHeight;
+
+    return true;
+}
+
+bool LoadSidechainState(const fs::path& path, const uint256& hashExpected, SidechainStateInfo& info, std::string& strError)
+{
+    SidechainPerfTimer timer("LoadSidechainState");
+
+    const CChainParams& chainparams = Params();
+
+    // First pass: check the content hash before touching any of our state
+    {
+        CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull()) {
+            strError = "Failed to open snapshot file";
+            return false;
+        }
+
+        CHashVerifier<CAutoFile> verifier(&filein);
+        try {
+            if (!ReadSidechainStateHeader(verifier, info, strError))
+                return false;
+
+            bool fMore = false;
+            info.nCoins = 0;
+            for (verifier >> fMore; fMore; verifier >> fMore) {
+                COutPoint outpoint;
+                Coin coin;
+                verifier >> outpoint;
+                verifier >> coin;
+                info.nCoins++;
+            }
+
+            DBRecordList vRecord;
+            DBRecordList vArchiveRecord;
+            std::vector<uint256> vHash;
+            verifier >> vRecord;
+            verifier >> vArchiveRecord;
+            for (int i = 0; i < 5; i++)
+                verifier >> vHash;
+            info.nRecords = vRecord.size() + vArchiveRecord.size();
+
+            info.hashContent = verifier.GetHash();
+
+            uint256 hashTrailer;
+            filein >> hashTrailer;
+            if (hashTrailer != info.hashContent) {
+                strError = "Snapshot file is corrupt";
+                return false;
+            }
+        }
+        catch (const std::exception& e) {
+            strError = strprintf("Error reading snapshot: %s", e.what());
+            return false;
+        }
+
+        if (info.hashContent != hashExpected) {
+            strError = strprintf("Snapshot content hash %s does not match the expected hash", info.hashContent.ToString());
+            return false;
+        }
+    }
+
+    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = "Failed to open snapshot file";
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+
+        // Only the header chain up to the snapshot tip is required, blocks
+        // below it are never downloaded
+        BlockMap::iterator it = mapBlockIndex.find(info.hashBlock);
+        if (it == mapBlockIndex.end()) {
+            strError = "Snapshot block header not found, sync headers first";
+            return false;
+        }
+        CBlockIndex* pindexSnapshot = it->second;
+        if (!pindexSnapshot->IsValid(BLOCK_VALID_TREE) || (pindexSnapshot->nStatus & BLOCK_FAILED_MASK)) {
+            strError = "Snapshot block is invalid";
+            return false;
+        }
+
+        SidechainStateInfo infoFile;
+        CHashVerifier<CAutoFile> verifier(&filein);
+        try {
+            if (!ReadSidechainStateHeader(verifier, infoFile, strError))
+                return false;
+        }
+        catch (const std::exception& e) {
+            strError = strprintf("Error reading snapshot: %s", e.what());
+            return false;
+        }
+
+        FlushStateToDisk();
+
+        // Nothing has been changed yet. From here on a failure leaves our
+        // state half replaced, and as blocks below the snapshot are never
+        // downloaded only -reindex can rebuild it. Shut down if that happens.
+        const std::string strAbortMessage = _("Loading a sidechain state snapshot failed. You need to rebuild the database using -reindex.");
+        if (!pblocktree->WriteFlag("sidechainstateload", true) || !pblocktree->WriteFlag("sidechainsnapshot", true)) {
+            strError = "Failed to write to block index database";
+            return AbortNode(strprintf("%s: %s", __func__, strError), strAbortMessage);
+        }
+        fHaveSnapshotChain = true;
+
+        try {
+            // Remove our coins. The cursor reads from a database snapshot,
+            // flush spent coins to the database in batches.
+            std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsdbview->Cursor());
+            for (; pcursor->Valid(); pcursor->Next()) {
+                COutPoint outpoint;
+                if (!pcursor->GetKey(outpoint))
+                    break;
+                pcoinsTip->SpendCoin(outpoint);
+                if (pcoinsTip->DynamicMemoryUsage() > SIDECHAIN_STATE_LOAD_BATCH_SIZE && !pcoinsTip->Flush())
+                    throw std::runtime_error("failed to write coins database");
+            }
+            if (!pcoinsTip->Flush())
+                throw std::runtime_error("failed to write coins database");
+
+            // Add the snapshot coins
+            bool fMore = false;
+            for (verifier >> fMore; fMore; verifier >> fMore) {
+                COutPoint outpoint;
+                Coin coin;
+                verifier >> outpoint;
+                verifier >> coin;
+                pcoinsTip->AddCoin(outpoint, std::move(coin), false);
+                if (pcoinsTip->DynamicMemoryUsage() > SIDECHAIN_STATE_LOAD_BATCH_SIZE && !pcoinsTip->Flush())
+                    throw std::runtime_error("failed to write coins database");
+            }
+            pcoinsTip->SetBestBlock(info.hashBlock);
+            if (!pcoinsTip->Flush())
+                throw std::runtime_error("failed to write coins database");
+
+            // Sidechain database
+            DBRecordList vRecord;
+            DBRecordList vArchiveRecord;
+            verifier >> vRecord;
+            verifier >> vArchiveRecord;
+            if (!psidechaintree->LoadSnapshot(vRecord, vArchiveRecord))
+                throw std::runtime_error("failed to write sidechain database");
+
+            // BMM caches
+            std::vector<uint256> vHashBMM;
+            std::vector<uint256> vDepositTXID;
+            std::vector<uint256> vHashWithdrawal;
+            std::vector<uint256> vMainBlockHash;
+            std::vector<uint256> vWithdrawalID;
+            verifier >> vHashBMM;
+            verifier >> vDepositTXID;
+            verifier >> vHashWithdrawal;
+            verifier >> vMainBlockHash;
+            verifier >> vWithdrawalID;
+
+            // Replace our caches, the journal is compacted below
+            bmmCache.ResetPersistedCaches();
+            for (const uint256& u : vHashBMM)
+                bmmCache.CacheVerifiedBMM(u);
+            for (const uint256& u : vDepositTXID)
+                bmmCache.CacheVerifiedDeposit(u);
+            for (const uint256& u : vHashWithdrawal)
+                bmmCache.StoreBroadcastedWithdrawalBundle(u);
+            for (const uint256& u : vWithdrawalID)
+                bmmCache.CacheWithdrawalID(u);
+            for (const uint256& u : vMainBlockHash)
+                bmmCache.CacheMainBlockHash(u);
+            CompactBMMCacheJournal();
+
+            // The file could have been replaced since the first pass
+            if (verifier.GetHash() != info.hashContent)
+                throw std::runtime_error("snapshot file changed while loading");
+        }
+        catch (const std::exception& e) {
+            strError = strprintf("Error loading snapshot: %s", e.what());
+            return AbortNode(strprintf("%s: %s", __func__, strError), strAbortMessage);
+        }
+
+        g_chainstate.SetSnapshotTip(pindexSnapshot);
+
+        // Transactions in our mempool were checked against the old tip
+        mempool.clear();
+
+        FlushStateToDisk();
+
+        // Statistics stored for the snapshot block describe our old coins
+        if (!LoadCoinsRollingStats(true)) {
+            strError = "Error computing UTXO set statistics of the snapshot";
+            return AbortNode(strprintf("%s: %s", __func__, strError), strAbortMessage);
+        }
+
+        pblocktree->WriteFlag("sidechainstateload", false);
+
+        LogPrintf("%s: Loaded %u coins and %u sidechain records at block %s\n", __func__,
+                info.nCoins, info.nRecords, info.hashBlock.ToString());
+    }
+
+    uiInterface.NotifyBlockTip(false, chainActive.Tip());
+
+    // Connect any blocks we have above the snapshot
+    CValidationState state;
+    ActivateBestChain(state, chainparams);
+
+    return true;
+}
+
 /** Create joined Withdrawal Bundle to be sent to the mainchain */
 bool CreateWithdrawalBundleTx(int nHeight, CTransactionRef& withdrawalBundleTx, CTransactionRef& withdrawalBundleDataTx, bool fReplicationCheck, bool fCheckUnique)
 {
+    SidechainPerfTimer timer("CreateWithdrawalBundleTx");
+
     unsigned int nMinWithdrawal = gArgs.GetArg("-minwithdrawal", DEFAULT_MIN_WITHDRAWAL_CREATE_BUNDLE);
 
     // Load the latest Withdrawal Bundle
@@ -5800,8 +6596,8 @@ bool CreateWithdrawalBundleTx(int nHeight, CTransactionRef& withdrawalBundleTx,
         }
     }
 
-    // Get Withdrawal(s) from psidechaintree
-    std::vector<SidechainWithdrawal> vWithdrawal = psidechaintree->GetWithdrawals(THIS_SIDECHAIN);
+    // Get Withdrawal(s) from psidechaintree, archived ones are all spent
+    std::vector<SidechainWithdrawal> vWithdrawal = psidechaintree->GetWithdrawals(THIS_SIDECHAIN, false /* fIncludeArchived */);
     if (vWithdrawal.empty()) {
         LogPrintf("%s: No withdrawals(s) to create bundle!\n", __func__);
         return false;
@@ -5822,19 +6618,18 @@ bool CreateWithdrawalBundleTx(int nHeight, CTransactionRef& withdrawalBundleTx,
     SidechainWithdrawalBundle withdrawalBundle;
     withdrawalBundle.nSidechain = THIS_SIDECHAIN;
 
-    CMutableTransaction wjtx; // Withdrawal Bundle
+    // Withdrawal Bundle, the mainchain fee encoding output is updated later
+    CMutableTransaction wjtx = CreateWithdrawalBundleBase();
+    CAmount amountMainchainFees = 0;
 
-    // Add SIDECHAIN_WITHDRAWAL_BUNDLE_RETURN_DEST OP_RETURN output
-    wjtx.vout.push_back(CTxOut(0, CScript() << OP_RETURN << ParseHex(HexStr(SIDECHAIN_WITHDRAWAL_BUNDLE_RETURN_DEST))));
+    // Select the withdrawals that fill the bundle with the most mainchain fees
+    std::vector<bool> vSelected = SelectWithdrawalsForBundle(nHeight, vWithdrawal);
 
-    // Add a dummy output for mainchain fee encoding (updated later)
-    CAmount amountMainchainFees = 0;
-    wjtx.vout.push_back(CTxOut(0, CScript() << OP_RETURN << CScriptNum(1LL << 40)));
+    for (size_t i = 0; i < vWithdrawal.size(); i++) {
+        if (!vSelected[i])
+            continue;
 
-    wjtx.nVersion = 2;
-    wjtx.vin.resize(1); // Dummy vin for serialization...
-    wjtx.vin[0].scriptSig = CScript() << OP_0;
-    for (const SidechainWithdrawal& withdrawal : vWithdrawal) {
+        const SidechainWithdrawal& withdrawal = vWithdrawal[i];
         CAmount amountWithdrawal = withdrawal.amount - withdrawal.mainchainFee;
 
         amountMainchainFees += withdrawal.mainchainFee;
@@ -5846,25 +6641,20 @@ bool CreateWithdrawalBundleTx(int nHeight, CTransactionRef& withdrawalBundleTx,
 
         // Add Withdrawal objid to Withdrawal Bundle obj
         withdrawalBundle.vWithdrawalID.push_back(withdrawal.GetID());
-
-        // Make sure we have room for more outputs
-        if (GetTransactionWeight(wjtx) > MAX_WITHDRAWAL_BUNDLE_WEIGHT) {
-            // If we went over size, undo this output and stop
-            withdrawalBundle.vWithdrawalID.pop_back();
-            wjtx.vout.pop_back();
-
-            // Also remove added fees
-            amountMainchainFees -= withdrawal.mainchainFee;
-
-            break;
-        }
     }
 
     // Update mainchain fee encoding output.
     wjtx.vout[1].scriptPubKey = EncodeWithdrawalFees(amountMainchainFees);
 
+    // Bundles below WithdrawalBundlePackHeight were created without this check
+    if (nHeight >= Params().GetConsensus().WithdrawalBundlePackHeight &&
+            GetTransactionWeight(wjtx) > MAX_WITHDRAWAL_BUNDLE_WEIGHT) {
+        LogPrintf("%s: ERROR: Withdrawal Bundle too large!\n", __func__);
+        return false;
+    }
+
     // Did anything make it into the Withdrawal Bundle?
-    if (!wjtx.vout.size()) {
+    if (withdrawalBundle.vWithdrawalID.empty()) {
         LogPrintf("%s: ERROR: Withdrawal Bundle empty!\n", __func__);
         return false;
     }
@@ -6046,6 +6836,8 @@ bool VerifyWithdrawalBundles(std::string& strFail, int nHeight, const std::vecto
 
 bool SortDeposits(const std::vector<SidechainDeposit>& vDeposit, std::vector<SidechainDeposit>& vDepositSorted)
 {
+    SidechainPerfTimer timer("SortDeposits");
+
     if (vDeposit.empty())
         return true;
 
@@ -6351,39 +7143,46 @@ void HandleMainchainReorg(const std::vector<uint256>& vOrphan)
             vOrphanFinal.push_back(u);
     }
 
-    // Check if any BMM blocks were created from commitments in this
-    // orphaned mainchain block
-    for (const uint256& u : vOrphanFinal) {
-        CValidationState state;
-        {
-            LOCK(cs_main);
+    // Check if any BMM blocks were created from commitments in the orphaned
+    // mainchain blocks and invalidate all of them at once, so that we only
+    // disconnect back to the deepest one and activate the best chain once.
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        std::vector<CBlockIndex*> vIndex;
+        for (const uint256& u : vOrphanFinal) {
             // Check our map of blocks based on their mainchain BMM commit block
-            if (!mapBlockMainHashIndex.count(u))
+            std::map<uint256, CBlockIndex*>::const_iterator it = mapBlockMainHashIndex.find(u);
+            if (it == mapBlockMainHashIndex.end())
                 continue;
 
-            CBlockIndex* pindex = mapBlockMainHashIndex[u];
+            CBlockIndex* pindex = it->second;
             if (!chainActive.Contains(pindex))
                 continue;
 
-            InvalidateBlock(state, Params(), pindex);
+            vIndex.push_back(pindex);
 
-            LogPrintf("%s: Invalidated block: %s because mainchain block: %s was orphaned!\n",
+            LogPrintf("%s: Invalidating block: %s because mainchain block: %s was orphaned!\n",
                     __func__, pindex->GetBlockHash().ToString(), u.ToString());
-
-            if (!state.IsValid()) {
-                LogPrintf("%s: Error while invalidating blocks: %s\n",
-                        __func__, FormatStateMessage(state));
-                return;
-            }
         }
 
-        ActivateBestChain(state, Params());
+        if (vIndex.empty())
+            return;
+
+        InvalidateBlocks(state, Params(), vIndex);
         if (!state.IsValid()) {
-            LogPrintf("%s: Error activating best chain: %s\n",
+            LogPrintf("%s: Error while invalidating blocks: %s\n",
                     __func__, FormatStateMessage(state));
             return;
         }
     }
+
+    ActivateBestChain(state, Params());
+    if (!state.IsValid()) {
+        LogPrintf("%s: Error activating best chain: %s\n",
+                __func__, FormatStateMessage(state));
+        return;
+    }
 }
 
 CScript EncodeWithdrawalFees(const CAmount& amount)
@@ -33,6 +33,7 @@
 #include <atomic>
 
 class BMMCache;
+struct BMMCacheSnapshot;
 class CBlockIndex;
 class CBlockTreeDB;
 class CSidechainTreeDB;
@@ -81,9 +82,19 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 32;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Transactions entering the mempool with at least this many inputs have their scripts checked in parallel */
+static const unsigned int MEMPOOL_PARALLEL_SCRIPT_CHECK_INPUTS = 16;
+/** Default for -prefetchinputs, read the input coins of a block in parallel before connecting it */
+static const bool DEFAULT_PREFETCH_INPUTS = true;
+/** Default for -coinsrollingstats, maintain UTXO set statistics with every block */
+static const bool DEFAULT_COINS_ROLLING_STATS = true;
+/** Number of most recent blocks of the active chain whose UTXO set statistics are kept */
+static const unsigned int COINS_ROLLING_STATS_WINDOW = 288;
+/** Number of input coins read by one prefetch job */
+static const unsigned int INPUT_PREFETCH_BATCH_SIZE = 16;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -173,11 +184,15 @@ extern CWaitableCriticalSection csBestBlock;
 extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
+/** Number of transactions whose scripts were checked on the script check threads on mempool entry */
+extern std::atomic<uint64_t> nMempoolParallelScriptChecks;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
+extern bool fPrefetchInputs;
+extern bool fCoinsRollingStatsEnabled;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
@@ -202,6 +217,8 @@ static const uint64_t nMinDiskSpace = 52428800;
 extern bool fHavePruned;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
+/** True if a sidechain state snapshot was loaded, blocks below it may have never been downloaded. */
+extern bool fHaveSnapshotChain;
 /** Number of MiB of block files that we're trying to stay below. */
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
@@ -228,6 +245,9 @@ static const char* const SIDECHAIN_TEST_SCRIPT_HEX = "76a914497f7d6b59281591c50b
 
 static const bool DEFAULT_VERIFY_WITHDRAWAL_BUNDLE_ACCEPT_BLOCK = true;
 
+/** Number of BMM cache journal entries after which the journal is compacted into the cache files */
+static const size_t BMM_JOURNAL_COMPACT_ENTRIES = 10000;
+
 extern BMMCache bmmCache;
 
 extern std::mutex mainBlockCacheMutex;
@@ -286,6 +306,8 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the input coin prefetch thread */
+void ThreadInputPrefetch();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -401,6 +423,21 @@ public:
     }
 
     ScriptError GetScriptError() const { return error; }
+    unsigned int GetInputIndex() const { return nIn; }
+    const CTransaction* GetTransaction() const { return ptxTo; }
+};
+
+template <typename T>
+struct CheckQueueOrder;
+
+/** Only the inputs of one transaction are ordered, checks of other transactions are skipped after a failure */
+template <>
+struct CheckQueueOrder<CScriptCheck> {
+    static const bool fOrdered = true;
+    static bool Before(const CScriptCheck& a, const CScriptCheck& b)
+    {
+        return a.GetTransaction() == b.GetTransaction() && a.GetInputIndex() < b.GetInputIndex();
+    }
 };
 
 /** Initializes the script-execution cache */
@@ -413,14 +450,17 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 /** Functions for validating blocks and updating the block tree */
 
-/** Verify BMM for this block with the mainchain */
-bool VerifyBMM(const CBlock& block);
+/**
+ * Verify BMM for this block with the mainchain. fCsMainHeld tells whether the
+ * caller holds cs_main, so the wait on the mainchain is counted as such.
+ */
+bool VerifyBMM(const CBlock& block, bool fCsMainHeld = true);
 
 /** Verify deposit with the mainchain */
 bool VerifyDeposit(const uint256& hashMainBlock, const uint256& txid, const int nTx);
 
 /** Context-independent validity checks */
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckMerkleRoot = true, bool fCheckBMM = true);
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckMerkleRoot = true, bool fCheckBMM = true, bool fCsMainHeld = true);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckMerkleRoot = true, bool fChekBMM = false, bool fReorg = false);
@@ -476,6 +516,9 @@ bool PreciousBlock(CValidationState& state, const CChainParams& params, CBlockIn
 /** Mark a block as invalid. */
 bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, CBlockIndex *pindex);
 
+/** Mark several blocks as invalid, disconnecting back to the deepest of them at once. */
+bool InvalidateBlocks(CValidationState& state, const CChainParams& chainparams, const std::vector<CBlockIndex*>& vIndex);
+
 /** Remove invalidity status from a block and its descendants. */
 bool ResetBlockFailureFlags(CBlockIndex *pindex);
 
@@ -525,24 +568,77 @@ bool DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
-/** Dump the BMM caches to disk. */
-void DumpBMMCache();
+/** Dump the BMM caches of snapshot to disk. */
+bool DumpBMMCache(const BMMCacheSnapshot& snapshot);
 
 /** Load the BMM caches from disk. */
 void LoadBMMCache();
 
-/** Dump the cache of mainchain block hashes to disk */
-void DumpMainBlockCache();
+/** Dump the cache of mainchain block hashes of snapshot to disk */
+bool DumpMainBlockCache(const BMMCacheSnapshot& snapshot);
 
 /** Load the cache of mainchain block hashes from disk */
 void LoadMainBlockCache();
 
-/** Dump the cache of users withdrawal IDs */
-void DumpWithdrawalIDCache();
+/** Dump the cache of users withdrawal IDs of snapshot */
+bool DumpWithdrawalIDCache(const BMMCacheSnapshot& snapshot);
 
 /** Read the cache of users withdrawal IDs */
 void LoadWithdrawalIDCache();
 
+/** Replay the BMM cache journal on top of the loaded caches and start journaling */
+void LoadBMMCacheJournal();
+
+/** Write all BMM caches to disk and clear the BMM cache journal */
+bool CompactBMMCacheJournal();
+
+/** Stop journaling BMM cache changes */
+void CloseBMMCacheJournal();
+
+/** Version of the sidechain state snapshot format */
+static const int SIDECHAIN_STATE_DUMP_VERSION = 1;
+
+/** Memory usage of the coins cache at which loading a snapshot flushes it */
+static const size_t SIDECHAIN_STATE_LOAD_BATCH_SIZE = 64 * 1024 * 1024;
+
+/**
+ * Load the UTXO set statistics (see CCoinsRollingStats) of the chain tip
+ * from the block tree database, or compute them from the coins database if
+ * they weren't stored or fForceScan is set. Blocks connected afterwards keep
+ * them up to date. Statistics of blocks other than the last
+ * COINS_ROLLING_STATS_WINDOW blocks of the active chain are erased, all of
+ * them with -coinsrollingstats=0.
+ */
+bool LoadCoinsRollingStats(bool fForceScan = false);
+
+/**
+ * UTXO set statistics after connecting the given block. Returns false if
+ * they aren't known.
+ */
+bool GetCoinsRollingStats(const uint256& hashBlock, CCoinsRollingStats& stats);
+
+/** Description of a sidechain state snapshot */
+struct SidechainStateInfo
+{
+    uint256 hashBlock;
+    int nHeight = -1;
+    uint64_t nCoins = 0;
+    uint64_t nRecords = 0;
+    uint256 hashContent;
+};
+
+/**
+ * Write the UTXO set, sidechain database and BMM caches at the current tip to
+ * a snapshot file which another node can bootstrap from.
+ */
+bool DumpSidechainState(const fs::path& path, SidechainStateInfo& info, std::string& strError);
+
+/**
+ * Replace our UTXO set, sidechain database and BMM caches with a snapshot if
+ * its content hash matches hashExpected, and make the snapshot block our tip.
+ */
+bool LoadSidechainState(const fs::path& path, const uint256& hashExpected, SidechainStateInfo& info, std::string& strError);
+
 /** Create joined Withdrawal Bundle to be sent to the mainchain */
 bool CreateWithdrawalBundleTx(int nHeight, CTransactionRef& withdrawalBundleTx, CTransactionRef& withdrawalBundleDataTx, bool fReplicationCheck = false, bool fCheckUnique = false);
 
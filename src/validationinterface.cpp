@@ -8,6 +8,7 @@
 #include <init.h>
 #include <primitives/block.h>
 #include <scheduler.h>
+#include <sidechain.h>
 #include <sync.h>
 #include <txmempool.h>
 #include <util.h>
@@ -32,6 +33,9 @@ struct MainSignalsInstance {
     boost::signals2::signal<void (int64_t nBestBlockTime, CConnman* connman)> Broadcast;
     boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
     boost::signals2::signal<void (const CBlockIndex *, const std::shared_ptr<const CBlock>&)> NewPoWValidBlock;
+    boost::signals2::signal<void (const std::vector<SidechainWithdrawal>&)> SidechainWithdrawalsUpdated;
+    boost::signals2::signal<void (const SidechainWithdrawalBundle&)> SidechainWithdrawalBundleUpdated;
+    boost::signals2::signal<void ()> SidechainDBReloaded;
 
     // We are not allowed to assume the scheduler only runs in one thread,
     // but must ensure all callbacks happen in-order, so we end up creating
@@ -86,9 +90,15 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.m_internals->Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
     g_signals.m_internals->BlockChecked.connect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.m_internals->NewPoWValidBlock.connect(boost::bind(&CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
+    g_signals.m_internals->SidechainWithdrawalsUpdated.connect(boost::bind(&CValidationInterface::SidechainWithdrawalsUpdated, pwalletIn, _1));
+    g_signals.m_internals->SidechainWithdrawalBundleUpdated.connect(boost::bind(&CValidationInterface::SidechainWithdrawalBundleUpdated, pwalletIn, _1));
+    g_signals.m_internals->SidechainDBReloaded.connect(boost::bind(&CValidationInterface::SidechainDBReloaded, pwalletIn));
 }
 
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
+    if (!g_signals.m_internals) {
+        return;
+    }
     g_signals.m_internals->BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.m_internals->Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1, _2));
     g_signals.m_internals->SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
@@ -98,6 +108,9 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.m_internals->TransactionRemovedFromMempool.disconnect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1));
     g_signals.m_internals->UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
     g_signals.m_internals->NewPoWValidBlock.disconnect(boost::bind(&CValidationInterface::NewPoWValidBlock, pwalletIn, _1, _2));
+    g_signals.m_internals->SidechainWithdrawalsUpdated.disconnect(boost::bind(&CValidationInterface::SidechainWithdrawalsUpdated, pwalletIn, _1));
+    g_signals.m_internals->SidechainWithdrawalBundleUpdated.disconnect(boost::bind(&CValidationInterface::SidechainWithdrawalBundleUpdated, pwalletIn, _1));
+    g_signals.m_internals->SidechainDBReloaded.disconnect(boost::bind(&CValidationInterface::SidechainDBReloaded, pwalletIn));
 }
 
 void UnregisterAllValidationInterfaces() {
@@ -113,6 +126,9 @@ void UnregisterAllValidationInterfaces() {
     g_signals.m_internals->TransactionRemovedFromMempool.disconnect_all_slots();
     g_signals.m_internals->UpdatedBlockTip.disconnect_all_slots();
     g_signals.m_internals->NewPoWValidBlock.disconnect_all_slots();
+    g_signals.m_internals->SidechainWithdrawalsUpdated.disconnect_all_slots();
+    g_signals.m_internals->SidechainWithdrawalBundleUpdated.disconnect_all_slots();
+    g_signals.m_internals->SidechainDBReloaded.disconnect_all_slots();
 }
 
 void CallFunctionInValidationInterfaceQueue(std::function<void ()> func) {
@@ -178,3 +194,21 @@ void CMainSignals::BlockChecked(const CBlock& block, const CValidationState& sta
 void CMainSignals::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock> &block) {
     m_internals->NewPoWValidBlock(pindex, block);
 }
+
+void CMainSignals::SidechainWithdrawalsUpdated(const std::vector<SidechainWithdrawal>& vWithdrawal) {
+    m_internals->m_schedulerClient.AddToProcessQueue([vWithdrawal, this] {
+        m_internals->SidechainWithdrawalsUpdated(vWithdrawal);
+    });
+}
+
+void CMainSignals::SidechainWithdrawalBundleUpdated(const SidechainWithdrawalBundle& withdrawalBundle) {
+    m_internals->m_schedulerClient.AddToProcessQueue([withdrawalBundle, this] {
+        m_internals->SidechainWithdrawalBundleUpdated(withdrawalBundle);
+    });
+}
+
+void CMainSignals::SidechainDBReloaded() {
+    m_internals->m_schedulerClient.AddToProcessQueue([this] {
+        m_internals->SidechainDBReloaded();
+    });
+}
@@ -10,6 +10,7 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 
 class CBlock;
 class CBlockIndex;
@@ -23,6 +24,8 @@ class uint256;
 class CScheduler;
 class CTxMemPool;
 enum class MemPoolRemovalReason;
+struct SidechainWithdrawal;
+struct SidechainWithdrawalBundle;
 
 // These functions dispatch to one or all registered wallets
 
@@ -110,6 +113,28 @@ protected:
      * Notifies listeners that a block which builds directly on our current tip
      * has been received and connected to the headers tree, though not validated yet */
     virtual void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& block) {};
+    /**
+     * Notifies listeners of withdrawals being added to the sidechain database
+     * or having their status updated.
+     *
+     * Called on a background thread.
+     */
+    virtual void SidechainWithdrawalsUpdated(const std::vector<SidechainWithdrawal>& vWithdrawal) {}
+    /**
+     * Notifies listeners of a withdrawal bundle being added to the sidechain
+     * database or having its status updated.
+     *
+     * Called on a background thread.
+     */
+    virtual void SidechainWithdrawalBundleUpdated(const SidechainWithdrawalBundle& withdrawalBundle) {}
+    /**
+     * Notifies listeners of sidechain database objects being changed in bulk
+     * without the notifications above, by a database upgrade or a snapshot
+     * load. Listeners should read the objects again.
+     *
+     * Called on a background thread.
+     */
+    virtual void SidechainDBReloaded() {}
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
@@ -150,6 +175,9 @@ public:
     void Broadcast(int64_t nBestBlockTime, CConnman* connman);
     void BlockChecked(const CBlock&, const CValidationState&);
     void NewPoWValidBlock(const CBlockIndex *, const std::shared_ptr<const CBlock>&);
+    void SidechainWithdrawalsUpdated(const std::vector<SidechainWithdrawal>&);
+    void SidechainWithdrawalBundleUpdated(const SidechainWithdrawalBundle&);
+    void SidechainDBReloaded();
 };
 
 CMainSignals& GetMainSignals();
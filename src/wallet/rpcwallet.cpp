@@ -5,7 +5,6 @@
 
 #include <amount.h>
 #include <base58.h>
-#include <bmmcache.h>
 #include <chain.h>
 #include <consensus/validation.h>
 #include <core_io.h>
@@ -3562,9 +3561,6 @@ UniValue createwithdrawal(const JSONRPCRequest& request)
         throw JSONRPCError(RPC_MISC_ERROR, strFail);
     }
 
-    // Cache user's withdrawal ID
-    bmmCache.CacheWithdrawalID(wtid);
-
     UniValue response(UniValue::VOBJ);
     response.pushKV("txid", txid.ToString());
     return response;
@@ -3676,9 +3672,15 @@ UniValue refundallwithdrawals(const JSONRPCRequest& request)
 
     ObserveSafeMode();
 
+    std::vector<uint256> vWithdrawalID;
+    {
+        LOCK(pwallet->cs_wallet);
+        for (const auto& it : pwallet->mapWithdrawal)
+            vWithdrawalID.push_back(it.first);
+    }
+
     UniValue result(UniValue::VARR);
-    std::set<uint256> setWithdrawalID = bmmCache.GetCachedWithdrawalID();
-    for (const uint256& wtID : setWithdrawalID) {
+    for (const uint256& wtID : vWithdrawalID) {
         if (wtID.IsNull()) {
             throw JSONRPCError(RPC_MISC_ERROR, "Invalid withdrawal ID!");
         }
@@ -3743,6 +3745,61 @@ UniValue refundallwithdrawals(const JSONRPCRequest& request)
     return result;
 }
 
+UniValue listmywithdrawals(const JSONRPCRequest& request)
+{
+    CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
+    if (!EnsureWalletIsAvailable(pwallet, request.fHelp)) {
+        return NullUniValue;
+    }
+
+    if (request.fHelp || request.params.size())
+        throw std::runtime_error(
+            "listmywithdrawals\n"
+            "\nList the sidechain withdrawals created by this wallet.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"id\": xxxx,                 (string) The withdrawal ID\n"
+            "    \"txid\": xxxx,               (string) The transaction which created the withdrawal, if known\n"
+            "    \"status\": xxxx,             (string) Withdrawal status, not set if the withdrawal is not in a block yet\n"
+            "    \"destination\": xxxx,        (string) Mainchain destination\n"
+            "    \"refunddestination\": xxxx,  (string) Sidechain refund destination\n"
+            "    \"amount\": n,                (numeric) Amount in satoshis\n"
+            "    \"amountmainchainfee\": n,    (numeric) Mainchain fee in satoshis\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("listmywithdrawals", "")
+            + HelpExampleRpc("listmywithdrawals", "")
+        );
+
+    std::map<uint256, uint256> mapWithdrawal;
+    {
+        LOCK(pwallet->cs_wallet);
+        mapWithdrawal = pwallet->mapWithdrawal;
+    }
+
+    UniValue result(UniValue::VARR);
+    for (const auto& it : mapWithdrawal) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("id", it.first.ToString());
+        if (!it.second.IsNull())
+            obj.pushKV("txid", it.second.ToString());
+
+        SidechainWithdrawal wt;
+        if (psidechaintree->GetWithdrawal(it.first, wt)) {
+            obj.pushKV("status", wt.GetStatusStr());
+            obj.pushKV("destination", wt.strDestination);
+            obj.pushKV("refunddestination", wt.strRefundDestination);
+            obj.pushKV("amount", wt.amount);
+            obj.pushKV("amountmainchainfee", wt.mainchainFee);
+        }
+        result.push_back(obj);
+    }
+
+    return result;
+}
+
 UniValue rescanblockchain(const JSONRPCRequest& request)
 {
     CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
@@ -4104,6 +4161,7 @@ static const CRPCCommand commands[] =
     { "sidechain",          "createwithdrawal",                 &createwithdrawal,                      {"address","refundaddress","namount","nfee", "nmainchainfee"} },
     { "sidechain",          "createwithdrawalrefundrequest",    &createwithdrawalrefundrequest,         {"id"} },
     { "sidechain",          "refundallwithdrawals",             &refundallwithdrawals,                  {} },
+    { "sidechain",          "listmywithdrawals",                &listmywithdrawals,                     {} },
 };
 
 void RegisterWalletRPCCommands(CRPCTable &t)
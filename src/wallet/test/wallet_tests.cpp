@@ -9,8 +9,11 @@
 #include <utility>
 #include <vector>
 
+#include <base58.h>
 #include <consensus/validation.h>
+#include <random.h>
 #include <rpc/server.h>
+#include <sidechain.h>
 #include <test/test_bitcoin.h>
 #include <validation.h>
 #include <wallet/coincontrol.h>
@@ -611,6 +614,77 @@ BOOST_AUTO_TEST_CASE(LoadReceiveRequests)
     BOOST_CHECK_EQUAL(values[1], "val_rr1");
 }
 
+BOOST_AUTO_TEST_CASE(LoadWithdrawals)
+{
+    uint256 id = GetRandHash();
+    uint256 txid = GetRandHash();
+    BOOST_CHECK(!pwalletMain->IsMyWithdrawal(id));
+    BOOST_CHECK(pwalletMain->AddWithdrawal(id, txid));
+    BOOST_CHECK(pwalletMain->IsMyWithdrawal(id));
+
+    // Withdrawals are read back from the wallet database
+    bool fFirstRun;
+    std::unique_ptr<CWalletDBWrapper> dbw(new CWalletDBWrapper(&bitdb, "wallet_test.dat"));
+    CWallet wallet(std::move(dbw));
+    BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+    BOOST_CHECK(wallet.IsMyWithdrawal(id));
+    LOCK(wallet.cs_wallet);
+    BOOST_CHECK(wallet.mapWithdrawal[id] == txid);
+}
+
+BOOST_AUTO_TEST_CASE(SyncWithdrawals)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    }
+
+    // A coin of the wallet to fund a withdrawal with
+    CMutableTransaction mtxFunding;
+    mtxFunding.vin.resize(1);
+    mtxFunding.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtxFunding.vout.push_back(CTxOut(10 * COIN, GetScriptForDestination(key.GetPubKey().GetID())));
+    CTransactionRef txFunding = MakeTransactionRef(mtxFunding);
+    pwalletMain->TransactionAddedToMempool(txFunding);
+
+    // Withdrawals funded by the wallet, refunding to it, and neither
+    std::vector<SidechainWithdrawal> vWithdrawal;
+    std::vector<CTransactionRef> vTx;
+    for (int i = 0; i < 3; i++) {
+        SidechainWithdrawal wt;
+        wt.nSidechain = THIS_SIDECHAIN;
+        wt.strDestination = "1BitcoinEaterAddressDontSendf59kuE";
+        wt.strRefundDestination = EncodeDestination(i == 1 ? key.GetPubKey().GetID() : keyOther.GetPubKey().GetID());
+        wt.amount = COIN;
+        wt.mainchainFee = 0;
+        wt.hashBlindTx = GetRandHash();
+        vWithdrawal.push_back(wt);
+
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = i == 0 ? COutPoint(txFunding->GetHash(), 0) : COutPoint(GetRandHash(), 0);
+        mtx.vout.push_back(CTxOut(COIN, CScript() << OP_RETURN));
+        mtx.vout.push_back(CTxOut(CAmount(0), wt.GetScript()));
+        vTx.push_back(MakeTransactionRef(mtx));
+
+        // Seen in the mempool, the same path blocks and rescans take
+        pwalletMain->TransactionAddedToMempool(vTx.back());
+    }
+
+    BOOST_CHECK(pwalletMain->IsMyWithdrawal(vWithdrawal[0].GetID()));
+    BOOST_CHECK(pwalletMain->IsMyWithdrawal(vWithdrawal[1].GetID()));
+    BOOST_CHECK(!pwalletMain->IsMyWithdrawal(vWithdrawal[2].GetID()));
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->mapWithdrawal[vWithdrawal[0].GetID()] == vTx[0]->GetHash());
+        BOOST_CHECK(pwalletMain->mapWithdrawal[vWithdrawal[1].GetID()] == vTx[1]->GetHash());
+    }
+}
+
 // TODO make functional with PrevBlockCommit
 /*
 class ListCoinsTestingSetup : public TestChain100Setup
@@ -24,7 +24,9 @@
 #include <primitives/transaction.h>
 #include <script/script.h>
 #include <scheduler.h>
+#include <sidechain.h>
 #include <timedata.h>
+#include <txdb.h>
 #include <txmempool.h>
 #include <util.h>
 #include <utilmoneystr.h>
@@ -1034,6 +1036,8 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransactionRef& ptx, const CBlockI
             }
         }
 
+        SyncWithdrawals(tx);
+
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
         if (fExisted || IsMine(tx) || IsFromMe(tx))
@@ -4039,9 +4043,16 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
 
     {
         LOCK(walletInstance->cs_wallet);
+
+        // Index the withdrawals of transactions the wallet already has, such
+        // as those of wallets from before withdrawals were stored in them
+        for (const auto& item : walletInstance->mapWallet)
+            walletInstance->SyncWithdrawals(*item.second.tx);
+
         LogPrintf("setKeyPool.size() = %u\n",      walletInstance->GetKeyPoolSize());
         LogPrintf("mapWallet.size() = %u\n",       walletInstance->mapWallet.size());
         LogPrintf("mapAddressBook.size() = %u\n",  walletInstance->mapAddressBook.size());
+        LogPrintf("mapWithdrawal.size() = %u\n",   walletInstance->mapWithdrawal.size());
     }
 
     return walletInstance;
@@ -4394,9 +4405,65 @@ bool CWallet::CreateWithdrawal(const CAmount& nAmount, const CAmount& nFee, cons
 
     txid = wtx.GetHash();
 
+    if (!AddWithdrawal(id, txid))
+        LogPrintf("%s: Failed to write withdrawal %s to wallet\n", __func__, id.ToString());
+
     return true;
 }
 
+bool CWallet::AddWithdrawal(const uint256& id, const uint256& txid)
+{
+    LOCK(cs_wallet);
+    mapWithdrawal[id] = txid;
+    return CWalletDB(*dbw).WriteWithdrawal(id, txid);
+}
+
+void CWallet::LoadWithdrawal(const uint256& id, const uint256& txid)
+{
+    AssertLockHeld(cs_wallet);
+    mapWithdrawal[id] = txid;
+}
+
+bool CWallet::IsMyWithdrawal(const uint256& id) const
+{
+    LOCK(cs_wallet);
+    return mapWithdrawal.count(id);
+}
+
+void CWallet::SyncWithdrawals(const CTransaction& tx)
+{
+    AssertLockHeld(cs_wallet);
+
+    // Only checked once a withdrawal output is found
+    int nFromMe = -1;
+    for (const CTxOut& out : tx.vout) {
+        std::vector<unsigned char> vch;
+        if (!out.scriptPubKey.IsSidechainObj(vch))
+            continue;
+
+        std::unique_ptr<SidechainObj> obj(ParseSidechainObj(vch));
+        if (!obj || obj->sidechainop != DB_SIDECHAIN_WITHDRAWAL_OP)
+            continue;
+
+        const SidechainWithdrawal* wt = (const SidechainWithdrawal *) obj.get();
+        uint256 id = wt->GetID();
+
+        std::map<uint256, uint256>::const_iterator it = mapWithdrawal.find(id);
+        if (it != mapWithdrawal.end() && it->second == tx.GetHash())
+            continue;
+
+        if (nFromMe < 0)
+            nFromMe = IsFromMe(tx);
+
+        CTxDestination dest = DecodeDestination(wt->strRefundDestination);
+        if (!nFromMe && !(IsValidDestination(dest) && ::IsMine(*this, dest)))
+            continue;
+
+        if (!AddWithdrawal(id, tx.GetHash()))
+            LogPrintf("%s: Failed to write withdrawal %s to wallet\n", __func__, id.ToString());
+    }
+}
+
 bool CWallet::CreateWithdrawalRefundRequest(const uint256& id, const std::vector<unsigned char>& vchSig, std::string& strFail, uint256& txid)
 {
     if (mempool.WithdrawalRefundExists(id)) {
@@ -835,6 +835,12 @@ public:
 
     std::map<CTxDestination, CAddressBookData> mapAddressBook;
 
+    /**
+     * Sidechain withdrawal IDs funded by this wallet or refunding to it and
+     * the transaction which created them
+     */
+    std::map<uint256, uint256> mapWithdrawal;
+
     std::set<COutPoint> setLockedCoins;
 
     const CWalletTx* GetWalletTx(const uint256& hash) const;
@@ -1161,6 +1167,19 @@ public:
     bool CreateWithdrawal(const CAmount& nAmount, const CAmount& nFee, const CAmount& nMainchainFee, const std::string& strDestination, const std::string& strRefundDestination, std::string& strFail, uint256& txid, uint256& wtid);
 
     bool CreateWithdrawalRefundRequest(const uint256& id, const std::vector<unsigned char>& vch, std::string& strFail, uint256& txid);
+
+    /** Record a sidechain withdrawal created by this wallet */
+    bool AddWithdrawal(const uint256& id, const uint256& txid);
+    /** Adds a withdrawal to the in-memory map only, used by LoadWallet */
+    void LoadWithdrawal(const uint256& id, const uint256& txid);
+    bool IsMyWithdrawal(const uint256& id) const;
+    /**
+     * Record the withdrawals created by tx which this wallet funded or which
+     * refund to it. Every transaction the wallet is synced with goes through
+     * here, from the mempool, blocks and rescans, so the index follows the
+     * chain rather than only the withdrawals this wallet created.
+     */
+    void SyncWithdrawals(const CTransaction& tx);
 };
 
 /** A key allocated from the key pool. */
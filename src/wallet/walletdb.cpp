@@ -495,6 +495,14 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
                 return false;
             }
         }
+        else if (strType == "withdrawal")
+        {
+            uint256 id;
+            uint256 txid;
+            ssKey >> id;
+            ssValue >> txid;
+            pwallet->LoadWithdrawal(id, txid);
+        }
         else if (strType == "hdchain")
         {
             CHDChain chain;
@@ -826,6 +834,11 @@ bool CWalletDB::EraseDestData(const std::string &address, const std::string &key
     return EraseIC(std::make_pair(std::string("destdata"), std::make_pair(address, key)));
 }
 
+bool CWalletDB::WriteWithdrawal(const uint256& id, const uint256& txid)
+{
+    return WriteIC(std::make_pair(std::string("withdrawal"), id), txid);
+}
+
 
 bool CWalletDB::WriteHDChain(const CHDChain& chain)
 {
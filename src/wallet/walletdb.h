@@ -210,6 +210,9 @@ public:
     /// Erase destination data tuple from wallet database
     bool EraseDestData(const std::string &address, const std::string &key);
 
+    /// Write a sidechain withdrawal ID and the transaction which created it
+    bool WriteWithdrawal(const uint256& id, const uint256& txid);
+
     CAmount GetAccountCreditDebit(const std::string& strAccount);
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& acentries);
 